@@ -0,0 +1,445 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Bricks.h"
+#include "CodecConfigCreator.h"
+#include "CodecRunner.h"
+#include "CodecSweep.h"
+#include "FileMetadata.h"
+#include "ResultSheetCreator.h"
+
+// Picks encoder settings per volume instead of one config for the whole dataset
+// A few slabs of every volume are encoded with each grid point, the fastest variant whose bits per pixel
+// are within the tolerance of the smallest wins and goes into <CODEC>-tuning.csv next to conv_metadata.csv,
+// where CodecConfigCreator::use_tuning picks it up
+class AutoTuner
+{
+private:
+    Codec m_codec;
+    std::filesystem::path m_tools_dir;
+    unsigned m_jobs;
+    ParameterGrid m_grid;
+    double m_tolerance = 0.02;
+    int m_slabs = 3, m_slab_depth = 8;
+    ProcessLimits m_limits;
+
+    // What one variant did over the slabs of one volume
+    struct Score
+    {
+        double m_bits = 0.0, m_pixels = 0.0, m_encoding_time = 0.0;
+        int m_runs = 0;
+        bool m_lossless = true;
+    };
+
+    int slab_count(const ConfigData &data) const
+    {
+        return data.m_depth <= m_slab_depth ? 1 : m_slabs;
+    }
+
+    static int power_of_two(const std::string &value)
+    {
+        int exponent = std::atoi(value.c_str());
+        return exponent < 0 || exponent > 30 ? -1 : 1 << exponent;
+    }
+
+    // Copies evenly spaced slabs of the volume into work_dir as volumes of their own
+    // A volume converted to the BRICKED format is read brick by brick, only where the slabs are
+    bool write_slabs(const std::filesystem::path &raw_path, const ConfigData &data, const std::filesystem::path &work_dir,
+                     const FileMetadata &origin, std::string &metadata_buffer) const
+    {
+        namespace fs = std::filesystem;
+        fs::path bricked_path = fs::path(raw_path).replace_extension(BrickedVolume::EXTENSION);
+        if (!fs::exists(raw_path) && fs::exists(bricked_path))
+            return write_bricked_slabs(bricked_path, data, work_dir, origin, metadata_buffer);
+        uintmax_t pixels = (uintmax_t)data.m_width * data.m_height * data.m_depth;
+        uintmax_t file_size = fs::file_size(raw_path);
+        if (!pixels || file_size % pixels)
+        {
+            std::cerr << raw_path << " does not match its dimensions" << std::endl;
+            return false;
+        }
+        size_t slice_bytes = (size_t)(file_size / data.m_depth);
+        int slab_depth = std::min(m_slab_depth, data.m_depth);
+        int slabs = slab_count(data);
+
+        int fd = ::open(raw_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cerr << "Error opening " << raw_path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::vector<char> buffer(slice_bytes * slab_depth);
+        bool ok = true;
+        for (int k = 0; k < slabs && ok; ++k)
+        {
+            // First slab at the top, last one at the bottom
+            int first = slabs == 1 ? 0 : (int)((long long)(data.m_depth - slab_depth) * k / (slabs - 1));
+            off_t offset = (off_t)first * slice_bytes;
+            size_t done = 0;
+            while (done < buffer.size())
+            {
+                ssize_t got = pread(fd, buffer.data() + done, buffer.size() - done, offset + done);
+                if (got <= 0)
+                {
+                    if (got < 0 && errno == EINTR)
+                        continue;
+                    ok = false;
+                    break;
+                }
+                done += (size_t)got;
+            }
+            std::string slab_name = data.m_name + "_slab" + std::to_string(k);
+            std::ofstream slab(work_dir / (slab_name + ".raw"), std::ios::binary);
+            ok = ok && slab.write(buffer.data(), buffer.size());
+
+            FileMetadata metadata = origin;
+            metadata.set_image_params(slab_name, data.m_width, data.m_height, slab_depth, 0);
+            metadata.get_info(metadata_buffer);
+        }
+        close(fd);
+        if (!ok)
+            std::cerr << "Could not sample " << raw_path << std::endl;
+        return ok;
+    }
+
+    bool write_bricked_slabs(const std::filesystem::path &bricked_path, const ConfigData &data,
+                             const std::filesystem::path &work_dir, const FileMetadata &origin,
+                             std::string &metadata_buffer) const
+    {
+        BrickedVolume volume;
+        if (!volume.open(bricked_path))
+        {
+            std::cerr << "Error opening " << bricked_path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (volume.width() != data.m_width || volume.height() != data.m_height || volume.depth() != data.m_depth)
+        {
+            std::cerr << bricked_path << " does not match its dimensions" << std::endl;
+            return false;
+        }
+        int slab_depth = std::min(m_slab_depth, data.m_depth);
+        int slabs = slab_count(data);
+        std::vector<uint8_t> buffer((size_t)data.m_width * data.m_height * slab_depth);
+        bool ok = true;
+        for (int k = 0; k < slabs && ok; ++k)
+        {
+            int first = slabs == 1 ? 0 : (int)((long long)(data.m_depth - slab_depth) * k / (slabs - 1));
+            ok = volume.read_slab(first, slab_depth, buffer.data(), m_jobs);
+            std::string slab_name = data.m_name + "_slab" + std::to_string(k);
+            std::ofstream slab(work_dir / (slab_name + ".raw"), std::ios::binary);
+            ok = ok && slab.write(reinterpret_cast<const char *>(buffer.data()), (std::streamsize)buffer.size());
+
+            FileMetadata metadata = origin;
+            metadata.set_image_params(slab_name, data.m_width, data.m_height, slab_depth, 0);
+            metadata.get_info(metadata_buffer);
+        }
+        if (!ok)
+            std::cerr << "Could not sample " << bricked_path << std::endl;
+        return ok;
+    }
+
+    bool tune_directory(const std::filesystem::path &dir, const std::filesystem::path &metadata_path) const
+    {
+        namespace fs = std::filesystem;
+        CodecFiles files = get_codec_files(m_codec);
+
+        // 1. Volumes and what they came from
+        std::vector<ConfigData> configDatas;
+        if (!CodecConfigCreator::read_config_datas(metadata_path, configDatas))
+            return false;
+        std::map<std::string, FileMetadata> origins;
+        {
+            CSVReader reader;
+            CSVRow row;
+            auto schema = FileMetadata::converted_schema();
+            if (reader.open(metadata_path) && reader.read_row(row) && schema.bind(row))
+            {
+                FileMetadata metadata;
+                while (reader.read_row(row))
+                    if (schema.read(row, metadata))
+                        origins[metadata.m_result_name] = metadata;
+            }
+        }
+
+        // 2. Slabs of every volume in a work directory of their own, so nothing next to the volumes is touched
+        static std::atomic<unsigned> counter{0};
+        fs::path work_dir = fs::temp_directory_path() /
+                            ("ntcomp-tune-" + std::to_string(getpid()) + "-" + std::to_string(counter++));
+        fs::create_directories(work_dir);
+        std::string metadata_buffer = FileMetadata::get_info_header();
+        std::map<std::string, const ConfigData *> slab_owner; // Slab volume -> volume
+        for (const auto &data : configDatas)
+        {
+            std::string before = metadata_buffer;
+            if (!write_slabs(dir / (data.m_name + ".raw"), data, work_dir, origins[data.m_name], metadata_buffer))
+            {
+                metadata_buffer = before;
+                continue;
+            }
+            for (int k = 0; k < slab_count(data); ++k)
+                slab_owner[data.m_name + "_slab" + std::to_string(k)] = &data;
+        }
+        {
+            std::ofstream metadata(work_dir / "conv_metadata.csv");
+            metadata << metadata_buffer;
+        }
+
+        // 3. Every slab with every grid point, configs rendered in memory, then the usual sweep table
+        CodecConfigCreator creator(m_codec == JP3D, m_codec == AVC, m_codec == HEVC, m_codec == VVC);
+        creator.set_sweep(m_grid, true);
+        CodecRunner runner(m_codec, m_tools_dir, nullptr, m_jobs);
+        runner.set_config_creator(&creator);
+        runner.set_limits(m_limits);
+        bool ok = runner.run(work_dir) && ResultSheetCreator().run_sweep(work_dir, m_codec);
+
+        // 4. Sum the slabs up per volume and variant
+        std::map<std::string, std::map<std::string, Score>> scores; // Volume -> variant -> score
+        CSVReader reader;
+        CSVRow row;
+        auto schema = SweepResult::schema();
+        if (ok && reader.open(work_dir / (files.m_name + "-sweep-results.csv")) && reader.read_row(row) && schema.bind(row))
+        {
+            SweepResult result;
+            while (reader.read_row(row))
+            {
+                if (!schema.read(row, result))
+                    continue;
+                auto owner = slab_owner.find(result.m_name);
+                if (owner == slab_owner.end())
+                    continue;
+                const ConfigData &data = *owner->second;
+                double pixels = (double)data.m_width * data.m_height * std::min(m_slab_depth, data.m_depth);
+                Score &score = scores[data.m_name][result.m_variant];
+                score.m_bits += result.m_bits_per_pixel * pixels;
+                score.m_pixels += pixels;
+                score.m_encoding_time += result.m_encoding_time;
+                score.m_runs++;
+                score.m_lossless = score.m_lossless && result.m_lossless;
+            }
+        }
+        else if (ok)
+        {
+            std::cerr << "No sweep results for " << dir << std::endl;
+            ok = false;
+        }
+
+        // 5. Fastest variant within the tolerance of the best compression, checked against the whole volume
+        std::map<std::string, ConfigOverrides> variant_overrides{{"default", {}}};
+        for (const auto &variant : m_grid.expand())
+            variant_overrides[variant.m_name] = variant.m_overrides;
+        const ConfigOverrides builtin = builtin_values(m_codec);
+        std::string buffer;
+        auto tuning_schema = TuningChoice::schema();
+        tuning_schema.write_header(buffer);
+        for (const auto &data : configDatas)
+        {
+            auto volume = scores.find(data.m_name);
+            if (volume == scores.end())
+                continue;
+            int slabs = slab_count(data);
+            double best_bpp = -1.0;
+            for (auto &[variant, score] : volume->second)
+            {
+                ConfigOverrides effective = builtin;
+                const ConfigOverrides &overrides = variant_overrides[variant];
+                effective.insert(effective.end(), overrides.begin(), overrides.end());
+                if (!score.m_lossless || score.m_runs < slabs ||
+                    !is_valid(effective, data.m_width, data.m_height, data.m_depth))
+                {
+                    score.m_lossless = false; // Out of the running
+                    continue;
+                }
+                double bpp = score.m_bits / score.m_pixels;
+                if (best_bpp < 0.0 || bpp < best_bpp)
+                    best_bpp = bpp;
+            }
+            if (best_bpp < 0.0)
+                continue; // Nothing worked, the volume keeps the plain config
+            const std::string *chosen = nullptr;
+            const Score *chosen_score = nullptr;
+            for (const auto &[variant, score] : volume->second)
+            {
+                if (!score.m_lossless || score.m_bits / score.m_pixels > best_bpp * (1.0 + m_tolerance))
+                    continue;
+                if (!chosen_score || score.m_encoding_time < chosen_score->m_encoding_time)
+                {
+                    chosen = &variant;
+                    chosen_score = &score;
+                }
+            }
+            TuningChoice choice;
+            choice.m_name = data.m_name;
+            choice.m_variant = *chosen;
+            choice.m_bits_per_pixel = chosen_score->m_bits / chosen_score->m_pixels;
+            choice.m_encoding_time = chosen_score->m_encoding_time;
+            choice.m_overrides = TuningChoice::join(variant_overrides[*chosen]);
+            tuning_schema.write(choice, buffer);
+        }
+
+        std::error_code ec;
+        fs::remove_all(work_dir, ec);
+        if (!ok)
+            return false;
+        std::ofstream tuning(dir / files.m_tuning_file_name);
+        tuning << buffer;
+        if (!tuning)
+        {
+            std::cerr << "Could not write " << (dir / files.m_tuning_file_name) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    AutoTuner(Codec codec, const std::filesystem::path &tools_dir, unsigned jobs = 1)
+        : m_codec(codec), m_tools_dir(tools_dir), m_jobs(jobs), m_grid(default_grid(codec))
+    {
+    }
+
+    // Candidates for codecs whose defaults depend most on the shape of the volume
+    // JM has nothing of the kind, AVC gets an empty grid and is not tuned
+    static ParameterGrid default_grid(Codec codec)
+    {
+        ParameterGrid grid(codec);
+        switch (codec)
+        {
+        case JP3D:
+            grid.add("levels", {"2,2,0", "3,3,1", "4,4,2", "5,5,2", "5,5,3"});
+            break;
+        case HEVC:
+            grid.add("QuadtreeTULog2MaxSize", {"3", "4", "5"});
+            break;
+        case VVC:
+            grid.add("CTUSize", {"32", "64", "128"});
+            break;
+        default:
+            break;
+        }
+        return grid;
+    }
+
+    // What the built-in configs have for the keys is_valid looks at, so the default variant is checked too
+    // (VTM picks a CTUSize of 128 when the config has none)
+    static ConfigOverrides builtin_values(Codec codec)
+    {
+        switch (codec)
+        {
+        case JP3D:
+            return {{"levels", "4,4,2"}};
+        case HEVC:
+            return {{"QuadtreeTULog2MaxSize", "5"}, {"GOPSize", "1"}, {"IntraPeriod", "1"}};
+        case VVC:
+            return {{"CTUSize", "128"}, {"GOPSize", "1"}, {"IntraPeriod", "1"}};
+        default:
+            return {};
+        }
+    }
+
+    // Whether a set of overrides makes sense for a volume of this shape, later ones win like in the configs;
+    // the slabs are shallower than the volume but the wavelet levels along z still have to fit the volume itself
+    static bool is_valid(const ConfigOverrides &overrides, int width, int height, int depth)
+    {
+        int largest = std::max(width, height);
+        std::map<std::string, std::string> values;
+        for (const auto &[key, value] : overrides)
+            values[key] = value;
+        for (const auto &[key, value] : values)
+        {
+            if (key == "levels")
+            {
+                int levels[3] = {0, 0, 0};
+                if (sscanf(value.c_str(), "%d,%d,%d", &levels[0], &levels[1], &levels[2]) != 3)
+                    return false;
+                const int dimensions[3] = {width, height, depth};
+                for (int i = 0; i < 3; ++i)
+                {
+                    if (levels[i] < 0 || levels[i] > 30 || (1 << levels[i]) > dimensions[i])
+                        return false;
+                }
+            }
+            else if (key == "GOPSize" || key == "IntraPeriod")
+            {
+                if (std::atoi(value.c_str()) > depth)
+                    return false;
+            }
+            else if (key == "CTUSize")
+            {
+                if (std::atoi(value.c_str()) >= 2 * largest)
+                    return false;
+            }
+            else if (key == "QuadtreeTULog2MaxSize")
+            {
+                int size = power_of_two(value);
+                if (size < 0 || size > largest)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    void set_grid(const ParameterGrid &grid)
+    {
+        m_grid = grid;
+    }
+
+    // How much worse than the best bits per pixel a faster variant may be, 0.02 is 2%
+    void set_tolerance(double tolerance)
+    {
+        m_tolerance = tolerance;
+    }
+
+    // Number of slabs per volume and slices per slab; shallower volumes are used whole
+    void set_sampling(int slabs, int slab_depth)
+    {
+        m_slabs = std::max(1, slabs);
+        m_slab_depth = std::max(1, slab_depth);
+    }
+
+    void set_limits(const ProcessLimits &limits)
+    {
+        m_limits = limits;
+    }
+
+    // Writes <CODEC>-tuning.csv into every directory with a conv_metadata.csv
+    bool run(const std::filesystem::path &collection_dir)
+    {
+        namespace fs = std::filesystem;
+        if (m_grid.expand().empty())
+        {
+            std::cerr << "Nothing to tune for " << get_codec_files(m_codec).m_name << std::endl;
+            return true;
+        }
+        bool ok = true;
+        try
+        {
+            std::vector<fs::path> metadata_paths;
+            for (const auto &entry : fs::recursive_directory_iterator(collection_dir))
+            {
+                if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
+                    metadata_paths.push_back(entry.path());
+            }
+            for (const auto &metadata_path : metadata_paths)
+                ok = tune_directory(metadata_path.parent_path(), metadata_path) && ok;
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return ok;
+    }
+};
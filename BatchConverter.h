@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "DicomConverter.h"
+#include "ThreadPool.h"
+
+// One row of the manifest of manifests: a TCIA download, the collection it becomes and its quotas
+// Quota columns may be left out, 0 takes the defaults of the batch
+class CollectionEntry
+{
+public:
+    std::string m_manifest_dir, m_collection;
+    int m_max_modality_occurrences = 0, m_min_slices = 0, m_min_slices_us = 0;
+    bool m_pack_histograms = false, m_copy_originals = false;
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("ManifestDir", &CollectionEntry::m_manifest_dir),
+            csv_column("Collection", &CollectionEntry::m_collection),
+            csv_column("MaxPerModality", &CollectionEntry::m_max_modality_occurrences, false),
+            csv_column("MinSlices", &CollectionEntry::m_min_slices, false),
+            csv_column("MinSlicesUS", &CollectionEntry::m_min_slices_us, false),
+            csv_column("PackHistograms", &CollectionEntry::m_pack_histograms, false),
+            csv_column("CopyOriginals", &CollectionEntry::m_copy_originals, false));
+    }
+};
+
+// Converts many TCIA collections into one collections directory at once
+// Every manifest is loaded and checked before anything is converted; then the series of all collections go
+// to one pool, largest first, while their slices load on a second pool shared by all of them, so a full
+// rebuild keeps both the cores and the disks busy; MemoryGovernor keeps the volumes held at once in budget
+class BatchConverter
+{
+private:
+    struct Collection
+    {
+        CollectionEntry m_entry;
+        std::unique_ptr<DicomConverter> m_converter;
+        bool m_ok = true;
+    };
+
+    std::filesystem::path m_collections_dir;
+    ImageFormat m_format;
+    unsigned m_threads, m_io_threads;
+    CollectionEntry m_defaults;
+    bool m_planned = false;
+    std::function<void(DicomConverter &)> m_configure;
+    std::vector<Collection> m_collections;
+
+public:
+    // threads 0 means one per core; the I/O pool mostly waits on medcon and the disks, a few are plenty
+    BatchConverter(const std::filesystem::path &collections_dir, ImageFormat format, unsigned threads = 0,
+                   unsigned io_threads = 4)
+        : m_collections_dir(collections_dir), m_format(format),
+          m_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+          m_io_threads(std::max(1u, io_threads))
+    {
+        // What main.cpp used for every collection
+        m_defaults.m_max_modality_occurrences = 8;
+        m_defaults.m_min_slices = 50;
+        m_defaults.m_min_slices_us = 3;
+    }
+
+    BatchConverter(const BatchConverter &) = delete;
+
+    // Quotas for entries that leave them out
+    void set_defaults(int max_modality_occurrences, int min_slices, int min_slices_us)
+    {
+        m_defaults.m_max_modality_occurrences = max_modality_occurrences;
+        m_defaults.m_min_slices = min_slices;
+        m_defaults.m_min_slices_us = min_slices_us;
+    }
+
+    // Called on every converter before it converts, e.g. [](DicomConverter &c) { c.set_crop_borders(); }
+    void configure(std::function<void(DicomConverter &)> configure)
+    {
+        m_configure = std::move(configure);
+    }
+
+    void add(const CollectionEntry &entry)
+    {
+        m_collections.push_back(Collection{entry, nullptr});
+    }
+
+    // ManifestDir,Collection[,MaxPerModality,MinSlices,MinSlicesUS,PackHistograms,CopyOriginals]
+    bool load(const std::filesystem::path &path)
+    {
+        CSVReader reader;
+        if (!reader.open(path))
+        {
+            std::cerr << "Error while opening " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        CSVRow row;
+        auto schema = CollectionEntry::schema();
+        if (!reader.read_row(row) || !schema.bind(row))
+        {
+            std::cerr << path << " lacks ManifestDir or Collection" << std::endl;
+            return false;
+        }
+        while (reader.read_row(row))
+        {
+            CollectionEntry entry;
+            if (!schema.read(row, entry))
+            {
+                std::cerr << "Skipping malformed row of " << path << std::endl;
+                continue;
+            }
+            add(entry);
+        }
+        return true;
+    }
+
+    // Loads every manifest and picks the first series of each collection; a collection that fails is left out,
+    // the others still run. run() plans if this was not called before
+    bool plan()
+    {
+        m_planned = true;
+        unsigned ok = 0;
+        for (auto &collection : m_collections)
+        {
+            const CollectionEntry &entry = collection.m_entry;
+            auto pick = [](int value, int fallback) { return value > 0 ? value : fallback; };
+            collection.m_converter = std::make_unique<DicomConverter>(
+                pick(entry.m_max_modality_occurrences, m_defaults.m_max_modality_occurrences),
+                pick(entry.m_min_slices, m_defaults.m_min_slices),
+                pick(entry.m_min_slices_us, m_defaults.m_min_slices_us),
+                entry.m_pack_histograms, entry.m_copy_originals, m_format);
+            if (m_configure)
+                m_configure(*collection.m_converter);
+            collection.m_ok = collection.m_converter->load_metadatas(entry.m_manifest_dir) &&
+                              collection.m_converter->prepare(m_collections_dir, entry.m_collection);
+            if (!collection.m_ok)
+                std::cerr << "Leaving out " << entry.m_collection << " from " << entry.m_manifest_dir << std::endl;
+            ok += collection.m_ok;
+        }
+        std::cout << "Converting " << ok << " of " << m_collections.size() << " collections" << std::endl;
+        return ok > 0;
+    }
+
+    // Converts everything planned, wave by wave (see DicomConverter::next_wave), and writes the metadata of
+    // every collection; false if any collection failed
+    bool run()
+    {
+        if (!m_planned && !plan())
+            return false;
+        ThreadPool pool(m_threads), io_pool(m_io_threads);
+        for (auto &collection : m_collections)
+            if (collection.m_ok)
+                collection.m_converter->set_io_pool(&io_pool);
+
+        unsigned converted = 0, failed = 0;
+        for (;;)
+        {
+            std::vector<std::pair<DicomConverter *, DicomConverter::PlannedSeries>> work;
+            for (auto &collection : m_collections)
+            {
+                std::vector<DicomConverter::PlannedSeries> wave;
+                if (!collection.m_ok)
+                    continue;
+                if (!collection.m_converter->next_wave(wave))
+                {
+                    std::cerr << "Stopping " << collection.m_entry.m_collection << std::endl;
+                    collection.m_ok = false;
+                    continue;
+                }
+                for (const auto &series : wave)
+                    work.emplace_back(collection.m_converter.get(), series);
+            }
+            if (work.empty())
+                break;
+
+            // The largest series first, so a long one does not start last and run alone
+            std::stable_sort(work.begin(), work.end(), [](const auto &a, const auto &b)
+                             { return a.second.m_metadata->m_slices > b.second.m_metadata->m_slices; });
+            std::vector<char> results(work.size(), 0);
+            for (size_t i = 0; i < work.size(); ++i)
+                pool.submit([&work, &results, i]
+                            { results[i] = work[i].first->convert_series(work[i].second); });
+            pool.wait();
+            for (char result : results)
+                (result ? converted : failed)++;
+        }
+
+        bool ok = true;
+        for (auto &collection : m_collections)
+        {
+            collection.m_converter->set_io_pool(nullptr);
+            if (collection.m_ok)
+                collection.m_converter->write_metadata();
+            ok = ok && collection.m_ok;
+        }
+        std::cout << m_collections_dir << ": converted " << converted << " series, " << failed << " failed" << std::endl;
+        return ok;
+    }
+};
@@ -0,0 +1,374 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Crop.h"
+#include "LosslessCoder.h"
+#include "ThreadPool.h"
+
+// 8 bit volume cut into cubic bricks, each stored on its own behind an offset table, so any box of the volume
+// (a slab, a preview, one brick) costs only the bricks it touches:
+//   header | brick table | brick payloads
+// Bricks go x first, then y, then z; those at the far edges hold only the voxels inside the volume, row by row.
+// A payload is LosslessCoder output where that came out smaller, the plain voxels otherwise.
+// Numbers are in host byte order, like the dataset index.
+class BrickedVolume
+{
+public:
+    static constexpr char EXTENSION[] = ".ntbrick";
+    static constexpr int DEFAULT_BRICK_SIZE = 64;
+
+    enum Coding : uint32_t
+    {
+        PLAIN = 0,
+        LOSSLESS = 1,
+    };
+
+private:
+    static constexpr char MAGIC[4] = {'N', 'T', 'B', 'K'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char m_magic[4];
+        uint32_t m_version;
+        int32_t m_width, m_height, m_depth;
+        uint32_t m_brick_size;
+        uint64_t m_bricks;
+    };
+
+    struct Brick
+    {
+        uint64_t m_offset; // From the start of the file
+        uint32_t m_size;   // Of the payload
+        uint32_t m_coding;
+    };
+
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    const Header *m_header = nullptr;
+    const Brick *m_bricks = nullptr;
+    int m_bricks_x = 0, m_bricks_y = 0, m_bricks_z = 0;
+
+    void unmap()
+    {
+        if (m_data && m_size)
+            munmap(const_cast<char *>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_header = nullptr;
+        m_bricks = nullptr;
+        m_bricks_x = m_bricks_y = m_bricks_z = 0;
+    }
+
+    static int bricks_along(int size, int brick_size)
+    {
+        return (size + brick_size - 1) / brick_size;
+    }
+
+    static CropBox box_of(size_t index, int width, int height, int depth, int brick_size)
+    {
+        size_t bricks_x = (size_t)bricks_along(width, brick_size), bricks_y = (size_t)bricks_along(height, brick_size);
+        CropBox box;
+        box.m_x = (int)(index % bricks_x) * brick_size;
+        box.m_y = (int)(index / bricks_x % bricks_y) * brick_size;
+        box.m_z = (int)(index / bricks_x / bricks_y) * brick_size;
+        box.m_width = std::min(brick_size, width - box.m_x);
+        box.m_height = std::min(brick_size, height - box.m_y);
+        box.m_depth = std::min(brick_size, depth - box.m_z);
+        return box;
+    }
+
+    static unsigned threads_for(size_t tasks, unsigned threads)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        return (unsigned)std::max<size_t>(1, std::min<size_t>(threads, tasks));
+    }
+
+public:
+    BrickedVolume() = default;
+    BrickedVolume(const BrickedVolume &) = delete;
+    BrickedVolume &operator=(const BrickedVolume &) = delete;
+    ~BrickedVolume()
+    {
+        unmap();
+    }
+
+    // Bricks are cut and coded in parallel, then written in order next to path and renamed over it
+    // brick_size 0 means DEFAULT_BRICK_SIZE; threads 0 means one per core
+    static bool write(const std::filesystem::path &path, const uint8_t *data, int width, int height, int depth,
+                      int brick_size = 0, bool compress = true, unsigned threads = 0)
+    {
+        namespace fs = std::filesystem;
+        if (brick_size <= 0)
+            brick_size = DEFAULT_BRICK_SIZE;
+        size_t count = (size_t)bricks_along(width, brick_size) * bricks_along(height, brick_size) *
+                       bricks_along(depth, brick_size);
+        std::vector<std::vector<uint8_t>> payloads(count);
+        std::vector<Brick> bricks(count);
+        threads = threads_for(count, threads);
+        {
+            ThreadPool pool(threads);
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                pool.submit([&, t]
+                            {
+                                std::vector<uint8_t> voxels;
+                                for (size_t i = t; i < count; i += threads)
+                                {
+                                    CropBox box = box_of(i, width, height, depth, brick_size);
+                                    voxels.resize((size_t)box.m_width * box.m_height * box.m_depth);
+                                    BorderCropper::crop(data, width, height, box, voxels.data());
+                                    bricks[i].m_coding = PLAIN;
+                                    if (compress)
+                                    {
+                                        LosslessCoder::encode(voxels.data(), voxels.size(), payloads[i]);
+                                        if (payloads[i].size() < voxels.size())
+                                        {
+                                            bricks[i].m_coding = LOSSLESS;
+                                            continue;
+                                        }
+                                    }
+                                    payloads[i] = voxels;
+                                }
+                            });
+            }
+            pool.wait();
+        }
+
+        Header header{};
+        memcpy(header.m_magic, MAGIC, 4);
+        header.m_version = VERSION;
+        header.m_width = width;
+        header.m_height = height;
+        header.m_depth = depth;
+        header.m_brick_size = (uint32_t)brick_size;
+        header.m_bricks = count;
+        uint64_t offset = sizeof(Header) + count * sizeof(Brick);
+        for (size_t i = 0; i < count; ++i)
+        {
+            bricks[i].m_offset = offset;
+            bricks[i].m_size = (uint32_t)payloads[i].size();
+            offset += payloads[i].size();
+        }
+
+        fs::path temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(bricks.data()), (std::streamsize)(count * sizeof(Brick)));
+            for (const auto &payload : payloads)
+                file.write(reinterpret_cast<const char *>(payload.data()), (std::streamsize)payload.size());
+            if (!file)
+            {
+                std::cerr << "Could not write " << temp_path << std::endl;
+                std::error_code ec;
+                fs::remove(temp_path, ec);
+                return false;
+            }
+        }
+        fs::rename(temp_path, path);
+        return true;
+    }
+
+    // False with errno set when the file cannot be mapped, with errno EINVAL when it is not a bricked volume
+    bool open(const std::filesystem::path &path)
+    {
+        unmap();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+        {
+            close(fd);
+            errno = EINVAL;
+            return false;
+        }
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            errno = error;
+            return false;
+        }
+        m_data = static_cast<const char *>(data);
+        m_size = (size_t)st.st_size;
+
+        m_header = reinterpret_cast<const Header *>(m_data);
+        if (memcmp(m_header->m_magic, MAGIC, 4) != 0 || m_header->m_version != VERSION || m_header->m_brick_size == 0 ||
+            m_header->m_width < 0 || m_header->m_height < 0 || m_header->m_depth < 0)
+        {
+            unmap();
+            errno = EINVAL;
+            return false;
+        }
+        int brick_size = (int)m_header->m_brick_size;
+        m_bricks_x = bricks_along(m_header->m_width, brick_size);
+        m_bricks_y = bricks_along(m_header->m_height, brick_size);
+        m_bricks_z = bricks_along(m_header->m_depth, brick_size);
+        uint64_t count = (uint64_t)m_bricks_x * m_bricks_y * m_bricks_z;
+        if (m_header->m_bricks != count || sizeof(Header) + count * sizeof(Brick) > m_size)
+        {
+            unmap();
+            errno = EINVAL;
+            return false;
+        }
+        m_bricks = reinterpret_cast<const Brick *>(m_data + sizeof(Header));
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if (m_bricks[i].m_offset + m_bricks[i].m_size > m_size)
+            {
+                unmap();
+                errno = EINVAL;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int width() const
+    {
+        return m_header ? m_header->m_width : 0;
+    }
+
+    int height() const
+    {
+        return m_header ? m_header->m_height : 0;
+    }
+
+    int depth() const
+    {
+        return m_header ? m_header->m_depth : 0;
+    }
+
+    int brick_size() const
+    {
+        return m_header ? (int)m_header->m_brick_size : 0;
+    }
+
+    size_t brick_count() const
+    {
+        return m_header ? (size_t)m_header->m_bricks : 0;
+    }
+
+    // Where a brick sits in the volume, its voxels are box.m_width * box.m_height * box.m_depth
+    CropBox brick_box(size_t index) const
+    {
+        return box_of(index, width(), height(), depth(), brick_size());
+    }
+
+    size_t brick_index(int brick_x, int brick_y, int brick_z) const
+    {
+        return ((size_t)brick_z * m_bricks_y + brick_y) * m_bricks_x + brick_x;
+    }
+
+    // Stored size of a brick, for telling how well it compressed
+    size_t payload_size(size_t index) const
+    {
+        return m_bricks[index].m_size;
+    }
+
+    // Decodes one brick, out has to hold its box; safe to call from several threads at once
+    bool read_brick(size_t index, uint8_t *out) const
+    {
+        if (index >= brick_count())
+            return false;
+        const Brick &brick = m_bricks[index];
+        CropBox box = brick_box(index);
+        size_t voxels = (size_t)box.m_width * box.m_height * box.m_depth;
+        const uint8_t *payload = reinterpret_cast<const uint8_t *>(m_data + brick.m_offset);
+        switch (brick.m_coding)
+        {
+        case PLAIN:
+            if (brick.m_size != voxels)
+                return false;
+            memcpy(out, payload, voxels);
+            return true;
+        case LOSSLESS:
+            return LosslessCoder::decode(payload, brick.m_size, out, voxels);
+        default:
+            return false;
+        }
+    }
+
+    // Any box of the volume into out, box.m_width * box.m_height * box.m_depth voxels; only the bricks it
+    // touches are decoded, those in parallel; threads 0 means one per core
+    bool read_box(const CropBox &box, uint8_t *out, unsigned threads = 0) const
+    {
+        if (!m_header || box.is_empty() || box.m_x < 0 || box.m_y < 0 || box.m_z < 0 ||
+            box.m_x + box.m_width > width() || box.m_y + box.m_height > height() || box.m_z + box.m_depth > depth())
+            return false;
+        int size = brick_size();
+        std::vector<size_t> touched;
+        for (int bz = box.m_z / size; bz <= (box.m_z + box.m_depth - 1) / size; ++bz)
+            for (int by = box.m_y / size; by <= (box.m_y + box.m_height - 1) / size; ++by)
+                for (int bx = box.m_x / size; bx <= (box.m_x + box.m_width - 1) / size; ++bx)
+                    touched.push_back(brick_index(bx, by, bz));
+
+        threads = threads_for(touched.size(), threads);
+        std::vector<char> failed(threads, 0);
+        {
+            ThreadPool pool(threads);
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                pool.submit([&, t]
+                            {
+                                std::vector<uint8_t> voxels;
+                                for (size_t k = t; k < touched.size(); k += threads)
+                                {
+                                    CropBox brick = brick_box(touched[k]);
+                                    voxels.resize((size_t)brick.m_width * brick.m_height * brick.m_depth);
+                                    if (!read_brick(touched[k], voxels.data()))
+                                    {
+                                        failed[t] = 1;
+                                        return;
+                                    }
+                                    // Overlap of brick and box, copied row by row; bricks never share a voxel
+                                    int x0 = std::max(box.m_x, brick.m_x), x1 = std::min(box.m_x + box.m_width, brick.m_x + brick.m_width);
+                                    int y0 = std::max(box.m_y, brick.m_y), y1 = std::min(box.m_y + box.m_height, brick.m_y + brick.m_height);
+                                    int z0 = std::max(box.m_z, brick.m_z), z1 = std::min(box.m_z + box.m_depth, brick.m_z + brick.m_depth);
+                                    for (int z = z0; z < z1; ++z)
+                                    {
+                                        for (int y = y0; y < y1; ++y)
+                                        {
+                                            const uint8_t *from = voxels.data() +
+                                                                  (((size_t)(z - brick.m_z) * brick.m_height + (y - brick.m_y)) * brick.m_width + (x0 - brick.m_x));
+                                            uint8_t *to = out + (((size_t)(z - box.m_z) * box.m_height + (y - box.m_y)) * box.m_width + (x0 - box.m_x));
+                                            memcpy(to, from, (size_t)(x1 - x0));
+                                        }
+                                    }
+                                }
+                            });
+            }
+            pool.wait();
+        }
+        return std::none_of(failed.begin(), failed.end(), [](char f) { return f != 0; });
+    }
+
+    // Slices first to first + slices - 1, whole
+    bool read_slab(int first, int slices, uint8_t *out, unsigned threads = 0) const
+    {
+        return read_box(CropBox{0, 0, first, width(), height(), slices}, out, threads);
+    }
+
+    bool read_all(std::vector<uint8_t> &volume, unsigned threads = 0) const
+    {
+        volume.resize((size_t)width() * height() * depth());
+        return volume.empty() || read_slab(0, depth(), volume.data(), threads);
+    }
+};
@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fields of one row, pointing into the mapped file; valid until the next read_row or until the reader goes away
+class CSVRow
+{
+private:
+    friend class CSVReader;
+    std::vector<std::string_view> m_fields;
+    std::deque<std::string> m_unescaped; // Quoted fields with "" inside need a copy without them
+
+public:
+    std::string_view operator[](std::size_t index) const
+    {
+        return m_fields[index];
+    }
+    std::size_t size() const
+    {
+        return m_fields.size();
+    }
+};
+
+// RFC 4180 reader over a memory-mapped file: quoted fields may hold commas, newlines and "" escapes
+// Separators, quotes and line ends are found 16 bytes at a time; the bitmask of a block is kept
+// between calls, so a row costs one pass over its bytes and no copies
+class CSVReader
+{
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_pos = 0;
+
+    // Special characters of the block starting at m_block, bits below the last position asked for cleared
+    size_t m_block = 0;
+    unsigned m_mask = 0;
+    bool m_mask_valid = false;
+
+    static bool is_special(char c)
+    {
+        return c == ',' || c == '"' || c == '\n' || c == '\r';
+    }
+
+    // First , " \n or \r at or after pos, m_size if there is none
+    size_t find_special(size_t pos)
+    {
+#ifdef __SSE2__
+        const __m128i comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"');
+        const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+        if (!m_mask_valid || pos < m_block || pos >= m_block + 16)
+        {
+            m_block = pos;
+            m_mask_valid = false;
+        }
+        while (m_block + 16 <= m_size)
+        {
+            if (!m_mask_valid)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_data + m_block));
+                __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, quote)),
+                                            _mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr)));
+                m_mask = (unsigned)_mm_movemask_epi8(hits);
+                m_mask_valid = true;
+            }
+            unsigned mask = m_mask & (~0u << (pos > m_block ? pos - m_block : 0));
+            if (mask)
+                return m_block + __builtin_ctz(mask);
+            m_block += 16;
+            m_mask_valid = false;
+        }
+        pos = std::max(pos, m_block);
+#endif
+        while (pos < m_size && !is_special(m_data[pos]))
+            ++pos;
+        return pos;
+    }
+
+    void unmap()
+    {
+        if (m_data && m_size)
+            munmap(const_cast<char *>(m_data), m_size);
+        m_data = nullptr;
+        m_size = m_pos = 0;
+        m_mask_valid = false;
+    }
+
+public:
+    CSVReader() = default;
+    CSVReader(const CSVReader &) = delete;
+    CSVReader &operator=(const CSVReader &) = delete;
+    ~CSVReader()
+    {
+        unmap();
+    }
+
+    // False with errno set if the file cannot be opened or mapped
+    bool open(const std::filesystem::path &path)
+    {
+        unmap();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return false;
+        }
+        if (st.st_size > 0)
+        {
+            void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                int error = errno;
+                close(fd);
+                errno = error;
+                return false;
+            }
+            madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char *>(data);
+            m_size = (size_t)st.st_size;
+        }
+        close(fd); // The mapping keeps the file alive
+        return true;
+    }
+
+    // Next non-empty row, false at the end of the file; \n, \r\n and \r all end a row
+    bool read_row(CSVRow &row)
+    {
+        row.m_fields.clear();
+        row.m_unescaped.clear();
+        while (m_pos < m_size && (m_data[m_pos] == '\n' || m_data[m_pos] == '\r'))
+            ++m_pos;
+        if (m_pos >= m_size)
+            return false;
+
+        size_t field_start = m_pos;
+        size_t pos = m_pos;
+        for (;;)
+        {
+            if (m_data[field_start] == '"')
+            {
+                // Quoted field: only the next quote matters, "" is an escaped quote
+                bool escaped = false;
+                size_t close = field_start + 1;
+                for (;;)
+                {
+                    const void *quote = memchr(m_data + close, '"', m_size - close);
+                    close = quote ? (size_t)(static_cast<const char *>(quote) - m_data) : m_size;
+                    if (close + 1 < m_size && m_data[close + 1] == '"')
+                    {
+                        escaped = true;
+                        close += 2;
+                        continue;
+                    }
+                    break;
+                }
+                std::string_view field(m_data + field_start + 1, std::min(close, m_size) - field_start - 1);
+                if (escaped)
+                {
+                    std::string &copy = row.m_unescaped.emplace_back();
+                    copy.reserve(field.size());
+                    for (size_t i = 0; i < field.size(); ++i)
+                    {
+                        copy.push_back(field[i]);
+                        if (field[i] == '"')
+                            ++i;
+                    }
+                    field = copy;
+                }
+                row.m_fields.push_back(field);
+                // Anything between the closing quote and the separator is dropped
+                pos = close + 1;
+                while ((pos = find_special(pos)) < m_size && m_data[pos] == '"')
+                    ++pos;
+            }
+            else
+            {
+                // Quotes inside an unquoted field are ordinary characters
+                pos = field_start;
+                while ((pos = find_special(pos)) < m_size && m_data[pos] == '"')
+                    ++pos;
+                row.m_fields.emplace_back(m_data + field_start, pos - field_start);
+            }
+
+            if (pos >= m_size)
+            {
+                m_pos = m_size;
+                return true;
+            }
+            if (m_data[pos] == ',')
+            {
+                field_start = pos + 1;
+                if (field_start >= m_size)
+                {
+                    row.m_fields.emplace_back(); // Trailing comma at the very end
+                    m_pos = m_size;
+                    return true;
+                }
+                continue;
+            }
+            // Line end
+            m_pos = pos + 1;
+            if (m_data[pos] == '\r' && m_pos < m_size && m_data[m_pos] == '\n')
+                ++m_pos;
+            return true;
+        }
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "CSVReader.h"
+#include "Hash.h"
+
+// One column of a record type: header name and the member it lands in
+template <typename Record, typename T>
+struct CSVColumn
+{
+    const char *m_name;
+    T Record::*m_member;
+    bool m_required;
+};
+
+template <typename Record, typename T>
+constexpr CSVColumn<Record, T> csv_column(const char *name, T Record::*member, bool required = true)
+{
+    return {name, member, required};
+}
+
+// Maps header names to members of Record, fixed at compile time; numbers are parsed once with from_chars
+// on the way in and written with to_chars on the way out, always into a buffer the caller reuses
+// Usage: auto schema = Record::schema(); schema.bind(header_row); while (...) schema.read(row, record);
+template <typename Record, typename... Ts>
+class CSVSchema
+{
+private:
+    static constexpr size_t COUNT = sizeof...(Ts);
+    static constexpr size_t ABSENT = SIZE_MAX;
+    std::tuple<CSVColumn<Record, Ts>...> m_columns;
+    std::array<size_t, COUNT> m_positions; // Column of the current file, by default the order we write in
+
+    static std::string_view trim(std::string_view text)
+    {
+        size_t start = text.find_first_not_of(" \t");
+        if (start == std::string_view::npos)
+            return {};
+        return text.substr(start, text.find_last_not_of(" \t") + 1 - start);
+    }
+
+    static bool parse(std::string_view text, std::string &value)
+    {
+        value.assign(text.data(), text.size());
+        return true;
+    }
+
+    static bool parse(std::string_view text, bool &value)
+    {
+        text = trim(text);
+        value = text == "1" || text == "true";
+        return value || text == "0" || text == "false";
+    }
+
+    // Hex as Hash128::to_string writes it, empty for a hash that is not known
+    static bool parse(std::string_view text, Hash128 &value)
+    {
+        text = trim(text);
+        value = Hash128();
+        return text.empty() || Hash128::from_string(text, value);
+    }
+
+    template <typename T>
+    static std::enable_if_t<std::is_arithmetic_v<T>, bool> parse(std::string_view text, T &value)
+    {
+        text = trim(text);
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && ptr == text.data() + text.size() && !text.empty();
+    }
+
+    static void format(const std::string &value, std::string &out)
+    {
+        if (value.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            out += value;
+            return;
+        }
+        out.push_back('"');
+        for (char c : value)
+        {
+            if (c == '"')
+                out.push_back('"');
+            out.push_back(c);
+        }
+        out.push_back('"');
+    }
+
+    static void format(const Hash128 &value, std::string &out)
+    {
+        if (value != Hash128())
+            out += value.to_string();
+    }
+
+    static void format(bool value, std::string &out)
+    {
+        out.push_back(value ? '1' : '0');
+    }
+
+    // Floating point as %f, so the sheets read the same as when they were written with std::to_string
+    template <typename T>
+    static std::enable_if_t<std::is_arithmetic_v<T>> format(T value, std::string &out)
+    {
+        char buffer[128];
+        std::to_chars_result result;
+        if constexpr (std::is_floating_point_v<T>)
+            result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, 6);
+        else
+            result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+    }
+
+    template <size_t I>
+    bool read_column(const CSVRow &row, Record &record) const
+    {
+        const auto &column = std::get<I>(m_columns);
+        size_t position = m_positions[I];
+        if (position >= row.size())
+        {
+            record.*(column.m_member) = {}; // Optional and not in this row
+            return !column.m_required;
+        }
+        return parse(row[position], record.*(column.m_member));
+    }
+
+    template <size_t... I>
+    bool read_columns(const CSVRow &row, Record &record, std::index_sequence<I...>) const
+    {
+        return (read_column<I>(row, record) && ...);
+    }
+
+    template <size_t... I>
+    void write_columns(const Record &record, std::string &out, std::index_sequence<I...>) const
+    {
+        ((out.append(I ? "," : ""), format(record.*(std::get<I>(m_columns).m_member), out)), ...);
+    }
+
+    template <size_t... I>
+    void write_names(std::string &out, std::index_sequence<I...>) const
+    {
+        ((out.append(I ? "," : ""), out.append(std::get<I>(m_columns).m_name)), ...);
+    }
+
+    template <size_t I>
+    bool bind_column(const CSVRow &header)
+    {
+        const auto &column = std::get<I>(m_columns);
+        for (size_t i = 0; i < header.size(); ++i)
+        {
+            std::string_view name = trim(header[i]);
+            if (i == 0 && name.substr(0, 3) == "\xEF\xBB\xBF")
+                name.remove_prefix(3); // UTF-8 BOM, TCIA manifests have one
+            if (name == column.m_name)
+            {
+                m_positions[I] = i;
+                return true;
+            }
+        }
+        // Past the end of the header it can still be a column appended to rows before the header knew it;
+        // where the header names some other column it is not in this file at all
+        m_positions[I] = I < header.size() ? ABSENT : I;
+        return !column.m_required;
+    }
+
+    template <size_t... I>
+    bool bind_columns(const CSVRow &header, std::index_sequence<I...>)
+    {
+        return (bind_column<I>(header) & ...); // Bind all of them even if one is missing
+    }
+
+public:
+    constexpr CSVSchema(CSVColumn<Record, Ts>... columns) : m_columns(columns...), m_positions()
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            m_positions[i] = i;
+    }
+
+    // Finds the columns in a header row; optional columns missing from it are looked for where we write them
+    // if the header ends before that, which is where rows appended by newer code have them.
+    // False if a required one is missing.
+    bool bind(const CSVRow &header)
+    {
+        return bind_columns(header, std::index_sequence_for<Ts...>());
+    }
+
+    // False if a required column is missing or does not parse, e.g. on a repeated header row
+    bool read(const CSVRow &row, Record &record) const
+    {
+        return read_columns(row, record, std::index_sequence_for<Ts...>());
+    }
+
+    void write_header(std::string &out) const
+    {
+        write_names(out, std::index_sequence_for<Ts...>());
+        out.push_back('\n');
+    }
+
+    // Appends one line
+    void write(const Record &record, std::string &out) const
+    {
+        write_columns(record, out, std::index_sequence_for<Ts...>());
+        out.push_back('\n');
+    }
+
+    std::string header() const
+    {
+        std::string out;
+        write_header(out);
+        return out;
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "CSVSchema.h"
+
+enum Codec
+{
+    AVC,
+    HEVC,
+    VVC,
+    JP3D,
+};
+
+// Names of everything a codec reads and leaves behind, same as in tools/*/run.sh
+struct CodecFiles
+{
+    std::string m_name;
+    std::string m_log_enc_name, m_log_dec_name;
+    std::string m_config_ext, m_config_dec_ext;
+    std::string m_enc_ext, m_dec_ext;
+    std::string m_result_file_name;
+    std::string m_tuning_file_name; // Written by AutoTuner, read by CodecConfigCreator
+    std::string m_encoder, m_decoder;
+    std::vector<std::string> m_tools;
+    std::vector<std::string> m_leftovers;
+    bool m_shared_workdir = false; // Writes fixed-name side files, so runs in one directory must not overlap
+};
+
+inline CodecFiles get_codec_files(Codec codec)
+{
+    CodecFiles files;
+    switch (codec)
+    {
+    case (AVC):
+        files.m_name = "AVC";
+        files.m_config_ext = ".cfg264e";
+        files.m_config_dec_ext = ".cfg264d";
+        files.m_enc_ext = ".264e";
+        files.m_dec_ext = ".264d";
+        files.m_encoder = "lencod";
+        files.m_decoder = "ldecod";
+        files.m_tools = {"lencod", "ldecod", "lossless.dcfg264e"};
+        files.m_leftovers = {"log.dec", "dataDec.txt", "stats.dat", "log.dat", "leakybucketparam.cfg", "data.txt"};
+        files.m_shared_workdir = true;
+        break;
+    case (HEVC):
+        files.m_name = "HEVC";
+        files.m_config_ext = ".cfg265e";
+        files.m_enc_ext = ".265e";
+        files.m_dec_ext = ".265d";
+        files.m_encoder = "TAppEncoder";
+        files.m_decoder = "TAppDecoder";
+        files.m_tools = {"TAppEncoder", "TAppDecoder"};
+        break;
+    case (VVC):
+        files.m_name = "VVC";
+        files.m_config_ext = ".cfg266e";
+        files.m_enc_ext = ".266e";
+        files.m_dec_ext = ".266d";
+        files.m_encoder = "EncoderApp";
+        files.m_decoder = "DecoderApp";
+        files.m_tools = {"EncoderApp", "DecoderApp"};
+        break;
+    case (JP3D):
+        files.m_name = "JP3D";
+        files.m_config_ext = ".sh";
+        files.m_enc_ext = ".jp3de";
+        files.m_dec_ext = ".jp3dd";
+        files.m_encoder = "jp3d";
+        files.m_decoder = "jp3d";
+        files.m_tools = {"jp3d"};
+        break;
+    }
+    files.m_log_enc_name = files.m_name + "-enc.log";
+    files.m_log_dec_name = files.m_name + "-dec.log";
+    files.m_result_file_name = files.m_name + "-results.csv";
+    files.m_tuning_file_name = files.m_name + "-tuning.csv";
+    return files;
+}
+
+// One row of <CODEC>-enc.log or -dec.log: ./<config or bitstream file>, seconds and, in logs written by CodecRunner, the status
+struct LogEntry
+{
+    std::string m_file;
+    double m_time = 0.0;
+    std::string m_status;
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("File", &LogEntry::m_file),
+            csv_column("Time", &LogEntry::m_time),
+            csv_column("Status", &LogEntry::m_status, false));
+    }
+
+    // Name of the volume or sweep variant the row is about, without ./ and the extension; empty if it is not a file
+    std::string_view config_name() const
+    {
+        std::string_view name = m_file;
+        size_t dot_index = name.find_last_of('.');
+        if (dot_index == std::string_view::npos || dot_index < 2)
+            return {};
+        return name.substr(2, dot_index - 2);
+    }
+};
@@ -1,44 +1,116 @@
-#include "CSVRow.h"
+#pragma once
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "CodecSweep.h"
+#include "ConfigTemplate.h"
+#include "DatasetIndex.h"
+#include "DirectoryWriter.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
 #include <string.h>
 #include <format>
-#include <regex>
 
 class ConfigData
 {
 private:
     using s = std::string;
-    using sv = std::string_view;
 
 public:
-    const s m_name, m_width, m_height, m_depth;
+    s m_name;
+    int m_width = 0, m_height = 0, m_depth = 0;
+    int m_bit_depth = 0; // Effective, 0 if not known
+    s m_duplicate_of;    // Duplicates get no configs, see DicomConverter::dedup_converted
 
-    ConfigData(const s &name, const s &width, const s &height, const s &depth)
-        : m_name(name), m_width(width), m_height(height), m_depth(depth) {}
+    ConfigData() = default;
 
-    ConfigData(sv name, sv width, sv height, sv depth)
-        : m_name(s(name)), m_width(s(width)), m_height(s(height)), m_depth(s(depth)) {}
+    ConfigData(const s &name, int width, int height, int depth)
+        : m_name(name), m_width(width), m_height(height), m_depth(depth) {}
 
-    enum Field
+    // The columns of conv_metadata.csv a config needs
+    static constexpr auto schema()
     {
-        Name = 0,
-        Width = 3,
-        Height = 4,
-        Depth = 5,
-    };
+        return CSVSchema(
+            csv_column("Name", &ConfigData::m_name),
+            csv_column("Width", &ConfigData::m_width),
+            csv_column("Height", &ConfigData::m_height),
+            csv_column("Depth", &ConfigData::m_depth),
+            csv_column("BitDepth", &ConfigData::m_bit_depth, false),
+            csv_column("DuplicateOf", &ConfigData::m_duplicate_of, false));
+    }
 };
 
 class CodecConfigCreator
 {
 private:
     bool m_jp3d, m_avc, m_hevc, m_vvc;
+    bool m_use_tuning = false;
+    std::map<Codec, std::vector<ConfigVariant>> m_sweeps;
 
-    std::string create_config_hevc(const ConfigData &configData) const
+    // HM, VTM and JM configs are "Key<separator>value" lines; overridden keys get their value replaced,
+    // keys the template does not have are appended
+    static void apply_overrides(std::string &config, char separator, const ConfigVariant &variant)
     {
-        std::string config(
-            R"(
+        for (const auto &[key, value] : variant.m_overrides)
+        {
+            bool replaced = false;
+            size_t line_start = 0;
+            while (line_start < config.size())
+            {
+                size_t line_end = config.find('\n', line_start);
+                if (line_end == std::string::npos)
+                    line_end = config.size();
+                size_t sep = config.find(separator, line_start);
+                if (sep != std::string::npos && sep < line_end)
+                {
+                    size_t key_start = config.find_first_not_of(" \t", line_start);
+                    size_t key_end = config.find_last_not_of(" \t", sep - 1);
+                    if (key_start < sep && config.compare(key_start, key_end + 1 - key_start, key) == 0)
+                    {
+                        std::string line = key + " " + separator + " " + value;
+                        config.replace(line_start, line_end - line_start, line);
+                        replaced = true;
+                        break;
+                    }
+                }
+                line_start = line_end + 1;
+            }
+            if (!replaced)
+            {
+                if (!config.empty() && config.back() != '\n')
+                    config += "\n";
+                config += key + " " + separator + " " + value + "\n";
+            }
+        }
+    }
+
+    // jp3d takes everything on the command line as --key=value
+    static void apply_jp3d_overrides(std::string &config, const ConfigVariant &variant)
+    {
+        for (const auto &[key, value] : variant.m_overrides)
+        {
+            std::string option = "--" + key + "=";
+            size_t pos = config.find(option);
+            if (pos != std::string::npos)
+            {
+                size_t end = config.find(' ', pos);
+                config.replace(pos, end - pos, option + value);
+            }
+            else
+            {
+                size_t after_mode = config.find(" -c ") + 3;
+                config.insert(after_mode, " " + option + value);
+            }
+        }
+    }
+
+    static constexpr std::string_view HEVC_TEMPLATE = R"(
 InputFile: XnameX.raw
-BitstreamFile: XnameX.265e
+BitstreamFile: XoutX.265e
 SourceWidth: XwidthX
 SourceHeight: XheightX
 FramesToBeEncoded: XdepthX
@@ -55,41 +127,25 @@ ConstrainedIntraPred: 1
 SAO: 0
 QuadtreeTULog2MaxSize: 5
 ConformanceWindowMode: 1
-            )");
-        config = std::regex_replace(config, std::regex("XnameX"), configData.m_name);
-        config = std::regex_replace(config, std::regex("XwidthX"), configData.m_width);
-        config = std::regex_replace(config, std::regex("XheightX"), configData.m_height);
-        config = std::regex_replace(config, std::regex("XdepthX"), configData.m_depth);
-        return config;
-    }
+            )";
+    static_assert(ConfigTemplate::count_placeholders(HEVC_TEMPLATE) == 5);
 
-    std::string create_config_avc_enc(const ConfigData &configData) const
-    {
-        std::string config(
-            R"(
+    static constexpr std::string_view AVC_ENC_TEMPLATE = R"(
 InputFile = "XnameX.raw"
-ReconFile = "XnameX_rec.raw"
-OutputFile = "XnameX.264e"
+ReconFile = "XoutX_rec.raw"
+OutputFile = "XoutX.264e"
 SourceWidth = XwidthX
 SourceHeight = XheightX
 OutputWidth = XwidthX
 OutputHeight = XheightX
 FramesToBeEncoded = XdepthX
-            )");
-        config = std::regex_replace(config, std::regex("XnameX"), configData.m_name);
-        config = std::regex_replace(config, std::regex("XwidthX"), configData.m_width);
-        config = std::regex_replace(config, std::regex("XheightX"), configData.m_height);
-        config = std::regex_replace(config, std::regex("XdepthX"), configData.m_depth);
-        return config;
-    }
+            )";
+    static_assert(ConfigTemplate::count_placeholders(AVC_ENC_TEMPLATE) == 8);
 
-    std::string create_config_avc_dec(const ConfigData &configData) const
-    {
-        std::string config(
-            R"(
-InputFile = "XnameX.264e" 
-OutputFile = "XnameX.264d" 
-RefFile = "XnameX_rec.raw" 
+    static constexpr std::string_view AVC_DEC_TEMPLATE = R"(
+InputFile = "XoutX.264e" 
+OutputFile = "XoutX.264d" 
+RefFile = "XoutX_rec.raw" 
 WriteUV = 0 
 FileFormat = 0 
 RefOffset = 0 
@@ -102,17 +158,12 @@ Silent = 0
 IntraProfileDeblocking = 1 
 DecFrmNum = 0 
 DecodeAllLayers = 0 
-            )");
-        config = std::regex_replace(config, std::regex("XnameX"), configData.m_name);
-        return config;
-    }
+            )";
+    static_assert(ConfigTemplate::count_placeholders(AVC_DEC_TEMPLATE) == 3);
 
-    std::string create_config_vvc_enc(const ConfigData &configData) const
-    {
-        std::string config(
-            R"(
+    static constexpr std::string_view VVC_TEMPLATE = R"(
 InputFile: XnameX.raw
-BitstreamFile: XnameX.266e
+BitstreamFile: XoutX.266e
 SourceWidth: XwidthX
 SourceHeight: XheightX
 FramesToBeEncoded: XdepthX
@@ -151,148 +202,326 @@ Log2MaxTbSize : 5
 InternalBitDepth : 0
 TSRCdisableLL : 1
 ConformanceWindowMode: 1
-            )");
-        config = std::regex_replace(config, std::regex("XnameX"), configData.m_name);
-        config = std::regex_replace(config, std::regex("XwidthX"), configData.m_width);
-        config = std::regex_replace(config, std::regex("XheightX"), configData.m_height);
-        config = std::regex_replace(config, std::regex("XdepthX"), configData.m_depth);
-        return config;
+            )";
+    static_assert(ConfigTemplate::count_placeholders(VVC_TEMPLATE) == 5);
+
+    static constexpr std::string_view JP3D_TEMPLATE = "./jp3d -c --size=XwidthX,XheightX,XdepthX --levels=4,4,2 --bitrates=- XnameX.raw XoutX.jp3de";
+    static_assert(ConfigTemplate::count_placeholders(JP3D_TEMPLATE) == 5);
+
+    // Overrides are the same for every volume, so they go into the template once per variant
+    // Tuned overrides of a volume go in first, the variant's can still change them
+    static ConfigTemplate variant_template(std::string_view base, const ConfigVariant &variant, char separator,
+                                           const ConfigOverrides *tuned = nullptr)
+    {
+        ConfigVariant merged;
+        if (tuned)
+            merged.m_overrides = *tuned;
+        merged.m_overrides.insert(merged.m_overrides.end(), variant.m_overrides.begin(), variant.m_overrides.end());
+        std::string text(base);
+        if (separator)
+            apply_overrides(text, separator, merged);
+        else
+            apply_jp3d_overrides(text, merged);
+        return ConfigTemplate(std::move(text));
+    }
+
+    // Sample bit depth settings for a volume's effective bit depth
+    // JM, HM and VTM code nothing below 8 bits; with a lower input depth they would only shift the samples up
+    // and decode them shifted, so sparser volumes are coded at 8 like before and only deeper ones change
+    static ConfigOverrides bit_depth_overrides(Codec codec, int bit_depth)
+    {
+        if (bit_depth <= 8)
+            return {};
+        std::string depth = std::to_string(std::min(bit_depth, codec == AVC ? 14 : 16));
+        switch (codec)
+        {
+        case AVC:
+            return {{"SourceBitDepthLuma", depth}, {"OutputBitDepthLuma", depth}};
+        case HEVC:
+        case VVC:
+            return {{"InputBitDepth", depth}, {"InternalBitDepth", depth}};
+        default:
+            return {}; // jp3d is left as it is
+        }
     }
 
-    std::string create_config_jp3d_enc(const ConfigData &configData) const
+    // Everything a volume's config gets on top of the variant: its bit depth, then what auto-tuning picked
+    static ConfigOverrides volume_overrides(Codec codec, const ConfigData &configData, const ConfigOverrides *tuned)
     {
-        std::string config("./jp3d -c --size=XwidthX,XheightX,XdepthX --levels=4,4,2 --bitrates=- XnameX.raw XnameX.jp3de");
-        config = std::regex_replace(config, std::regex("XnameX"), configData.m_name);
-        config = std::regex_replace(config, std::regex("XwidthX"), configData.m_width);
-        config = std::regex_replace(config, std::regex("XheightX"), configData.m_height);
-        config = std::regex_replace(config, std::regex("XdepthX"), configData.m_depth);
-        return config;
+        ConfigOverrides overrides = bit_depth_overrides(codec, configData.m_bit_depth);
+        if (tuned)
+            overrides.insert(overrides.end(), tuned->begin(), tuned->end());
+        return overrides;
+    }
+
+    // Encoder configs of one variant; volumes with overrides of their own (bit depth, auto-tuning) get
+    // a template of their own, shared by the volumes that got the same ones
+    static bool write_encoder_configs(Codec codec, DirectoryWriter &writer, const std::vector<ConfigData> &configDatas,
+                                      const ConfigVariant &variant, std::string_view base, char separator,
+                                      const char *extension, const std::map<std::string, ConfigOverrides> &tuning)
+    {
+        const ConfigTemplate shared = variant_template(base, variant, separator);
+        std::map<std::string, ConfigTemplate> volume_templates; // By the joined overrides
+        std::string buffer;
+        for (const auto &configData : configDatas)
+        {
+            const ConfigTemplate *config_template = &shared;
+            auto tuned = tuning.find(configData.m_name);
+            ConfigOverrides overrides = volume_overrides(codec, configData, tuned != tuning.end() ? &tuned->second : nullptr);
+            if (!overrides.empty())
+            {
+                std::string key = TuningChoice::join(overrides);
+                auto found = volume_templates.find(key);
+                if (found == volume_templates.end())
+                    found = volume_templates.emplace(key, variant_template(base, variant, separator, &overrides)).first;
+                config_template = &found->second;
+            }
+            std::string out = variant.file_name(configData.m_name);
+            TemplateValues values(configData.m_name, out, configData.m_width, configData.m_height, configData.m_depth);
+            config_template->render(values, buffer);
+            if (!writer.add(out + extension, buffer))
+                return false;
+        }
+        return true;
+    }
+
+    // Renders one config per volume into <name>[@<variant>]<extension> of the writer's directory, through one reused buffer
+    static bool write_decoder_configs(DirectoryWriter &writer, const std::vector<ConfigData> &configDatas,
+                              const ConfigVariant &variant, const ConfigTemplate &config_template, const char *extension)
+    {
+        std::string buffer;
+        for (const auto &configData : configDatas)
+        {
+            std::string out = variant.file_name(configData.m_name);
+            TemplateValues values(configData.m_name, out, configData.m_width, configData.m_height, configData.m_depth);
+            config_template.render(values, buffer);
+            if (!writer.add(out + extension, buffer))
+                return false;
+        }
+        return true;
+    }
+
+    // Every config of one directory, written through one directory descriptor
+    bool create_configs(const std::filesystem::path &metadata_path) const
+    {
+        try
+        {
+            std::vector<ConfigData> configDatas;
+            if (!read_config_datas(metadata_path, configDatas))
+                return false;
+            // Now we have all the data from the csv; let us create configs
+            DirectoryWriter writer;
+            if (!writer.open(metadata_path.parent_path()))
+            {
+                std::cerr << "Error opening " << metadata_path.parent_path() << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            // Overrides auto-tuning picked per volume, see AutoTuner
+            auto tuning_for = [this, &metadata_path](Codec codec) {
+                std::map<std::string, ConfigOverrides> tuning;
+                if (m_use_tuning)
+                    load_tuning(metadata_path.parent_path(), codec, tuning);
+                return tuning;
+            };
+            if (m_avc)
+            {
+                // AVC reference software JM encoder and decoder configs
+                // ---
+                // Note: the default config is the supplied lossless.cfg264e
+                // The created configs are only meant for resetting the defaults
+                // ---
+                const ConfigTemplate decoder_template{std::string(AVC_DEC_TEMPLATE)};
+                auto tuning = tuning_for(AVC);
+                for (const auto &variant : variants_for(AVC))
+                {
+                    if (!write_encoder_configs(AVC, writer, configDatas, variant, AVC_ENC_TEMPLATE, '=', ".cfg264e", tuning) ||
+                        !write_decoder_configs(writer, configDatas, variant, decoder_template, ".cfg264d"))
+                        return false;
+                }
+            }
+            if (m_hevc)
+            {
+                // HEVC reference software HM encoder configs
+                auto tuning = tuning_for(HEVC);
+                for (const auto &variant : variants_for(HEVC))
+                {
+                    if (!write_encoder_configs(HEVC, writer, configDatas, variant, HEVC_TEMPLATE, ':', ".cfg265e", tuning))
+                        return false;
+                }
+            }
+            if (m_vvc)
+            {
+                // VVC reference software VTM encoder configs
+                auto tuning = tuning_for(VVC);
+                for (const auto &variant : variants_for(VVC))
+                {
+                    if (!write_encoder_configs(VVC, writer, configDatas, variant, VVC_TEMPLATE, ':', ".cfg266e", tuning))
+                        return false;
+                }
+            }
+            if (m_jp3d)
+            {
+                // JP3D compression scripts
+                auto tuning = tuning_for(JP3D);
+                for (const auto &variant : variants_for(JP3D))
+                {
+                    if (!write_encoder_configs(JP3D, writer, configDatas, variant, JP3D_TEMPLATE, 0, ".sh", tuning))
+                        return false;
+                }
+            }
+            return writer.flush();
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
     }
 
 public:
     CodecConfigCreator(bool jp3d, bool avc, bool hevc, bool vvc)
         : m_jp3d(jp3d), m_avc(avc), m_hevc(hevc), m_vvc(vvc) {}
 
-    bool run(const std::filesystem::path &collection_dir)
+    // Sweep mode: instead of the single hardcoded config, write one config per grid point
+    // named <name>@<variant>; the untouched default is kept as a baseline unless told otherwise
+    void set_sweep(const ParameterGrid &grid, bool include_default = true)
+    {
+        std::vector<ConfigVariant> variants;
+        if (include_default)
+            variants.push_back(ConfigVariant());
+        for (const auto &variant : grid.expand())
+            variants.push_back(variant);
+        m_sweeps[grid.codec()] = variants;
+    }
+
+    // Volumes of one conv_metadata.csv, from the dataset index when it is up to date
+    static bool read_config_datas(const std::filesystem::path &metadata_path, std::vector<ConfigData> &configDatas)
+    {
+        DatasetIndex index;
+        CSVReader reader;
+        if (DatasetIndex::is_fresh(metadata_path.parent_path()) &&
+            index.open(DatasetIndex::path_for(metadata_path.parent_path())) &&
+            index.column<int32_t>("Width", DatasetIndex::I32))
+        {
+            // Same rows without parsing any text
+            const int32_t *widths = index.column<int32_t>("Width", DatasetIndex::I32);
+            const int32_t *heights = index.column<int32_t>("Height", DatasetIndex::I32);
+            const int32_t *depths = index.column<int32_t>("Depth", DatasetIndex::I32);
+            const uint8_t *bit_depths = index.column<uint8_t>("BitDepth", DatasetIndex::U8);
+            for (size_t i = 0; i < index.size(); ++i)
+            {
+                if (!index.duplicate_of(i).empty())
+                    continue;
+                configDatas.push_back(ConfigData(std::string(index.name(i)), widths[i], heights[i], depths[i]));
+                configDatas.back().m_bit_depth = bit_depths ? bit_depths[i] : 0;
+            }
+        }
+        else if (reader.open(metadata_path))
+        {
+            CSVRow row;
+            auto schema = ConfigData::schema();
+            reader.read_row(row);
+            if (!schema.bind(row))
+            {
+                std::cerr << metadata_path << " lacks name or dimension columns" << std::endl;
+                return false;
+            }
+            ConfigData configData;
+            while (reader.read_row(row))
+            {
+                if (schema.read(row, configData) && configData.m_duplicate_of.empty())
+                    configDatas.push_back(configData);
+            }
+        }
+        else
+        {
+            // CSVReader::open leaves errno set
+            std::cerr << "Error: " << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // Configs take the overrides AutoTuner left in <CODEC>-tuning.csv of their directory, if there is one
+    void use_tuning(bool use = true)
+    {
+        m_use_tuning = use;
+    }
+
+    bool uses_tuning() const
+    {
+        return m_use_tuning;
+    }
+
+    // Volume name -> tuned overrides; false if the directory has no tuning for the codec
+    static bool load_tuning(const std::filesystem::path &dir, Codec codec, std::map<std::string, ConfigOverrides> &tuning)
+    {
+        CSVReader reader;
+        if (!reader.open(dir / get_codec_files(codec).m_tuning_file_name))
+            return false;
+        CSVRow row;
+        auto schema = TuningChoice::schema();
+        if (!reader.read_row(row) || !schema.bind(row))
+            return false;
+        TuningChoice choice;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, choice))
+                tuning[choice.m_name] = choice.split();
+        }
+        return true;
+    }
+
+    // The sweep variants of a codec, or just the default one
+    std::vector<ConfigVariant> variants_for(Codec codec) const
+    {
+        auto found = m_sweeps.find(codec);
+        if (found == m_sweeps.end())
+            return {ConfigVariant()};
+        return found->second;
+    }
+
+    // What run() would write for one volume and variant, for runners that hand configs over in memory:
+    // the encoder config (the jp3d command line for JP3D) and, for AVC, the decoder config
+    // tuned are the volume's overrides from load_tuning, if any; the bit depth comes from configData
+    void render(Codec codec, const ConfigData &configData, const ConfigVariant &variant,
+                std::string &encoder_config, std::string &decoder_config, const ConfigOverrides *tuned = nullptr) const
+    {
+        std::string out = variant.file_name(configData.m_name);
+        TemplateValues values(configData.m_name, out, configData.m_width, configData.m_height, configData.m_depth);
+        ConfigOverrides overrides = volume_overrides(codec, configData, tuned);
+        tuned = &overrides;
+        decoder_config.clear();
+        switch (codec)
+        {
+        case (AVC):
+            variant_template(AVC_ENC_TEMPLATE, variant, '=', tuned).render(values, encoder_config);
+            ConfigTemplate(std::string(AVC_DEC_TEMPLATE)).render(values, decoder_config);
+            break;
+        case (HEVC):
+            variant_template(HEVC_TEMPLATE, variant, ':', tuned).render(values, encoder_config);
+            break;
+        case (VVC):
+            variant_template(VVC_TEMPLATE, variant, ':', tuned).render(values, encoder_config);
+            break;
+        case (JP3D):
+            variant_template(JP3D_TEMPLATE, variant, 0, tuned).render(values, encoder_config);
+            break;
+        }
+    }
+
+    // Directories are independent, each one is a job on the pool
+    bool run(const std::filesystem::path &collection_dir, unsigned jobs = std::thread::hardware_concurrency())
     {
         namespace fs = std::filesystem;
+        std::vector<fs::path> metadata_paths;
         try
         {
             for (const auto &entry : fs::recursive_directory_iterator(collection_dir))
             {
                 if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
-                {
-                    std::vector<ConfigData> configDatas;
-                    std::ifstream csvFile(entry.path().string());
-                    if (csvFile)
-                    {
-                        CSVRow row;
-                        row.readNextRow(csvFile); // Skip the header
-                        while (row.readNextRow(csvFile))
-                        {
-                            using CF = ConfigData::Field;
-                            configDatas.push_back(
-                                ConfigData(
-                                    row[CF::Name],
-                                    row[CF::Width],
-                                    row[CF::Height],
-                                    row[CF::Depth]));
-                        }
-                    }
-                    else
-                    {
-                        // Weird ifstream error reporting part
-                        std::cerr << "Error: " << strerror(errno);
-                        return false;
-                    }
-                    // Now we have all the data from the csv; let us create configs
-                    if (m_avc)
-                    {
-                        // AVC reference software JM encoder and decoder configs
-                        // ---
-                        // Note: the default config is the supplied lossless.cfg264e
-                        // The created configs are only meant for resetting the defaults
-                        // ---
-                        for (const auto &configData : configDatas)
-                        {
-                            { // Encoder config
-                                std::ofstream config(entry.path().parent_path() / (configData.m_name + ".cfg264e"));
-                                if (config)
-                                {
-                                    config << create_config_avc_enc(configData);
-                                }
-                                else
-                                {
-                                    std::cerr << "Error creating AVC encoder config: " << strerror(errno);
-                                    return false;
-                                }
-                            }
-                            { // Decoder config
-                                std::ofstream config(entry.path().parent_path() / (configData.m_name + ".cfg264d"));
-                                if (config)
-                                {
-                                    config << create_config_avc_dec(configData);
-                                }
-                                else
-                                {
-                                    std::cerr << "Error creating AVC decoder config: " << strerror(errno);
-                                    return false;
-                                }
-                            }
-                        }
-                    }
-                    if (m_hevc)
-                    {
-                        // HEVC reference software HM encoder configs
-                        for (const auto &configData : configDatas)
-                        {
-                            std::ofstream config(entry.path().parent_path() / (configData.m_name + ".cfg265e"));
-                            if (config)
-                            {
-                                config << create_config_hevc(configData);
-                            }
-                            else
-                            {
-                                std::cerr << "Error creating HEVC encoder config: " << strerror(errno);
-                                return false;
-                            }
-                        }
-                    }
-                    if (m_vvc)
-                    {
-                        // VVC reference software VTM encoder configs
-                        for (const auto &configData : configDatas)
-                        {
-                            std::ofstream config(entry.path().parent_path() / (configData.m_name + ".cfg266e"));
-                            if (config)
-                            {
-                                config << create_config_vvc_enc(configData);
-                            }
-                            else
-                            {
-                                std::cerr << "Error creating VVC encoder config: " << strerror(errno);
-                                return false;
-                            }
-                        }
-                    }
-                    if (m_jp3d)
-                    {
-                        // JP3D compression scripts
-                        for (const auto &configData : configDatas)
-                        {
-                            std::ofstream config(entry.path().parent_path() / (configData.m_name + ".sh"));
-                            if (config)
-                            {
-                                config << create_config_jp3d_enc(configData);
-                            }
-                            else
-                            {
-                                std::cerr << "Error creating JP3D config: " << strerror(errno);
-                                return false;
-                            }
-                        }
-                    }
-                }
+                    metadata_paths.push_back(entry.path());
             }
         }
         catch (...) // Too lazy to check what it can throw, just give me the error code
@@ -301,6 +530,17 @@ public:
             std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
             return false;
         }
-        return true;
+
+        std::atomic<bool> ok{true};
+        ThreadPool pool(std::min<unsigned>(jobs, (unsigned)metadata_paths.size()));
+        for (const auto &metadata_path : metadata_paths)
+        {
+            pool.submit([this, &metadata_path, &ok] {
+                if (!create_configs(metadata_path))
+                    ok = false;
+            });
+        }
+        pool.wait();
+        return ok;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,630 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "CSVReader.h"
+#include "Codec.h"
+#include "CodecConfigCreator.h"
+#include "CodecSweep.h"
+#include "Digest.h"
+#include "EncoderLogParser.h"
+#include "FileMetadata.h"
+#include "MemoryGovernor.h"
+#include "Process.h"
+#include "ResultCache.h"
+#include "Slabs.h"
+#include "ThreadPool.h"
+
+// Outcome of a run as written to the third column of the logs
+static constexpr const char *STATUS_OK = "OK";
+static constexpr const char *STATUS_FAILED = "FAILED";
+static constexpr const char *STATUS_MISMATCH = "MISMATCH";
+static constexpr const char *STATUS_TIMEOUT = "TIMEOUT";
+static constexpr const char *STATUS_OOM = "OOM";
+
+// C++ counterpart of tools/*/run.sh: encodes, decodes and verifies every config it finds,
+// writes the same *-enc.log and *-dec.log files, and skips work the result cache already knows
+// Every <name>.cfg* and every sweep variant <name>@<variant>.cfg* is one job, jobs run on a pool
+class CodecRunner
+{
+private:
+    struct Job
+    {
+        std::filesystem::path m_dir;
+        std::string m_name;      // Volume, the input is <name>.raw
+        std::string m_file_name; // Config and outputs, <name> or <name>@<variant>
+        std::mutex *m_dir_mutex = nullptr;
+        ConfigData m_data{};       // In-memory mode only, what the config is rendered from
+        ConfigVariant m_variant{};
+        ConfigOverrides m_tuned{}; // What auto-tuning picked for the volume, see CodecConfigCreator::use_tuning
+        double m_predicted_cost = 0.0; // See rank_by_prediction
+        uintmax_t m_voxels = 0;        // Of the volume, for its memory estimate
+    };
+
+    Codec m_codec;
+    CodecFiles m_files;
+    std::filesystem::path m_tools_dir;
+    ResultCache *m_cache;
+    unsigned m_jobs;
+    ProcessLimits m_limits;
+    const CodecConfigCreator *m_creator = nullptr; // Set in in-memory mode
+
+    Hash128 m_codec_hash;
+    std::mutex m_log_mutex;
+    std::map<std::string, std::unique_ptr<std::mutex>> m_dir_mutexes;
+    std::mutex m_inputs_mutex;
+    std::map<std::string, unsigned> m_decoded_inputs; // .raw decoded from bricks -> jobs still using it
+    unsigned m_encoded = 0, m_reused = 0, m_failed = 0;
+    unsigned m_skipped = 0, m_duplicates = 0;
+    // Compressibility based scheduling, see set_prediction_limits and rank_by_prediction
+    double m_min_predicted_bpp = 0.0, m_max_predicted_bpp = 0.0;
+    bool m_rank = false;
+
+    // config_path is the config file, or /proc/self/fd/N of a MemoryFile in in-memory mode
+    std::vector<std::string> encoder_command(const std::string &config_path) const
+    {
+        switch (m_codec)
+        {
+        case (AVC):
+            return {"./" + m_files.m_encoder, "-d", "lossless.dcfg264e", "-f", config_path};
+        case (HEVC):
+        case (VVC):
+            return {"./" + m_files.m_encoder, "-c", config_path};
+        case (JP3D):
+            return {"bash", config_path};
+        }
+        return {};
+    }
+
+    // decoder_config_path is only used by AVC, the others take everything on the command line
+    std::vector<std::string> decoder_command(const std::string &file_name, const std::string &decoder_config_path) const
+    {
+        switch (m_codec)
+        {
+        case (AVC):
+            return {"./" + m_files.m_decoder, "-d", decoder_config_path};
+        case (HEVC):
+            return {"./" + m_files.m_decoder, "-b", "./" + file_name + m_files.m_enc_ext, "-o", "./" + file_name + m_files.m_dec_ext, "-d", "8"};
+        case (VVC):
+            return {"./" + m_files.m_decoder, "-b", "./" + file_name + m_files.m_enc_ext, "-o", "./" + file_name + m_files.m_dec_ext};
+        case (JP3D):
+            return {"./" + m_files.m_decoder, "-d", "./" + file_name + m_files.m_enc_ext, "./" + file_name + m_files.m_dec_ext};
+        }
+        return {};
+    }
+
+    // The name the logs use for a run, ResultSheetCreator strips the leading ./ and the extension
+    std::string enc_log_file(const std::string &file_name) const
+    {
+        return "./" + file_name + m_files.m_config_ext;
+    }
+
+    std::string dec_log_file(const std::string &file_name) const
+    {
+        if (m_codec == AVC)
+            return "./" + file_name + m_files.m_config_dec_ext;
+        return "./" + file_name + m_files.m_enc_ext;
+    }
+
+    // The jp3d "config" is a one-line script, in in-memory mode it is run directly; the template has no quoting
+    static std::vector<std::string> split_command(const std::string &command)
+    {
+        std::vector<std::string> args;
+        size_t start = command.find_first_not_of(" \t\n");
+        while (start != std::string::npos)
+        {
+            size_t end = command.find_first_of(" \t\n", start);
+            args.push_back(command.substr(start, end == std::string::npos ? std::string::npos : end - start));
+            start = command.find_first_not_of(" \t\n", end);
+        }
+        return args;
+    }
+
+    static const char *failure_status(const ProcessResult &result)
+    {
+        if (result.m_timed_out)
+            return STATUS_TIMEOUT;
+        if (result.m_memory_exceeded)
+            return STATUS_OOM;
+        return STATUS_FAILED;
+    }
+
+    static bool read_text(const std::filesystem::path &path, std::string &text)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Encoder stdout is kept as <file>.enc.out, JM's stats.dat and log.dat as <file>.stats.dat and <file>.log.dat
+    static std::string capture_name(const std::string &file_name)
+    {
+        return file_name + ".enc.out";
+    }
+
+    // Streams the captured encoder output into <CODEC>-slices.csv
+    void record_slices(const std::filesystem::path &dir, const std::string &file_name)
+    {
+        std::ifstream output(dir / capture_name(file_name));
+        if (!output)
+            return;
+        std::string rows;
+        EncoderLogParser(m_codec).parse(output, [&](const SliceStats &stats) {
+            rows += stats.get_info(file_name) + "\n";
+        });
+        if (rows.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        std::filesystem::path slices_path = dir / (m_files.m_name + "-slices.csv");
+        bool fresh = !std::filesystem::exists(slices_path);
+        std::ofstream slices(slices_path, std::ios::app);
+        if (!slices)
+        {
+            std::cerr << "Error while opening " << slices_path << ": " << strerror(errno) << std::endl;
+            return;
+        }
+        if (fresh)
+            slices << SliceStats::get_info_header();
+        slices << rows;
+    }
+
+    // Against the digest sidecar of the source when there is one, the source is not read then; a mismatch names
+    // the first slice that differs
+    static bool decoded_matches(const std::filesystem::path &decoded, const std::filesystem::path &source)
+    {
+        SliceDigest whole;
+        std::vector<SliceDigest> slices;
+        if (!VolumeDigest::read(source, whole, slices))
+            return files_equal(decoded, source);
+        int mismatch;
+        if (VolumeDigest::matches(decoded, whole, slices, mismatch))
+            return true;
+        if (mismatch >= 0)
+            std::cerr << decoded << " differs from " << source << " first at slice " << mismatch << std::endl;
+        return false;
+    }
+
+    // Same job as cmp in run.sh
+    static bool files_equal(const std::filesystem::path &a, const std::filesystem::path &b)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec_a, ec_b;
+        if (fs::file_size(a, ec_a) != fs::file_size(b, ec_b) || ec_a || ec_b)
+            return false;
+        std::ifstream file_a(a, std::ios::binary), file_b(b, std::ios::binary);
+        if (!file_a || !file_b)
+            return false;
+        std::vector<char> chunk_a(1 << 20), chunk_b(1 << 20);
+        while (file_a && file_b)
+        {
+            file_a.read(chunk_a.data(), chunk_a.size());
+            file_b.read(chunk_b.data(), chunk_b.size());
+            if (file_a.gcount() != file_b.gcount() ||
+                memcmp(chunk_a.data(), chunk_b.data(), (size_t)file_a.gcount()) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool append_log_row(const std::filesystem::path &log_path, const std::string &file, double time, const char *status)
+    {
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        bool fresh = !std::filesystem::exists(log_path);
+        std::ofstream log(log_path, std::ios::app);
+        if (!log)
+        {
+            std::cerr << "Error while opening log " << log_path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        auto schema = LogEntry::schema();
+        std::string buffer;
+        if (fresh)
+            schema.write_header(buffer);
+        schema.write(LogEntry{file, time, status}, buffer);
+        log << buffer;
+        return true;
+    }
+
+    // Finds every config of every volume listed in the directory's conv_metadata.csv
+    bool plan_directory(const std::filesystem::path &dir, const std::filesystem::path &metadata_path, std::vector<Job> &jobs)
+    {
+        namespace fs = std::filesystem;
+
+        std::map<std::string, std::vector<std::string>> configs; // Volume name -> config file names
+        for (const auto &entry : fs::directory_iterator(dir))
+        {
+            if (!m_creator && entry.is_regular_file() && entry.path().extension() == m_files.m_config_ext)
+            {
+                std::string file_name = entry.path().stem().string();
+                configs[ConfigVariant::split_file_name(file_name).first].push_back(file_name);
+            }
+        }
+
+        CSVReader reader;
+        if (!reader.open(metadata_path))
+        {
+            std::cerr << "Error while opening converted metadata: " << strerror(errno);
+            return false;
+        }
+        auto &dir_mutex = m_dir_mutexes[dir.string()];
+        if (!dir_mutex)
+            dir_mutex = std::make_unique<std::mutex>();
+        CSVRow row;
+        auto schema = FileMetadata::converted_schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << metadata_path << " lacks some of its columns" << std::endl;
+            return false;
+        }
+        FileMetadata metadata;
+        std::vector<ConfigVariant> variants;
+        std::map<std::string, ConfigOverrides> tuning;
+        if (m_creator)
+        {
+            variants = m_creator->variants_for(m_codec);
+            if (m_creator->uses_tuning())
+                CodecConfigCreator::load_tuning(dir, m_codec, tuning);
+        }
+        while (reader.read_row(row))
+        {
+            if (!schema.read(row, metadata))
+                continue;
+            if (metadata.is_duplicate())
+            {
+                ++m_duplicates; // Its series is encoded under the name it was first converted as
+                continue;
+            }
+            const std::string &name = metadata.m_result_name;
+            Compressibility compressibility = metadata.compressibility();
+            double predicted_bpp = compressibility.predicted_bpp();
+            if (compressibility.is_known() &&
+                ((m_min_predicted_bpp > 0.0 && predicted_bpp < m_min_predicted_bpp) ||
+                 (m_max_predicted_bpp > 0.0 && predicted_bpp > m_max_predicted_bpp)))
+            {
+                ++m_skipped;
+                continue;
+            }
+            // Coding work grows with the voxels and with the bits left to code for each of them
+            double cost = (double)metadata.m_width * metadata.m_height * metadata.m_depth * (1.0 + predicted_bpp);
+            size_t first_job = jobs.size();
+            for (const auto &file_name : configs[name])
+                jobs.push_back(Job{dir, name, file_name, dir_mutex.get()});
+            // In-memory mode: every volume with every variant, no files to look for
+            ConfigData data(name, metadata.m_width, metadata.m_height, metadata.m_depth);
+            data.m_bit_depth = metadata.m_bit_depth;
+            const ConfigOverrides &tuned = tuning[name];
+            for (const auto &variant : variants)
+                jobs.push_back(Job{dir, name, variant.file_name(name), dir_mutex.get(), data, variant, tuned});
+            for (size_t i = first_job; i < jobs.size(); ++i)
+            {
+                jobs[i].m_predicted_cost = cost;
+                jobs[i].m_voxels = (uintmax_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+            }
+        }
+        return true;
+    }
+
+    // Slabs of a bricked volume decoded at once while its .raw is written for the tools
+    static constexpr size_t DECODE_BUDGET = size_t(256) << 20;
+
+    // The tools read <name>.raw; a volume converted BRICKED gets one decoded next to its bricks for as long as
+    // jobs of it run. Decoded under the lock, so variants starting together decode it once
+    bool acquire_input(const Job &job)
+    {
+        namespace fs = std::filesystem;
+        fs::path raw_path = job.m_dir / (job.m_name + ".raw");
+        fs::path bricked_path = job.m_dir / (job.m_name + BrickedVolume::EXTENSION);
+        std::lock_guard<std::mutex> lock(m_inputs_mutex);
+        auto found = m_decoded_inputs.find(raw_path.string());
+        if (found != m_decoded_inputs.end())
+        {
+            ++found->second;
+            return true;
+        }
+        std::error_code ec;
+        if (fs::exists(raw_path, ec) || !fs::exists(bricked_path, ec))
+            return true; // Nothing to decode; a missing volume fails in the tools like before
+        fs::path temp_path = raw_path;
+        temp_path += ".tmp";
+        SlabReader reader;
+        if (!reader.open(bricked_path) ||
+            !OutOfCore::write_box(reader, DECODE_BUDGET, CropBox{0, 0, 0, reader.width(), reader.height(), reader.depth()},
+                                  temp_path))
+        {
+            std::cerr << "Could not decode " << bricked_path << " for " << m_files.m_name << std::endl;
+            fs::remove(temp_path, ec);
+            return false;
+        }
+        fs::rename(temp_path, raw_path, ec);
+        if (ec)
+            return false;
+        m_decoded_inputs[raw_path.string()] = 1;
+        return true;
+    }
+
+    void release_input(const Job &job)
+    {
+        std::filesystem::path raw_path = job.m_dir / (job.m_name + ".raw");
+        std::lock_guard<std::mutex> lock(m_inputs_mutex);
+        auto found = m_decoded_inputs.find(raw_path.string());
+        if (found == m_decoded_inputs.end() || --found->second)
+            return;
+        std::error_code ec;
+        std::filesystem::remove(raw_path, ec);
+        m_decoded_inputs.erase(found);
+    }
+
+    void run_job(const Job &job)
+    {
+        if (!acquire_input(job))
+        {
+            std::lock_guard<std::mutex> lock(m_log_mutex);
+            ++m_failed;
+            return;
+        }
+        run_job_on_input(job);
+        release_input(job);
+    }
+
+    void run_job_on_input(const Job &job)
+    {
+        namespace fs = std::filesystem;
+        const fs::path &dir = job.m_dir;
+        const std::string &file_name = job.m_file_name;
+        fs::path log_enc = dir / m_files.m_log_enc_name;
+        fs::path log_dec = dir / m_files.m_log_dec_name;
+
+        std::string key;
+        fs::path raw_path = dir / (job.m_name + ".raw");
+        Hash128 input_hash;
+        std::string config_text, decoder_config_text;
+        if (m_creator)
+            m_creator->render(m_codec, job.m_data, job.m_variant, config_text, decoder_config_text, &job.m_tuned);
+        if (m_cache)
+        {
+            if ((!m_creator && !read_text(dir / (file_name + m_files.m_config_ext), config_text)) ||
+                !m_cache->hash_file(raw_path, input_hash))
+            {
+                std::cerr << "Could not read " << file_name << " inputs; skipping" << std::endl;
+                return;
+            }
+            key = ResultCache::make_key(input_hash, m_codec_hash, config_text, job.m_name);
+
+            CacheEntry entry;
+            if (m_cache->lookup(key, entry))
+            {
+                append_log_row(log_enc, enc_log_file(file_name), entry.m_encoding_time, STATUS_OK);
+                append_log_row(log_dec, dec_log_file(file_name), entry.m_decoding_time, entry.m_verified ? STATUS_OK : STATUS_MISMATCH);
+                std::lock_guard<std::mutex> lock(m_log_mutex);
+                ++m_reused;
+                return;
+            }
+        }
+
+        std::unique_lock<std::mutex> dir_lock(*job.m_dir_mutex, std::defer_lock);
+        if (m_files.m_shared_workdir)
+            dir_lock.lock();
+
+        // Starts only once the encodes already running leave room for it, see MemoryGovernor
+        MemoryGovernor &governor = MemoryGovernor::instance();
+        MemoryGovernor::Reservation reservation = governor.reserve(governor.estimate(m_files.m_name, job.m_voxels));
+
+        // Configs go to the tools as files, or in in-memory mode as memfds (jp3d gets its command line directly)
+        std::vector<std::string> enc_command, dec_command;
+        MemoryFile enc_config, dec_config;
+        std::vector<int> enc_fds, dec_fds;
+        if (!m_creator)
+        {
+            enc_command = encoder_command("./" + file_name + m_files.m_config_ext);
+            dec_command = decoder_command(file_name, "./" + file_name + m_files.m_config_dec_ext);
+        }
+        else
+        {
+            if (m_codec == JP3D)
+            {
+                enc_command = split_command(config_text);
+            }
+            else if (enc_config.create(file_name + m_files.m_config_ext, config_text))
+            {
+                enc_command = encoder_command(enc_config.path());
+                enc_fds.push_back(enc_config.fd());
+            }
+            if (m_codec != AVC)
+            {
+                dec_command = decoder_command(file_name, {});
+            }
+            else if (dec_config.create(file_name + m_files.m_config_dec_ext, decoder_config_text))
+            {
+                dec_command = decoder_command(file_name, dec_config.path());
+                dec_fds.push_back(dec_config.fd());
+            }
+            if (enc_command.empty() || dec_command.empty())
+            {
+                std::cerr << "Could not hand " << file_name << " configs over in memory: " << strerror(errno) << std::endl;
+                std::lock_guard<std::mutex> lock(m_log_mutex);
+                ++m_failed;
+                return;
+            }
+        }
+
+        // Encode
+        ProcessResult enc = Process::run(enc_command, dir, capture_name(file_name), m_limits, enc_fds);
+        if (m_codec == AVC)
+        {
+            // Only one AVC job per directory at a time, so these are ours
+            std::error_code ec;
+            fs::rename(dir / "stats.dat", dir / (file_name + ".stats.dat"), ec);
+            fs::rename(dir / "log.dat", dir / (file_name + ".log.dat"), ec);
+        }
+        if (enc.m_started)
+            governor.record(m_files.m_name, job.m_voxels, enc.m_peak_rss);
+        if (!enc.m_started || enc.m_exit_code != 0)
+        {
+            append_log_row(log_enc, enc_log_file(file_name), enc.m_elapsed, failure_status(enc));
+            std::cerr << m_files.m_name << " encoder failed on " << file_name << " with code " << enc.m_exit_code
+                      << (enc.m_timed_out ? " (timed out)" : "") << (enc.m_memory_exceeded ? " (out of memory)" : "") << std::endl;
+            fs::remove(dir / (file_name + m_files.m_enc_ext)); // Whatever a killed encoder left is garbage
+            std::lock_guard<std::mutex> lock(m_log_mutex);
+            ++m_failed;
+            return;
+        }
+        append_log_row(log_enc, enc_log_file(file_name), enc.m_elapsed, STATUS_OK);
+        record_slices(dir, file_name);
+
+        // Decode and check whether the coding was truly lossless
+        ProcessResult dec = Process::run(dec_command, dir, {}, m_limits, dec_fds);
+        fs::path decoded_path = dir / (file_name + m_files.m_dec_ext);
+        bool decoded = dec.m_started && dec.m_exit_code == 0;
+        if (dec.m_started)
+            governor.record(m_files.m_name, job.m_voxels, dec.m_peak_rss);
+        reservation.release();
+        bool verified = decoded && decoded_matches(decoded_path, raw_path);
+        append_log_row(log_dec, dec_log_file(file_name), dec.m_elapsed,
+                       verified ? STATUS_OK : (decoded ? STATUS_MISMATCH : failure_status(dec)));
+        if (!verified)
+            std::cerr << m_files.m_name << " round trip of " << file_name << " is not lossless" << std::endl;
+        fs::remove(decoded_path);
+        if (m_codec == AVC)
+            fs::remove(dir / (file_name + "_rec.raw"));
+        {
+            std::lock_guard<std::mutex> lock(m_log_mutex);
+            ++m_encoded;
+        }
+
+        if (m_cache && decoded)
+        {
+            CacheEntry entry;
+            entry.m_key = key;
+            entry.m_codec = m_files.m_name;
+            entry.m_name = job.m_name;
+            entry.m_file_name = file_name;
+            entry.m_input_hash = input_hash.to_string();
+            entry.m_bitstream_size = fs::file_size(dir / (file_name + m_files.m_enc_ext));
+            entry.m_encoding_time = enc.m_elapsed;
+            entry.m_decoding_time = dec.m_elapsed;
+            entry.m_verified = verified;
+            m_cache->store(entry); // Journaled, so a crash does not lose the encode; run() saves once at the end
+        }
+    }
+
+public:
+    // jobs is the number of encodes running at once; more finish sooner but make the timings noisier
+    CodecRunner(Codec codec, const std::filesystem::path &tools_dir, ResultCache *cache = nullptr, unsigned jobs = 1)
+        : m_codec(codec), m_files(get_codec_files(codec)), m_tools_dir(tools_dir / get_codec_files(codec).m_name), m_cache(cache), m_jobs(jobs)
+    {
+    }
+
+    CodecRunner(const CodecRunner &) = delete;
+
+    // In-memory mode: configs are rendered by the creator for every volume of conv_metadata.csv and every
+    // variant of its sweep, and handed to the tools without touching the disk; config files are ignored
+    void set_config_creator(const CodecConfigCreator *creator)
+    {
+        m_creator = creator;
+    }
+
+    // Volumes whose predicted lossless bpp (see Compressibility) is outside [min_bpp, max_bpp] are not encoded,
+    // 0 leaves that side open; volumes without compressibility columns are always encoded
+    void set_prediction_limits(double min_bpp, double max_bpp)
+    {
+        m_min_predicted_bpp = min_bpp;
+        m_max_predicted_bpp = max_bpp;
+    }
+
+    // Start the jobs predicted to take longest first, so a long one does not start last and run alone
+    void rank_by_prediction(bool rank = true)
+    {
+        m_rank = rank;
+    }
+
+    // Runaway jobs are killed and logged as TIMEOUT or OOM, the remaining jobs carry on
+    void set_limits(const ProcessLimits &limits)
+    {
+        m_limits = limits;
+    }
+
+    bool run(const std::filesystem::path &collection_dir)
+    {
+        namespace fs = std::filesystem;
+        std::vector<Job> jobs;
+        std::vector<fs::path> copied_tools, dirs;
+        m_encoded = m_reused = m_failed = m_skipped = m_duplicates = 0;
+        bool ok = true;
+        try
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(collection_dir))
+            {
+                if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
+                {
+                    if (!plan_directory(entry.path().parent_path(), entry.path(), jobs))
+                        return false;
+                    dirs.push_back(entry.path().parent_path());
+                }
+            }
+
+            if (m_cache && !jobs.empty() && !m_cache->hash_codec(m_tools_dir, m_codec, m_codec_hash))
+            {
+                std::cerr << "Could not hash " << m_files.m_name << " tools in " << m_tools_dir << std::endl;
+                return false;
+            }
+
+            // Copy tools to the target directories, remember which ones to clean up
+            for (const auto &dir : dirs)
+            {
+                for (const auto &tool : m_files.m_tools)
+                {
+                    if (!fs::exists(dir / tool))
+                    {
+                        fs::copy_file(m_tools_dir / tool, dir / tool);
+                        copied_tools.push_back(dir / tool);
+                    }
+                }
+            }
+
+            if (m_rank)
+                std::stable_sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b)
+                                 { return a.m_predicted_cost > b.m_predicted_cost; });
+
+            ThreadPool pool(m_jobs);
+            for (const auto &job : jobs)
+                pool.submit([this, &job] { run_job(job); });
+            pool.wait();
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            ok = false;
+        }
+
+        // Clean up tools and leftovers
+        std::error_code ec;
+        for (const auto &tool : copied_tools)
+            fs::remove(tool, ec);
+        for (const auto &dir : dirs)
+            for (const auto &leftover : m_files.m_leftovers)
+                fs::remove(dir / leftover, ec);
+        if (m_cache && !m_cache->save())
+            ok = false;
+
+        std::cout << collection_dir << ": " << m_files.m_name << " encoded " << m_encoded
+                  << ", reused " << m_reused << ", failed " << m_failed;
+        if (m_skipped)
+            std::cout << ", skipped " << m_skipped << " volumes by prediction";
+        if (m_duplicates)
+            std::cout << ", " << m_duplicates << " duplicates";
+        std::cout << std::endl;
+        return ok;
+    }
+};
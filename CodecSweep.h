@@ -0,0 +1,152 @@
+#pragma once
+#include <cctype>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Codec.h"
+
+// Volume name and variant name are joined with this in file names: <name>@<variant>.cfg265e
+static constexpr char VARIANT_SEPARATOR = '@';
+
+// Config keys and the values that replace the template's, applied in order
+using ConfigOverrides = std::vector<std::pair<std::string, std::string>>;
+
+// A named set of config overrides, the default variant has no name and no overrides
+struct ConfigVariant
+{
+    std::string m_name;
+    ConfigOverrides m_overrides;
+
+    std::string file_name(const std::string &volume_name) const
+    {
+        if (m_name.empty())
+            return volume_name;
+        return volume_name + VARIANT_SEPARATOR + m_name;
+    }
+
+    // Splits <name>@<variant> back into its parts
+    static std::pair<std::string, std::string> split_file_name(const std::string &file_name)
+    {
+        size_t at = file_name.find(VARIANT_SEPARATOR);
+        if (at == std::string::npos)
+            return {file_name, ""};
+        return {file_name.substr(0, at), file_name.substr(at + 1)};
+    }
+};
+
+// Parameter grid for one codec, every combination of values becomes one variant
+// Keys are config keys for HM/VTM/JM (e.g. GOPSize, IntraPeriod, CTUSize, QuadtreeTULog2MaxSize)
+// and long option names for jp3d (e.g. levels for --levels=)
+class ParameterGrid
+{
+private:
+    Codec m_codec;
+    std::vector<std::pair<std::string, std::vector<std::string>>> m_axes;
+
+    // Variant names end up in file names, keep them to [A-Za-z0-9_]
+    static std::string sanitize(const std::string &text)
+    {
+        std::string out;
+        for (char c : text)
+            out += (isalnum((unsigned char)c) ? c : '_');
+        return out;
+    }
+
+public:
+    ParameterGrid(Codec codec) : m_codec(codec) {}
+
+    Codec codec() const
+    {
+        return m_codec;
+    }
+
+    ParameterGrid &add(const std::string &key, const std::vector<std::string> &values)
+    {
+        if (!values.empty())
+            m_axes.push_back({key, values});
+        return *this;
+    }
+
+    size_t size() const
+    {
+        if (m_axes.empty())
+            return 0;
+        size_t combinations = 1;
+        for (const auto &axis : m_axes)
+            combinations *= axis.second.size();
+        return combinations;
+    }
+
+    std::vector<ConfigVariant> expand() const
+    {
+        std::vector<ConfigVariant> variants;
+        size_t combinations = size();
+        variants.reserve(combinations);
+        for (size_t index = 0; index < combinations; ++index)
+        {
+            // Mixed radix counter over the axes, the last axis changes fastest
+            ConfigVariant variant;
+            size_t rest = index;
+            ConfigOverrides overrides(m_axes.size());
+            for (size_t a = m_axes.size(); a-- > 0;)
+            {
+                const auto &[key, values] = m_axes[a];
+                overrides[a] = {key, values[rest % values.size()]};
+                rest /= values.size();
+            }
+            for (const auto &[key, value] : overrides)
+            {
+                if (!variant.m_name.empty())
+                    variant.m_name += "-";
+                variant.m_name += sanitize(key) + sanitize(value);
+            }
+            variant.m_overrides = overrides;
+            variants.push_back(variant);
+        }
+        return variants;
+    }
+};
+
+// The variant auto-tuning picked for one volume, a row of <CODEC>-tuning.csv
+struct TuningChoice
+{
+    std::string m_name, m_variant;
+    double m_bits_per_pixel = 0.0, m_encoding_time = 0.0; // Over the sampled slabs
+    std::string m_overrides;                             // key=value;key=value
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Name", &TuningChoice::m_name),
+            csv_column("Variant", &TuningChoice::m_variant),
+            csv_column("BPP", &TuningChoice::m_bits_per_pixel),
+            csv_column("EncodingTime", &TuningChoice::m_encoding_time),
+            csv_column("Overrides", &TuningChoice::m_overrides));
+    }
+
+    static std::string join(const ConfigOverrides &overrides)
+    {
+        std::string text;
+        for (const auto &[key, value] : overrides)
+            text += (text.empty() ? "" : ";") + key + "=" + value;
+        return text;
+    }
+
+    ConfigOverrides split() const
+    {
+        ConfigOverrides overrides;
+        size_t start = 0;
+        while (start < m_overrides.size())
+        {
+            size_t end = m_overrides.find(';', start);
+            if (end == std::string::npos)
+                end = m_overrides.size();
+            size_t equals = m_overrides.find('=', start);
+            if (equals != std::string::npos && equals < end)
+                overrides.push_back({m_overrides.substr(start, equals - start), m_overrides.substr(equals + 1, end - equals - 1)});
+            start = end + 1;
+        }
+        return overrides;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Histogram.h"
+#include "ThreadPool.h"
+
+// How hard a volume looks to compress, from statistics that take a fraction of an encode to gather
+// All entropies are in bits per voxel; everything is 0 for a volume that was never analyzed
+struct Compressibility
+{
+    float m_entropy = 0.0f;              // Zeroth order, of the levels alone
+    float m_conditional_entropy = 0.0f;  // Given the left and upper neighbour, 16 levels of each as context
+    float m_slice_entropy = 0.0f;        // Of the difference to the same voxel of the previous slice
+    float m_mean_gradient = 0.0f;        // Mean absolute difference to the left and upper neighbour
+    float m_mean_slice_difference = 0.0f; // Mean absolute difference to the previous slice
+
+    bool is_known() const
+    {
+        return m_entropy > 0.0f || m_mean_gradient > 0.0f;
+    }
+
+    // Rough lossless bits per voxel: the codecs predict within the slice or from the previous one,
+    // whichever of the two entropies is lower is about what is left to code. Good for ranking volumes
+    // and for skipping the extremes, not for a results table.
+    float predicted_bpp() const
+    {
+        return std::min({m_entropy, m_conditional_entropy, m_slice_entropy});
+    }
+};
+
+// Computes Compressibility for 8 bit volumes, slices split between threads
+// Sums of absolute differences use SSE2 _mm_sad_epu8, 16 voxels at a time, where the compiler offers it
+class CompressibilityAnalyzer
+{
+private:
+    static constexpr size_t CONTEXTS = 256; // 16 levels of the left times 16 levels of the upper neighbour
+
+    // What one thread counted over its slices
+    struct Partial
+    {
+        std::vector<uint64_t> m_context_counts = std::vector<uint64_t>(CONTEXTS * 256, 0); // Context, level
+        Histogram<uint8_t> m_slice_differences;
+        uint64_t m_gradient_sum = 0, m_gradients = 0;
+        uint64_t m_slice_difference_sum = 0, m_slice_differences_counted = 0;
+    };
+
+    // Sum of |a[i] - b[i]|
+    static uint64_t absolute_differences(const uint8_t *a, const uint8_t *b, size_t count)
+    {
+        uint64_t sum = 0;
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i total = _mm_setzero_si128();
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            total = _mm_add_epi64(total, _mm_sad_epu8(va, vb)); // Two 16 bit sums in two 64 bit lanes
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), total);
+        sum = lanes[0] + lanes[1];
+#endif
+        for (; i < count; ++i)
+            sum += (uint64_t)std::abs((int)a[i] - (int)b[i]);
+        return sum;
+    }
+
+    // out[i] = current[i] - previous[i] modulo 256, the residual of predicting from the previous slice
+    static void slice_difference(const uint8_t *current, const uint8_t *previous, uint8_t *out, size_t count)
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(current + i));
+            __m128i vp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(previous + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(vc, vp));
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = (uint8_t)(current[i] - previous[i]);
+    }
+
+    // previous is the slice before data, if there is one, e.g. the last one of the slab before
+    static void analyze_slices(const uint8_t *data, size_t width, size_t height, size_t first, size_t last, Partial &partial,
+                               const uint8_t *previous_slice = nullptr)
+    {
+        size_t slice_size = width * height;
+        std::vector<uint8_t> differences(slice_size);
+        uint64_t *counts = partial.m_context_counts.data();
+        for (size_t z = first; z < last; ++z)
+        {
+            const uint8_t *slice = data + z * slice_size;
+            for (size_t y = 0; y < height; ++y)
+            {
+                const uint8_t *row = slice + y * width;
+                const uint8_t *up = y ? row - width : nullptr;
+                // Context of each voxel, neighbours outside the slice count as 0
+                for (size_t x = 0; x < width; ++x)
+                {
+                    unsigned left = x ? row[x - 1] : 0;
+                    unsigned above = up ? up[x] : 0;
+                    ++counts[(((left >> 4) << 4) | (above >> 4)) * 256 + row[x]];
+                }
+                if (width > 1)
+                {
+                    partial.m_gradient_sum += absolute_differences(row + 1, row, width - 1);
+                    partial.m_gradients += width - 1;
+                }
+                if (up)
+                {
+                    partial.m_gradient_sum += absolute_differences(row, up, width);
+                    partial.m_gradients += width;
+                }
+            }
+            const uint8_t *previous = z ? slice - slice_size : previous_slice;
+            if (previous)
+            {
+                slice_difference(slice, previous, differences.data(), slice_size);
+                partial.m_slice_differences.add(differences.data(), slice_size);
+                partial.m_slice_difference_sum += absolute_differences(slice, previous, slice_size);
+                partial.m_slice_differences_counted += slice_size;
+            }
+        }
+    }
+
+    // Shannon entropy of a histogram, bits per sample
+    template <typename Counts>
+    static double entropy(const Counts &counts, size_t levels, uint64_t total)
+    {
+        if (!total)
+            return 0.0;
+        double sum = 0.0;
+        for (size_t level = 0; level < levels; ++level)
+        {
+            double count = (double)counts[level];
+            if (count > 0.0)
+                sum += count * std::log2(count);
+        }
+        return std::log2((double)total) - sum / (double)total;
+    }
+
+public:
+    // Compressibility of a volume fed in order a slab of whole slices at a time, for volumes that are never held
+    // whole; the last slice of each slab is kept to predict the first one of the next from
+    class Accumulator
+    {
+    private:
+        size_t m_width, m_height;
+        Partial m_total;
+        uint64_t m_voxels = 0;
+        std::vector<uint8_t> m_previous;
+
+    public:
+        Accumulator(int width, int height) : m_width((size_t)width), m_height((size_t)height)
+        {
+        }
+
+        // threads 0 means one per core
+        void add(const uint8_t *slab, int slices, unsigned threads = 0)
+        {
+            size_t slice_size = m_width * m_height;
+            if (!slice_size || slices <= 0)
+                return;
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            threads = std::min<unsigned>(threads, (unsigned)slices);
+
+            std::vector<Partial> partials(threads);
+            {
+                ThreadPool pool(threads);
+                const uint8_t *previous = m_previous.empty() ? nullptr : m_previous.data();
+                for (unsigned t = 0; t < threads; ++t)
+                {
+                    size_t first = (size_t)slices * t / threads, last = (size_t)slices * (t + 1) / threads;
+                    pool.submit([this, &partials, t, slab, first, last, previous]
+                                { analyze_slices(slab, m_width, m_height, first, last, partials[t], previous); });
+                }
+                pool.wait();
+            }
+            for (const auto &partial : partials)
+            {
+                for (size_t i = 0; i < m_total.m_context_counts.size(); ++i)
+                    m_total.m_context_counts[i] += partial.m_context_counts[i];
+                m_total.m_slice_differences.merge(partial.m_slice_differences);
+                m_total.m_gradient_sum += partial.m_gradient_sum;
+                m_total.m_gradients += partial.m_gradients;
+                m_total.m_slice_difference_sum += partial.m_slice_difference_sum;
+                m_total.m_slice_differences_counted += partial.m_slice_differences_counted;
+            }
+            m_voxels += (uint64_t)slice_size * slices;
+            const uint8_t *last_slice = slab + (size_t)(slices - 1) * slice_size;
+            m_previous.assign(last_slice, last_slice + slice_size);
+        }
+
+        Compressibility result() const
+        {
+            Compressibility result;
+            if (!m_voxels)
+                return result;
+            // H(X) from the levels summed over the contexts, H(X | C) = sum over C of P(C) H(X | C)
+            std::vector<uint64_t> levels(256, 0);
+            double conditional = 0.0;
+            for (size_t context = 0; context < CONTEXTS; ++context)
+            {
+                const uint64_t *counts = m_total.m_context_counts.data() + context * 256;
+                uint64_t in_context = 0;
+                for (size_t level = 0; level < 256; ++level)
+                {
+                    levels[level] += counts[level];
+                    in_context += counts[level];
+                }
+                conditional += (double)in_context / m_voxels * entropy(counts, 256, in_context);
+            }
+            result.m_entropy = (float)entropy(levels, 256, m_voxels);
+            result.m_conditional_entropy = (float)conditional;
+            // A single slice has nothing to predict from, as good as not predicting at all
+            result.m_slice_entropy = m_total.m_slice_differences_counted
+                                         ? (float)entropy(m_total.m_slice_differences, 256, m_total.m_slice_differences_counted)
+                                         : result.m_entropy;
+            if (m_total.m_gradients)
+                result.m_mean_gradient = (float)((double)m_total.m_gradient_sum / m_total.m_gradients);
+            if (m_total.m_slice_differences_counted)
+                result.m_mean_slice_difference =
+                    (float)((double)m_total.m_slice_difference_sum / m_total.m_slice_differences_counted);
+            return result;
+        }
+    };
+
+    // threads 0 means one per core
+    static Compressibility analyze(const uint8_t *data, int width, int height, int depth, unsigned threads = 0)
+    {
+        Accumulator accumulator(width, height);
+        accumulator.add(data, depth, threads);
+        return accumulator.result();
+    }
+
+    // An already converted <name>.raw of 8 bit voxels
+    static bool analyze_file(const std::filesystem::path &raw_path, int width, int height, int depth,
+                             Compressibility &result, unsigned threads = 0)
+    {
+        uintmax_t voxels = (uintmax_t)width * height * depth;
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(raw_path, ec);
+        if (ec || size != voxels)
+        {
+            std::cerr << raw_path << " is not an 8 bit volume of " << width << "x" << height << "x" << depth << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> data(voxels);
+        std::ifstream file(raw_path, std::ios::binary);
+        if (!file.read(reinterpret_cast<char *>(data.data()), (std::streamsize)voxels))
+        {
+            std::cerr << "Could not read " << raw_path << std::endl;
+            return false;
+        }
+        result = analyze(data.data(), width, height, depth, threads);
+        return true;
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Placeholders a config template may hold
+enum TemplateSlot : uint8_t
+{
+    SLOT_NAME,   // XnameX, the volume name
+    SLOT_WIDTH,  // XwidthX
+    SLOT_HEIGHT, // XheightX
+    SLOT_DEPTH,  // XdepthX
+    SLOT_OUT,    // XoutX, the volume name with the variant, for everything the codec writes
+    SLOT_COUNT,
+};
+
+// What goes into the placeholders for one volume and variant; the dimensions are formatted once here
+// Holds views, the name and output name have to outlive it
+class TemplateValues
+{
+private:
+    std::string_view m_values[SLOT_COUNT];
+    char m_digits[3][12];
+
+public:
+    TemplateValues(std::string_view name, std::string_view out, int width, int height, int depth)
+    {
+        m_values[SLOT_NAME] = name;
+        m_values[SLOT_OUT] = out;
+        const int dimensions[3] = {width, height, depth};
+        for (int i = 0; i < 3; ++i)
+        {
+            auto result = std::to_chars(m_digits[i], m_digits[i] + sizeof(m_digits[i]), dimensions[i]);
+            m_values[SLOT_WIDTH + i] = std::string_view(m_digits[i], result.ptr - m_digits[i]);
+        }
+    }
+
+    TemplateValues(const TemplateValues &) = delete; // The views point into m_digits
+    TemplateValues &operator=(const TemplateValues &) = delete;
+
+    std::string_view operator[](TemplateSlot slot) const
+    {
+        return m_values[slot];
+    }
+};
+
+// Config text split once into literal pieces and placeholders, so rendering a volume is one pass of appends
+// instead of rescanning the whole text for every placeholder
+class ConfigTemplate
+{
+private:
+    static constexpr std::string_view PLACEHOLDERS[SLOT_COUNT] = {"XnameX", "XwidthX", "XheightX", "XdepthX", "XoutX"};
+
+    // Literal text followed by the placeholder after it, SLOT_COUNT for the last piece
+    struct Piece
+    {
+        uint32_t m_offset, m_length;
+        TemplateSlot m_slot;
+    };
+
+    std::string m_text;
+    std::vector<Piece> m_pieces;
+
+public:
+    // The placeholder starting at pos, SLOT_COUNT if there is none
+    static constexpr TemplateSlot placeholder_at(std::string_view text, size_t pos)
+    {
+        for (uint8_t slot = 0; slot < SLOT_COUNT; ++slot)
+        {
+            if (text.substr(pos, PLACEHOLDERS[slot].size()) == PLACEHOLDERS[slot])
+                return (TemplateSlot)slot;
+        }
+        return SLOT_COUNT;
+    }
+
+    // Number of placeholders in a text, for checking the built-in templates at compile time
+    static constexpr size_t count_placeholders(std::string_view text)
+    {
+        size_t count = 0;
+        for (size_t pos = 0; pos < text.size(); ++pos)
+        {
+            TemplateSlot slot = placeholder_at(text, pos);
+            if (slot != SLOT_COUNT)
+            {
+                ++count;
+                pos += PLACEHOLDERS[slot].size() - 1;
+            }
+        }
+        return count;
+    }
+
+    ConfigTemplate(std::string text) : m_text(std::move(text))
+    {
+        size_t literal_start = 0;
+        size_t pos = m_text.find('X');
+        while (pos != std::string::npos)
+        {
+            TemplateSlot slot = placeholder_at(m_text, pos);
+            if (slot == SLOT_COUNT)
+            {
+                pos = m_text.find('X', pos + 1);
+                continue;
+            }
+            m_pieces.push_back({(uint32_t)literal_start, (uint32_t)(pos - literal_start), slot});
+            literal_start = pos + PLACEHOLDERS[slot].size();
+            pos = m_text.find('X', literal_start);
+        }
+        m_pieces.push_back({(uint32_t)literal_start, (uint32_t)(m_text.size() - literal_start), SLOT_COUNT});
+    }
+
+    const std::string &text() const
+    {
+        return m_text;
+    }
+
+    // Replaces the buffer's contents with the rendered config; reuse the buffer to keep its capacity
+    void render(const TemplateValues &values, std::string &buffer) const
+    {
+        buffer.clear();
+        for (const auto &piece : m_pieces)
+        {
+            buffer.append(m_text, piece.m_offset, piece.m_length);
+            if (piece.m_slot != SLOT_COUNT)
+                buffer.append(values[piece.m_slot]);
+        }
+    }
+};
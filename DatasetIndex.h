@@ -0,0 +1,454 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Codec.h"
+#include "Compressibility.h"
+#include "Hash.h"
+
+static constexpr int CODEC_COUNT = JP3D + 1;
+
+// Everything the index knows about one volume, used to build a new index
+struct DatasetRow
+{
+    // Latest outcome of one codec on the volume
+    struct CodecResult
+    {
+        double m_encoding_time = 0.0, m_decoding_time = 0.0; // Seconds
+        uint64_t m_bitstream_size = 0;                       // Bytes
+        uint8_t m_status = 0;                                // DatasetIndex::Status
+    };
+
+    std::string m_name, m_folder, m_modality;
+    std::string m_duplicate_of; // <collection dir>/<name> of the same series converted earlier, empty if none
+    int32_t m_width = 0, m_height = 0, m_depth = 0, m_active_levels = 0;
+    float m_histogram_usage = 0.0f;
+    uint8_t m_is_packed = 0;
+    uint64_t m_raw_bytes = 0; // Size of <name>.raw
+    Hash128 m_checksum;       // XXH3-128 of <name>.raw, zero if unknown
+    uint64_t m_crc32c = 0;    // CRC32C of <name>.raw in the low half, bit 32 set when it is known
+    Compressibility m_compressibility;
+    int32_t m_crop_x = 0, m_crop_y = 0, m_crop_z = 0;           // Of the stored volume within the full one
+    int32_t m_full_width = 0, m_full_height = 0, m_full_depth = 0; // 0 if not cropped
+    uint8_t m_bit_depth = 0, m_packed_bit_depth = 0;              // Effective, 0 if unknown
+    uint8_t m_orientation = 0;                                     // Orientation, XY unless resliced
+    CodecResult m_results[CODEC_COUNT];
+};
+
+// Binary, column-oriented twin of conv_metadata.csv and the <CODEC>-results.csv sheets of one collection
+// directory. The file is mapped and the columns are used in place, nothing is parsed:
+//   header | column directory | column data, every column 8-byte aligned
+// Strings are (offset, length) pairs into a shared "Strings" column. Numbers are in host byte order,
+// which is fine for a file that never leaves the machine (or the x86 machines) that made it.
+class DatasetIndex
+{
+public:
+    enum Type : uint32_t
+    {
+        I32,
+        F32,
+        F64,
+        U8,
+        U64,
+        HASH128,
+        STRING,
+        BYTES,
+    };
+
+    enum Status : uint8_t
+    {
+        NOT_RUN = 0,
+        OK = 1,
+        FAILED = 2,
+    };
+
+    struct StringRef
+    {
+        uint32_t m_offset, m_length;
+    };
+
+    static constexpr char FILE_NAME[] = "conv_metadata.ntidx";
+
+private:
+    static constexpr char MAGIC[4] = {'N', 'T', 'I', 'X'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char m_magic[4];
+        uint32_t m_version;
+        uint64_t m_rows;
+        uint32_t m_columns;
+        uint32_t m_reserved;
+    };
+
+    struct Column
+    {
+        char m_name[24];
+        uint32_t m_type;
+        uint32_t m_element_size;
+        uint64_t m_offset;
+        uint64_t m_size;
+    };
+
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    uint64_t m_rows = 0;
+    const Column *m_columns = nullptr;
+    uint32_t m_column_count = 0;
+
+    // Resolved once on open
+    const StringRef *m_names = nullptr, *m_folders = nullptr, *m_modalities = nullptr, *m_duplicates = nullptr;
+    const char *m_strings = nullptr;
+    uint64_t m_strings_size = 0;
+
+    void unmap()
+    {
+        if (m_data && m_size)
+            munmap(const_cast<char *>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_rows = 0;
+        m_columns = nullptr;
+        m_column_count = 0;
+        m_names = m_folders = m_modalities = m_duplicates = nullptr;
+        m_strings = nullptr;
+        m_strings_size = 0;
+    }
+
+    const Column *find_column(std::string_view name, Type type, uint32_t element_size) const
+    {
+        for (uint32_t i = 0; i < m_column_count; ++i)
+        {
+            const Column &column = m_columns[i];
+            if (std::string_view(column.m_name, strnlen(column.m_name, sizeof(column.m_name))) != name)
+                continue;
+            if (column.m_type != type || column.m_element_size != element_size ||
+                column.m_offset + column.m_size > m_size || column.m_offset % 8 != 0)
+                return nullptr;
+            if (type != BYTES && column.m_size != m_rows * element_size)
+                return nullptr;
+            return &column;
+        }
+        return nullptr;
+    }
+
+    std::string_view string_at(const StringRef *refs, size_t row) const
+    {
+        if (!refs || row >= m_rows)
+            return {};
+        const StringRef &ref = refs[row];
+        if ((uint64_t)ref.m_offset + ref.m_length > m_strings_size)
+            return {};
+        return std::string_view(m_strings + ref.m_offset, ref.m_length);
+    }
+
+    // Column builder for write()
+    struct PendingColumn
+    {
+        std::string m_name;
+        Type m_type;
+        uint32_t m_element_size;
+        std::vector<char> m_bytes;
+    };
+
+    template <typename T, typename Get>
+    static PendingColumn make_column(const std::string &name, Type type, size_t rows, Get get)
+    {
+        PendingColumn column{name, type, (uint32_t)sizeof(T), {}};
+        column.m_bytes.resize(rows * sizeof(T));
+        for (size_t i = 0; i < rows; ++i)
+        {
+            T value = get(i);
+            memcpy(column.m_bytes.data() + i * sizeof(T), &value, sizeof(T));
+        }
+        return column;
+    }
+
+public:
+    DatasetIndex() = default;
+    DatasetIndex(const DatasetIndex &) = delete;
+    DatasetIndex &operator=(const DatasetIndex &) = delete;
+    ~DatasetIndex()
+    {
+        unmap();
+    }
+
+    static std::filesystem::path path_for(const std::filesystem::path &collection_dir)
+    {
+        return collection_dir / FILE_NAME;
+    }
+
+    // An index at least as new as conv_metadata.csv next to it, which is what readers should trust
+    static bool is_fresh(const std::filesystem::path &collection_dir)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path index = path_for(collection_dir), csv = collection_dir / "conv_metadata.csv";
+        if (!fs::exists(index, ec))
+            return false;
+        if (!fs::exists(csv, ec))
+            return true;
+        return fs::last_write_time(index, ec) >= fs::last_write_time(csv, ec);
+    }
+
+    // False with errno set when the file cannot be mapped, with errno EINVAL when it is not an index
+    bool open(const std::filesystem::path &path)
+    {
+        unmap();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+        {
+            close(fd);
+            errno = EINVAL;
+            return false;
+        }
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            errno = error;
+            return false;
+        }
+        m_data = static_cast<const char *>(data);
+        m_size = (size_t)st.st_size;
+
+        const Header *header = reinterpret_cast<const Header *>(m_data);
+        if (memcmp(header->m_magic, MAGIC, 4) != 0 || header->m_version != VERSION ||
+            sizeof(Header) + (uint64_t)header->m_columns * sizeof(Column) > m_size)
+        {
+            unmap();
+            errno = EINVAL;
+            return false;
+        }
+        m_rows = header->m_rows;
+        m_column_count = header->m_columns;
+        m_columns = reinterpret_cast<const Column *>(m_data + sizeof(Header));
+
+        m_names = column<StringRef>("Name", STRING);
+        m_folders = column<StringRef>("OriginFolder", STRING);
+        m_modalities = column<StringRef>("Modality", STRING);
+        m_duplicates = column<StringRef>("DuplicateOf", STRING); // Indexes from before dedup lack it
+        if (const Column *strings = find_column("Strings", BYTES, 1))
+        {
+            m_strings = m_data + strings->m_offset;
+            m_strings_size = strings->m_size;
+        }
+        if (!m_names || !m_strings)
+        {
+            unmap();
+            errno = EINVAL;
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return (size_t)m_rows;
+    }
+
+    // Typed view of a whole column, nullptr if the index has no such column of that type
+    template <typename T>
+    const T *column(std::string_view name, Type type) const
+    {
+        const Column *found = find_column(name, type, (uint32_t)sizeof(T));
+        return found ? reinterpret_cast<const T *>(m_data + found->m_offset) : nullptr;
+    }
+
+    static std::string codec_column(Codec codec, const char *field)
+    {
+        return get_codec_files(codec).m_name + "." + field;
+    }
+
+    std::string_view name(size_t row) const
+    {
+        return string_at(m_names, row);
+    }
+
+    std::string_view folder(size_t row) const
+    {
+        return string_at(m_folders, row);
+    }
+
+    std::string_view modality(size_t row) const
+    {
+        return string_at(m_modalities, row);
+    }
+
+    std::string_view duplicate_of(size_t row) const
+    {
+        return string_at(m_duplicates, row);
+    }
+
+    // Copy of one row, e.g. to change a few fields and write a new index
+    DatasetRow row(size_t i) const
+    {
+        DatasetRow row;
+        row.m_name = std::string(name(i));
+        row.m_folder = std::string(folder(i));
+        row.m_modality = std::string(modality(i));
+        row.m_duplicate_of = std::string(duplicate_of(i));
+        auto get = [this, i](auto &field, const char *column_name, Type type) {
+            using T = std::remove_reference_t<decltype(field)>;
+            if (const T *values = column<T>(column_name, type))
+                field = values[i];
+        };
+        get(row.m_width, "Width", I32);
+        get(row.m_height, "Height", I32);
+        get(row.m_depth, "Depth", I32);
+        get(row.m_active_levels, "ActiveLevels", I32);
+        get(row.m_histogram_usage, "HistogramUsage", F32);
+        get(row.m_is_packed, "HasPackedVersion", U8);
+        get(row.m_raw_bytes, "RawBytes", U64);
+        get(row.m_checksum, "Checksum", HASH128);
+        get(row.m_crc32c, "CRC32C", U64);
+        get(row.m_compressibility.m_entropy, "Entropy", F32);
+        get(row.m_compressibility.m_conditional_entropy, "ConditionalEntropy", F32);
+        get(row.m_compressibility.m_slice_entropy, "SliceEntropy", F32);
+        get(row.m_compressibility.m_mean_gradient, "MeanGradient", F32);
+        get(row.m_compressibility.m_mean_slice_difference, "MeanSliceDifference", F32);
+        get(row.m_crop_x, "CropX", I32);
+        get(row.m_crop_y, "CropY", I32);
+        get(row.m_crop_z, "CropZ", I32);
+        get(row.m_full_width, "FullWidth", I32);
+        get(row.m_full_height, "FullHeight", I32);
+        get(row.m_full_depth, "FullDepth", I32);
+        get(row.m_bit_depth, "BitDepth", U8);
+        get(row.m_packed_bit_depth, "PackedBitDepth", U8);
+        get(row.m_orientation, "Orientation", U8);
+        for (Codec codec : {AVC, HEVC, VVC, JP3D})
+        {
+            DatasetRow::CodecResult &result = row.m_results[codec];
+            get(result.m_encoding_time, codec_column(codec, "EncodingTime").c_str(), F64);
+            get(result.m_decoding_time, codec_column(codec, "DecodingTime").c_str(), F64);
+            get(result.m_bitstream_size, codec_column(codec, "BitstreamSize").c_str(), U64);
+            get(result.m_status, codec_column(codec, "Status").c_str(), U8);
+        }
+        return row;
+    }
+
+    // Writes the rows next to the target and renames it over, so readers never map a half-written index
+    static bool write(const std::filesystem::path &path, const std::vector<DatasetRow> &rows)
+    {
+        std::vector<PendingColumn> columns;
+
+        // Strings first, their references point into the blob
+        PendingColumn strings{"Strings", BYTES, 1, {}};
+        auto add_string = [&strings](const std::string &text) {
+            StringRef ref{(uint32_t)strings.m_bytes.size(), (uint32_t)text.size()};
+            strings.m_bytes.insert(strings.m_bytes.end(), text.begin(), text.end());
+            return ref;
+        };
+        std::vector<StringRef> names, folders, modalities, duplicates;
+        for (const auto &row : rows)
+        {
+            names.push_back(add_string(row.m_name));
+            folders.push_back(add_string(row.m_folder));
+            modalities.push_back(add_string(row.m_modality));
+            duplicates.push_back(add_string(row.m_duplicate_of));
+        }
+        size_t n = rows.size();
+        columns.push_back(make_column<StringRef>("Name", STRING, n, [&](size_t i) { return names[i]; }));
+        columns.push_back(make_column<StringRef>("OriginFolder", STRING, n, [&](size_t i) { return folders[i]; }));
+        columns.push_back(make_column<StringRef>("Modality", STRING, n, [&](size_t i) { return modalities[i]; }));
+        columns.push_back(make_column<StringRef>("DuplicateOf", STRING, n, [&](size_t i) { return duplicates[i]; }));
+        columns.push_back(make_column<int32_t>("Width", I32, n, [&](size_t i) { return rows[i].m_width; }));
+        columns.push_back(make_column<int32_t>("Height", I32, n, [&](size_t i) { return rows[i].m_height; }));
+        columns.push_back(make_column<int32_t>("Depth", I32, n, [&](size_t i) { return rows[i].m_depth; }));
+        columns.push_back(make_column<int32_t>("ActiveLevels", I32, n, [&](size_t i) { return rows[i].m_active_levels; }));
+        columns.push_back(make_column<float>("HistogramUsage", F32, n, [&](size_t i) { return rows[i].m_histogram_usage; }));
+        columns.push_back(make_column<uint8_t>("HasPackedVersion", U8, n, [&](size_t i) { return rows[i].m_is_packed; }));
+        columns.push_back(make_column<uint64_t>("RawBytes", U64, n, [&](size_t i) { return rows[i].m_raw_bytes; }));
+        columns.push_back(make_column<Hash128>("Checksum", HASH128, n, [&](size_t i) { return rows[i].m_checksum; }));
+        columns.push_back(make_column<uint64_t>("CRC32C", U64, n, [&](size_t i) { return rows[i].m_crc32c; }));
+        columns.push_back(make_column<float>("Entropy", F32, n, [&](size_t i) { return rows[i].m_compressibility.m_entropy; }));
+        columns.push_back(make_column<float>("ConditionalEntropy", F32, n,
+                                             [&](size_t i) { return rows[i].m_compressibility.m_conditional_entropy; }));
+        columns.push_back(make_column<float>("SliceEntropy", F32, n, [&](size_t i) { return rows[i].m_compressibility.m_slice_entropy; }));
+        columns.push_back(make_column<float>("MeanGradient", F32, n, [&](size_t i) { return rows[i].m_compressibility.m_mean_gradient; }));
+        columns.push_back(make_column<float>("MeanSliceDifference", F32, n,
+                                             [&](size_t i) { return rows[i].m_compressibility.m_mean_slice_difference; }));
+        columns.push_back(make_column<int32_t>("CropX", I32, n, [&](size_t i) { return rows[i].m_crop_x; }));
+        columns.push_back(make_column<int32_t>("CropY", I32, n, [&](size_t i) { return rows[i].m_crop_y; }));
+        columns.push_back(make_column<int32_t>("CropZ", I32, n, [&](size_t i) { return rows[i].m_crop_z; }));
+        columns.push_back(make_column<int32_t>("FullWidth", I32, n, [&](size_t i) { return rows[i].m_full_width; }));
+        columns.push_back(make_column<int32_t>("FullHeight", I32, n, [&](size_t i) { return rows[i].m_full_height; }));
+        columns.push_back(make_column<int32_t>("FullDepth", I32, n, [&](size_t i) { return rows[i].m_full_depth; }));
+        columns.push_back(make_column<uint8_t>("BitDepth", U8, n, [&](size_t i) { return rows[i].m_bit_depth; }));
+        columns.push_back(make_column<uint8_t>("PackedBitDepth", U8, n, [&](size_t i) { return rows[i].m_packed_bit_depth; }));
+        columns.push_back(make_column<uint8_t>("Orientation", U8, n, [&](size_t i) { return rows[i].m_orientation; }));
+        for (Codec codec : {AVC, HEVC, VVC, JP3D})
+        {
+            columns.push_back(make_column<double>(codec_column(codec, "EncodingTime"), F64, n,
+                                                  [&](size_t i) { return rows[i].m_results[codec].m_encoding_time; }));
+            columns.push_back(make_column<double>(codec_column(codec, "DecodingTime"), F64, n,
+                                                  [&](size_t i) { return rows[i].m_results[codec].m_decoding_time; }));
+            columns.push_back(make_column<uint64_t>(codec_column(codec, "BitstreamSize"), U64, n,
+                                                    [&](size_t i) { return rows[i].m_results[codec].m_bitstream_size; }));
+            columns.push_back(make_column<uint8_t>(codec_column(codec, "Status"), U8, n,
+                                                   [&](size_t i) { return rows[i].m_results[codec].m_status; }));
+        }
+        columns.push_back(std::move(strings));
+
+        // Lay out the directory and the 8-byte aligned data after it
+        Header header;
+        memcpy(header.m_magic, MAGIC, 4);
+        header.m_version = VERSION;
+        header.m_rows = rows.size();
+        header.m_columns = (uint32_t)columns.size();
+        header.m_reserved = 0;
+        std::vector<Column> directory(columns.size());
+        uint64_t offset = sizeof(Header) + directory.size() * sizeof(Column);
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            offset = (offset + 7) & ~(uint64_t)7;
+            Column &column = directory[c];
+            memset(&column, 0, sizeof(column));
+            strncpy(column.m_name, columns[c].m_name.c_str(), sizeof(column.m_name) - 1);
+            column.m_type = columns[c].m_type;
+            column.m_element_size = columns[c].m_element_size;
+            column.m_offset = offset;
+            column.m_size = columns[c].m_bytes.size();
+            offset += column.m_size;
+        }
+
+        std::filesystem::path temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(directory.data()), directory.size() * sizeof(Column));
+            uint64_t written = sizeof(Header) + directory.size() * sizeof(Column);
+            static const char padding[8] = {};
+            for (size_t c = 0; c < columns.size(); ++c)
+            {
+                file.write(padding, directory[c].m_offset - written);
+                file.write(columns[c].m_bytes.data(), columns[c].m_bytes.size());
+                written = directory[c].m_offset + directory[c].m_size;
+            }
+            if (!file)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        return !ec;
+    }
+};
@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "Digest.h"
+#include "Hash.h"
+#include "Slabs.h"
+
+// A series as first converted: its fingerprint and where its volume is, <collection dir>/<name> relative to
+// the collections directory
+class SeriesRecord
+{
+public:
+    Hash128 m_fingerprint;
+    Hash128 m_tail_fingerprint; // Without the first of those slices, unknown if that leaves none
+    std::string m_location;
+    int m_slices = 0; // Slices the fingerprint covers
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Fingerprint", &SeriesRecord::m_fingerprint),
+            csv_column("TailFingerprint", &SeriesRecord::m_tail_fingerprint, false),
+            csv_column("Location", &SeriesRecord::m_location),
+            csv_column("Slices", &SeriesRecord::m_slices));
+    }
+};
+
+// Fingerprints of every converted volume under one collections directory, shared by all its collections so an
+// acquisition that TCIA lists twice, in one collection or in two, is encoded once
+// A fingerprint is the XXH3 of the slice digests after any leading all-zero slices, so the blank slice the
+// converter starts uncropped volumes with does not tell two copies of a series apart; the tail fingerprint also
+// drops the first slice after those, so does a localizer that one copy of a series starts with and the other not
+// Fingerprints only match over the same number of slices
+class SeriesIndex
+{
+private:
+    std::map<Hash128, SeriesRecord> m_series;
+    std::map<Hash128, Hash128> m_tails; // Tail fingerprint -> fingerprint
+
+    const SeriesRecord *find(const Hash128 &fingerprint, int slices) const
+    {
+        auto found = m_series.find(fingerprint);
+        if (found != m_series.end() && found->second.m_slices == slices)
+            return &found->second;
+        auto tail = m_tails.find(fingerprint);
+        if (tail != m_tails.end())
+        {
+            found = m_series.find(tail->second);
+            if (found != m_series.end() && found->second.m_slices - 1 == slices)
+                return &found->second;
+        }
+        return nullptr;
+    }
+
+    void add(const SeriesRecord &record)
+    {
+        m_series[record.m_fingerprint] = record;
+        if (record.m_tail_fingerprint != Hash128())
+            m_tails.emplace(record.m_tail_fingerprint, record.m_fingerprint);
+    }
+
+public:
+    static constexpr char FILE_NAME[] = "series_index.csv";
+
+    static std::filesystem::path path_for(const std::filesystem::path &collections_dir)
+    {
+        return collections_dir / FILE_NAME;
+    }
+
+    size_t size() const
+    {
+        return m_series.size();
+    }
+
+    // The series seen before with the same fingerprint or tail fingerprint, either way round; nullptr if there
+    // was none and record is the first
+    const SeriesRecord *find_or_add(const SeriesRecord &record)
+    {
+        const SeriesRecord *found = find(record.m_fingerprint, record.m_slices);
+        if (!found && record.m_tail_fingerprint != Hash128())
+            found = find(record.m_tail_fingerprint, record.m_slices - 1);
+        if (!found)
+            add(record);
+        return found;
+    }
+
+    // Makes record the first instead of first, e.g. when the volume the index named is gone
+    void replace(const SeriesRecord &first, const SeriesRecord &record)
+    {
+        SeriesRecord old = first; // Lives in m_series
+        auto tail = m_tails.find(old.m_tail_fingerprint);
+        if (tail != m_tails.end() && tail->second == old.m_fingerprint)
+            m_tails.erase(tail);
+        m_series.erase(old.m_fingerprint);
+        add(record);
+    }
+
+    // Of an 8 bit volume of width x height slices, .raw or bricked, from its digest sidecar when that is current;
+    // false if it cannot be read or holds nothing but zeros
+    static bool fingerprint(const std::filesystem::path &volume_path, int width, int height, Hash128 &fingerprint,
+                            Hash128 &tail_fingerprint, int &slices)
+    {
+        size_t slice_size = (size_t)width * height;
+        if (!slice_size)
+            return false;
+        SliceDigest whole;
+        std::vector<SliceDigest> digests;
+        if (!VolumeDigest::read(volume_path, whole, digests) || digests.empty() || digests[0].m_bytes != slice_size)
+        {
+            VolumeDigest digest(slice_size);
+            if (volume_path.extension() == BrickedVolume::EXTENSION)
+            {
+                // Bricks decoded a slab at a time, in the budget of a few slices
+                SlabReader reader;
+                if (!reader.open(volume_path) || reader.slice_size() != slice_size ||
+                    !reader.for_each(8 * slice_size, [&digest, &reader](const uint8_t *slab, int, int count)
+                                     {
+                                         digest.update(slab, reader.slice_size() * count);
+                                         return true;
+                                     }))
+                    return false;
+            }
+            else if (!VolumeDigest::of_file(volume_path, slice_size, false, digest))
+                return false;
+            digests = digest.slices();
+        }
+
+        std::string blank = XXH3::hash128(std::vector<uint8_t>(slice_size).data(), slice_size).to_string();
+        size_t first = 0;
+        while (first < digests.size() && digests[first].m_xxh3 == blank)
+            ++first;
+        if (first == digests.size())
+            return false;
+
+        auto hash_from = [&](size_t begin)
+        {
+            XXH3 hash;
+            hash.update(&width, sizeof(width));
+            hash.update(&height, sizeof(height));
+            for (size_t i = begin; i < digests.size(); ++i)
+                hash.update(digests[i].m_xxh3.data(), digests[i].m_xxh3.size());
+            return hash.digest128();
+        };
+        fingerprint = hash_from(first);
+        tail_fingerprint = first + 1 < digests.size() ? hash_from(first + 1) : Hash128();
+        slices = (int)(digests.size() - first);
+        return true;
+    }
+
+    bool load(const std::filesystem::path &path)
+    {
+        m_series.clear();
+        m_tails.clear();
+        if (!std::filesystem::exists(path))
+            return true; // Nothing fingerprinted yet
+        CSVReader reader;
+        if (!reader.open(path))
+        {
+            std::cerr << "Error while opening series index: " << strerror(errno);
+            return false;
+        }
+        CSVRow row;
+        auto schema = SeriesRecord::schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << path << " lacks some of its columns" << std::endl;
+            return false;
+        }
+        SeriesRecord record;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, record))
+                add(record);
+        }
+        return true;
+    }
+
+    bool save(const std::filesystem::path &path) const
+    {
+        std::filesystem::path temp_file = path;
+        temp_file += ".tmp";
+        {
+            std::ofstream file(temp_file);
+            auto schema = SeriesRecord::schema();
+            std::string buffer;
+            schema.write_header(buffer);
+            for (const auto &[fingerprint, record] : m_series)
+                schema.write(record, buffer);
+            file << buffer;
+            if (!file)
+            {
+                std::cerr << "Could not write series index: " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_file, path, ec);
+        if (ec)
+        {
+            std::cerr << "Could not replace series index: " << ec.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
@@ -1,29 +1,60 @@
+#pragma once
 #include <iostream>
 #include <filesystem>
 #include <string>
 #include <fstream>
+#include <deque>
+#include <future>
 #include <map>
+#include <memory>
+#include <set>
 
+#include "Bricks.h"
 #include "CImg.h"
-#include "CSVRow.h"
+#include "CSVReader.h"
+#include "Compressibility.h"
+#include "Crop.h"
+#include "Dedup.h"
+#include "Digest.h"
 #include "FileMetadata.h"
+#include "Histogram.h"
+#include "MemoryGovernor.h"
+#include "Reslice.h"
+#include "Slabs.h"
 
 enum ImageFormat
 {
     CIMG,
-    RAW
+    RAW,
+    BRICKED // BrickedVolume, for random access; the codecs still need a .raw
+};
+
+// What dedup_converted does with a volume whose series was converted before
+enum DuplicateAction
+{
+    DUPLICATE_SKIP,     // Marked in conv_metadata.csv so the codecs skip it, the files stay
+    DUPLICATE_HARD_LINK // Also its .raw becomes a hard link to the first one's, if they are the same bytes
 };
 
 class DicomConverter
 {
 private:
     using Img = cimg_library::CImg<unsigned char>;
-    using Hist = cimg_library::CImg<float>;
+    using Hist = Histogram<unsigned char>;
+
+    // Volumes held at once by an in-memory conversion: the one being appended to and its copy, then the
+    // cropped and packed ones; what MemoryGovernor is asked for per voxel
+    static constexpr uintmax_t CONVERSION_COPIES = 4;
 
     int m_max_mod_occurs;
     int m_min_slices, m_min_slices_us;
     bool m_pack_histograms, m_copy_originals;
     ImageFormat m_format;
+    bool m_crop_borders = false;
+    int m_brick_size = BrickedVolume::DEFAULT_BRICK_SIZE;
+    size_t m_memory_budget = 0;
+    bool m_crc32c = false;
+    bool m_compress_bricks = true;
 
 public:
     DicomConverter(
@@ -43,15 +74,132 @@ public:
 
     DicomConverter(const DicomConverter &) = delete;
 
+    // Store only the box around the voxels that are not 0, see FileMetadata::crop_box
+    void set_crop_borders(bool crop = true)
+    {
+        m_crop_borders = crop;
+    }
+
+    // Edge of the bricks of the BRICKED format and whether they are stored LosslessCoder coded
+    void set_brick_options(int brick_size, bool compress = true)
+    {
+        m_brick_size = brick_size;
+        m_compress_bricks = compress;
+    }
+
+    // RAW volumes are written slice by slice as they are loaded and then histogrammed, cropped, checksummed and
+    // packed in slabs, never holding more than about this many bytes of them; 0 keeps every volume in memory
+    // Their compressibility is not computed, analyze_converted can fill it in within a budget as well
+    // CIMG and BRICKED files are written from a whole volume, they cannot have a budget
+    void set_memory_budget(size_t bytes)
+    {
+        if (bytes && m_format != RAW)
+        {
+            std::cerr << "A memory budget needs the RAW format, converting every volume in memory" << std::endl;
+            return;
+        }
+        m_memory_budget = bytes;
+    }
+
+    // CRC32C next to the XXH3 digests of every written volume, in the sidecar and the CRC32C column
+    void set_crc32c(bool crc32c = true)
+    {
+        m_crc32c = crc32c;
+    }
+
+    // Slices are loaded on pool, a few ahead of the one being appended; may be shared by many converters
+    void set_io_pool(ThreadPool *pool)
+    {
+        m_io_pool = pool;
+    }
+
+    // A series picked by next_wave and the temporary name it is converted under, see next_wave
+    struct PlannedSeries
+    {
+        FileMetadata *m_metadata;
+        std::filesystem::path m_file_dir;
+        std::string m_file_name;
+    };
+
 private:
-    std::filesystem::path m_manifest_dir;
+    // Candidates of one modality and how many more series its quota has room for
+    struct ModalityPlan
+    {
+        std::vector<FileMetadata *> m_candidates;
+        size_t m_next = 0;
+        int m_room = 0;
+    };
+
+    // Slices of a series in order, the ones that fail to load skipped; with a pool the next few load on it while
+    // the current one is used, medcon runs one process per slice and mostly waits on the disk
+    class SliceLoader
+    {
+    private:
+        static constexpr size_t AHEAD = 8;
+
+        const std::vector<std::filesystem::directory_entry> &m_entries;
+        ThreadPool *m_pool;
+        size_t m_next = 0;
+        std::deque<std::pair<std::future<bool>, std::shared_ptr<Img>>> m_pending;
+
+    public:
+        SliceLoader(const std::vector<std::filesystem::directory_entry> &entries, ThreadPool *pool)
+            : m_entries(entries), m_pool(pool)
+        {
+        }
+
+        SliceLoader(const SliceLoader &) = delete;
+
+        ~SliceLoader()
+        {
+            // Queued loads still refer to the entries of the caller
+            for (auto &pending : m_pending)
+                pending.first.wait();
+        }
+
+        // False after the last slice; rethrows what loading threw
+        bool next(Img &image)
+        {
+            for (;;)
+            {
+                while (m_pool && m_pending.size() < AHEAD && m_next < m_entries.size())
+                {
+                    auto slice = std::make_shared<Img>();
+                    auto load = std::make_shared<std::packaged_task<bool()>>(
+                        [&entry = m_entries[m_next], slice] { return load_slice(entry, *slice); });
+                    m_pending.emplace_back(load->get_future(), slice);
+                    m_pool->submit([load] { (*load)(); });
+                    ++m_next;
+                }
+                if (m_pending.empty())
+                {
+                    if (m_pool || m_next >= m_entries.size())
+                        return false;
+                    if (load_slice(m_entries[m_next++], image))
+                        return true;
+                    continue;
+                }
+                auto [loaded, slice] = std::move(m_pending.front());
+                m_pending.pop_front();
+                if (loaded.get())
+                {
+                    image.swap(*slice);
+                    return true;
+                }
+            }
+        }
+    };
+
+    std::filesystem::path m_manifest_dir, m_collection_dir;
     std::vector<FileMetadata> m_metadatas;
     std::map<std::string, unsigned int> m_modality_occurrences;
+    std::map<std::string, ModalityPlan> m_modality_plans;
+    std::vector<PlannedSeries> m_wave;
+    ThreadPool *m_io_pool = nullptr;
 
-    Hist get_histogram(const Img &image, int num_bins = 256) const
+    Hist get_histogram(const Img &image) const
     {
-        Hist histogram = image.get_histogram(num_bins, 0, 255);
-        return histogram;
+        return Hist::of(image.data(), image.size());
     }
 
     bool is_sparse_histogram(const FileMetadata &metadata, int num_bins = 256) const
@@ -61,51 +209,224 @@ private:
 
     Img pack_volumetric_image(const Img &image, const Hist &histogram) const
     {
-        // Create the mapping from original bins to packed bins
-        std::map<int, int> bin_mapping;
-        int packed_bin_index = 0;
+        // Active levels in order, every other level is unused
+        std::vector<unsigned char> table = histogram.packing_table();
+
+        Img packed_image(image.width(), image.height(), image.depth(), image.spectrum());
+        const unsigned char *source = image.data();
+        unsigned char *packed = packed_image.data();
+        for (size_t i = 0, size = image.size(); i < size; ++i)
+            packed[i] = table[source[i]];
+
+        return packed_image;
+    }
+
+    void calculate_histogram_usage(const Hist &histogram, FileMetadata &metadata)
+    {
+        metadata.m_active_levels = histogram.active_levels();
+        metadata.m_histogram_usage = histogram.usage();
+        // The stored volume needs its highest level, a packed one only its number of levels
+        metadata.m_bit_depth = FileMetadata::bits_for(histogram.max_level() + 1);
+        metadata.m_packed_bit_depth = FileMetadata::bits_for(metadata.m_active_levels);
+    }
 
-        // Only add mappings for active levels
-        for (int i = 0; i < histogram.size(); ++i)
+    // Writes a .raw a slice at a time through the digest, next to it and renamed over, then its digest sidecar
+    static bool write_raw(const std::filesystem::path &path, const uint8_t *data, int width, int height, int depth,
+                          bool crc32c, VolumeDigest &digest)
+    {
+        namespace fs = std::filesystem;
+        size_t slice_size = (size_t)width * height;
+        digest = VolumeDigest(slice_size, crc32c);
+        fs::path temp_path = path;
+        temp_path += ".tmp";
         {
-            if (histogram[i] > 0)
+            std::ofstream raw(temp_path, std::ios::binary | std::ios::trunc);
+            for (int z = 0; z < depth && raw; ++z)
+            {
+                const uint8_t *slice = data + z * slice_size;
+                digest.update(slice, slice_size); // Still in cache when it is written
+                raw.write(reinterpret_cast<const char *>(slice), (std::streamsize)slice_size);
+            }
+            raw.close();
+            if (!raw)
             {
-                bin_mapping[i] = packed_bin_index++;
+                std::cerr << "Could not write " << temp_path << std::endl;
+                std::error_code ec;
+                fs::remove(temp_path, ec);
+                return false;
             }
         }
+        fs::rename(temp_path, path);
+        return digest.write(path);
+    }
 
-        // Create a new image for the packed image
-        Img packed_image(image.width(), image.height(), image.depth(), image.spectrum());
+    static void set_digest(FileMetadata &metadata, const VolumeDigest &digest)
+    {
+        metadata.m_raw_bytes = digest.bytes();
+        metadata.m_checksum = digest.checksum();
+        metadata.m_crc32c = digest.has_crc32c() ? SliceDigest::crc_string(digest.crc32c()) : std::string();
+    }
+
+    static bool load_slice(const std::filesystem::directory_entry &entry, Img &image)
+    {
+        image = Img::get_load_medcon_external(entry.path().c_str());
 
-        // Apply the mapping to the image
-        cimg_forXYZC(image, x, y, z, c)
+        if (image.is_empty())
         {
-            packed_image(x, y, z, c) = bin_mapping[image(x, y, z, c)];
+            std::cerr << "Unexpected empty image; skipping" << std::endl;
+            return false;
         }
 
-        return packed_image;
+        if (image.depth() > 1)
+        {
+            std::cerr << "Unexpected 3D layers in 2D image; skipping" << std::endl;
+            return false;
+        }
+
+        if (image.spectrum() > 1)
+        {
+            image = image.get_RGBtoYCbCr().get_channel(0);
+        }
+        return true;
     }
 
-    void calculate_histogram_usage(const Hist &histogram, FileMetadata &metadata)
+    // The RAW conversion of one series with at most m_memory_budget bytes of it in memory, see set_memory_budget
+    bool convert_streamed(const std::vector<std::filesystem::directory_entry> &entries,
+                          const std::filesystem::path &destination_file, const std::filesystem::path &destination_file_packed,
+                          std::string &file_name, FileMetadata &metadata)
     {
-        int active_bins = 0;
-        int min_active_bin = -1;
-        int max_active_bin;
-
-        for (int i = 0; i < histogram.size(); ++i)
+        namespace fs = std::filesystem;
+        // The slabs and their read-ahead, plus whatever crop or packing write on the way out
+        MemoryGovernor::Reservation reservation = MemoryGovernor::instance().reserve(2 * m_memory_budget);
+        int width = 0, height = 0, depth = 0;
         {
-            float bin_val = histogram[i];
-
-            if (bin_val > 0)
+            std::ofstream raw(destination_file, std::ios::binary | std::ios::trunc);
+            SliceLoader slices(entries, m_io_pool);
+            Img image;
+            while (slices.next(image))
             {
-                if (min_active_bin == -1)
-                    min_active_bin = i;
-                ++active_bins;
-                max_active_bin = i;
+                if (depth == 0)
+                {
+                    // Starts with a blank slice, like the volumes converted in memory
+                    width = image.width();
+                    height = image.height();
+                    std::vector<char> blank((size_t)width * height, 0);
+                    raw.write(blank.data(), (std::streamsize)blank.size());
+                    ++depth;
+                }
+                if (image.width() != width || image.height() != height)
+                {
+                    std::cerr << "Slice of a different size; skipping" << std::endl;
+                    continue;
+                }
+                raw.write(reinterpret_cast<const char *>(image.data()), (std::streamsize)image.size());
+                ++depth;
+            }
+            raw.close();
+            if (!raw || depth == 0)
+            {
+                std::cerr << "Could not write " << destination_file << std::endl;
+                return false;
             }
         }
-        metadata.m_active_levels = active_bins;
-        metadata.m_histogram_usage = (float)active_bins / (float)(1 + max_active_bin - min_active_bin);
+
+        SlabReader reader;
+        if (!reader.open(destination_file, width, height, depth))
+        {
+            std::cerr << "Error opening " << destination_file << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        OutOfCore::Scan scan;
+        VolumeDigest digest(reader.slice_size(), m_crc32c);
+        if (!OutOfCore::scan(reader, m_memory_budget, m_crop_borders, scan, 0, &digest))
+            return false;
+        CropBox crop_box;
+        if (m_crop_borders && !scan.m_box.is_empty() && !scan.m_box.is_whole(width, height, depth))
+        {
+            // Rescanned on the way out, what is left of the background changes the histogram
+            crop_box = scan.m_box;
+            fs::path temp_path = destination_file;
+            temp_path += ".tmp";
+            digest = VolumeDigest((size_t)crop_box.m_width * crop_box.m_height, m_crc32c);
+            if (!OutOfCore::write_box(reader, m_memory_budget, crop_box, temp_path, &scan, 0, &digest))
+                return false;
+            reader.close();
+            fs::rename(temp_path, destination_file);
+            if (!reader.open(destination_file, crop_box.m_width, crop_box.m_height, crop_box.m_depth))
+                return false;
+        }
+        if (!digest.write(destination_file))
+            return false;
+        set_digest(metadata, digest);
+        calculate_histogram_usage(scan.m_histogram, metadata);
+
+        int did_pack = 0;
+        if (m_pack_histograms && is_sparse_histogram(metadata))
+        {
+            VolumeDigest packed_digest(reader.slice_size(), m_crc32c);
+            if (!OutOfCore::map_levels(reader, m_memory_budget, scan.m_histogram.packing_table(), destination_file_packed,
+                                       0, &packed_digest) ||
+                !packed_digest.write(destination_file_packed))
+                return false;
+            did_pack = 1;
+        }
+
+        metadata.set_image_params(file_name, reader.width(), reader.height(), reader.depth(), did_pack);
+        if (!crop_box.is_empty())
+            metadata.set_crop(crop_box, width, height, depth);
+        return true;
+    }
+
+    std::string volume_suffix() const
+    {
+        switch (m_format)
+        {
+        case CIMG:
+            return ".cimg";
+        case RAW:
+            return ".raw";
+        default:
+            return BrickedVolume::EXTENSION;
+        }
+    }
+
+    // The volume, packed volume, their digest sidecars and copied originals of a converted series, by file name
+    std::vector<std::filesystem::path> converted_files(const std::string &file_name) const
+    {
+        std::filesystem::path volume = m_collection_dir / (file_name + volume_suffix());
+        std::filesystem::path packed = m_collection_dir / "packed" / (file_name + volume_suffix());
+        return {volume, VolumeDigest::sidecar_for(volume), packed, VolumeDigest::sidecar_for(packed),
+                m_collection_dir / file_name};
+    }
+
+    void rename_converted(FileMetadata &metadata, const std::string &from, const std::string &to)
+    {
+        std::vector<std::filesystem::path> sources = converted_files(from), targets = converted_files(to);
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            std::error_code ec;
+            if (!std::filesystem::exists(sources[i], ec))
+                continue;
+            std::filesystem::rename(sources[i], targets[i], ec);
+            if (ec)
+                std::cerr << "Could not rename " << sources[i] << " to " << targets[i] << ": " << ec.message() << std::endl;
+        }
+        metadata.m_result_name = to;
+    }
+
+    void remove_converted(const std::string &file_name)
+    {
+        std::error_code ec;
+        for (const auto &path : converted_files(file_name))
+            std::filesystem::remove_all(path, ec);
+    }
+
+    void finish_conversion(FileMetadata &metadata, const std::filesystem::path &file_dir,
+                           const std::filesystem::path &collection_dir, const std::string &file_name)
+    {
+        metadata.m_converted = true; // Counted against the quota by next_wave, series of a wave run concurrently
+        if (m_copy_originals)
+            std::filesystem::copy(file_dir, collection_dir / file_name, std::filesystem::copy_options::recursive);
     }
 
 public:
@@ -118,30 +439,35 @@ public:
             {
                 if (entry.is_regular_file() && entry.path().extension() == ".csv")
                 {
-                    std::ifstream csvFile(entry.path().string());
-                    if (csvFile)
+                    CSVReader reader;
+                    if (reader.open(entry.path()))
                     {
                         CSVRow row;
-                        row.readNextRow(csvFile); // Skip the header
-                        while (row.readNextRow(csvFile))
+                        auto schema = FileMetadata::manifest_schema();
+                        if (!reader.read_row(row) || !schema.bind(row))
                         {
-                            using FMF = FileMetadata::Field;
-                            m_metadatas.push_back(
-                                FileMetadata(
-                                    row[FMF::Collection],
-                                    row[FMF::Modality],
-                                    row[FMF::Slices],
-                                    row[FMF::Folder]));
+                            std::cerr << entry.path() << " is not a TCIA manifest" << std::endl;
+                            return false;
+                        }
+                        FileMetadata metadata;
+                        while (reader.read_row(row))
+                        {
+                            if (!schema.read(row, metadata))
+                            {
+                                std::cerr << "Skipping malformed manifest row" << std::endl;
+                                continue;
+                            }
+                            m_metadatas.push_back(metadata);
                             m_modality_occurrences.insert(
                                 std::pair<std::string, unsigned int>(
-                                    row[FMF::Modality],
+                                    metadata.m_modality,
                                     0));
                         }
                         break;
                     }
                     else
                     {
-                        // Weird ifstream error reporting part
+                        // CSVReader::open leaves errno set
                         std::cerr << "Error: " << strerror(errno);
                         return false;
                     }
@@ -159,15 +485,16 @@ public:
         return true;
     }
 
-    bool convert(const std::filesystem::path &collections_dir, const std::string &collection_name)
+    // Creates the collection directory; the series are then picked by next_wave and converted by convert_series
+    bool prepare(const std::filesystem::path &collections_dir, const std::string &collection_name)
     {
         namespace fs = std::filesystem;
 
         // Prepare the directory for our collection
-        fs::path collection_dir = collections_dir / collection_name;
-        if (!fs::exists(collection_dir))
+        m_collection_dir = collections_dir / collection_name;
+        if (!fs::exists(m_collection_dir))
         {
-            if (!fs::create_directory(collection_dir))
+            if (!fs::create_directory(m_collection_dir))
             {
                 std::cerr << "Unable to create collection directory" << std::endl;
                 return false;
@@ -180,196 +507,902 @@ public:
             return false;
         }
 
-        // Update the metadata at the very end so no const
+        if (m_format != CIMG && m_format != RAW && m_format != BRICKED)
+        {
+            std::cerr << "Unsupported format" << std::endl;
+            return false;
+        }
+
+        // Prepare the directory for packed images
+        fs::path destination_packed = m_collection_dir / "packed";
+        if (m_pack_histograms && !fs::exists(destination_packed))
+        {
+            if (!fs::create_directory(destination_packed))
+            {
+                std::cerr << "Unable to create packed directory" << std::endl;
+                return false;
+            }
+        }
+
+        // Every series with enough slices is a candidate, in manifest order per modality
+        m_modality_plans.clear();
+        m_wave.clear();
         for (auto &metadata : m_metadatas)
         {
             // Check if enough slices
-            int meta_slices = std::stoi(metadata.m_slices);
-            if (metadata.m_modality != "US" && meta_slices < m_min_slices ||
-                metadata.m_modality == "US" && meta_slices < m_min_slices_us)
+            if (metadata.m_modality != "US" && metadata.m_slices < m_min_slices ||
+                metadata.m_modality == "US" && metadata.m_slices < m_min_slices_us)
             {
                 // Not enough slices
                 continue;
             }
+            ModalityPlan &plan = m_modality_plans[metadata.m_modality];
+            if (plan.m_candidates.empty())
+                plan.m_room = std::max(0, m_max_mod_occurs - (int)m_modality_occurrences[metadata.m_modality]);
+            plan.m_candidates.push_back(&metadata);
+        }
+        return true;
+    }
 
-            // Count occurrences
-            if (m_modality_occurrences[metadata.m_modality] > m_max_mod_occurs - 1)
+    // The series to convert next, empty when the collection is done: the first candidates of every modality its
+    // quota has room for, then those taking the places of series that failed to convert
+    // Series of one wave are independent and may be converted concurrently, all of them before the next wave
+    // They are converted under temporary names; the ones of the previous wave that made it are then named
+    // <collection>_<modality>_<number> here, numbered in manifest order as if converted one after the other
+    bool next_wave(std::vector<PlannedSeries> &wave)
+    {
+        namespace fs = std::filesystem;
+        for (const auto &series : m_wave)
+        {
+            FileMetadata &metadata = *series.m_metadata;
+            if (!metadata.m_converted)
             {
-                // We reached the quota for this modality
+                ++m_modality_plans[metadata.m_modality].m_room;
+                remove_converted(series.m_file_name); // Whatever it got to write
                 continue;
             }
+            int number = ++m_modality_occurrences[metadata.m_modality];
+            rename_converted(metadata, series.m_file_name,
+                             metadata.m_collection + "_" + metadata.m_modality + "_" + std::to_string(number));
+        }
+        m_wave.clear();
 
-            // Fix the path
-            fs::path file_dir = m_manifest_dir / metadata.m_folder.substr(2);
-            if (!fs::is_directory(file_dir))
+        for (auto &[modality, plan] : m_modality_plans)
+        {
+            for (; plan.m_room > 0 && plan.m_next < plan.m_candidates.size(); --plan.m_room)
             {
-                std::cerr << file_dir << " is not a directory" << std::endl;
-                return false;
+                size_t candidate = plan.m_next++;
+                FileMetadata &metadata = *plan.m_candidates[candidate];
+
+                // Fix the path
+                fs::path file_dir = m_manifest_dir / metadata.m_folder.substr(2);
+                if (!fs::is_directory(file_dir))
+                {
+                    std::cerr << file_dir << " is not a directory" << std::endl;
+                    return false;
+                }
+
+                // Until next_wave knows its number
+                std::string file_name = metadata.m_collection + "_" + metadata.m_modality + "_converting_" +
+                                        std::to_string(candidate);
+                m_wave.push_back(PlannedSeries{&metadata, file_dir, file_name});
             }
+        }
+        wave = m_wave;
+        return true;
+    }
+
+    // Converts one series of the current wave, safe to call for all of them at once
+    bool convert_series(const PlannedSeries &series)
+    {
+        namespace fs = std::filesystem;
+        FileMetadata &metadata = *series.m_metadata;
+        const fs::path &file_dir = series.m_file_dir;
+        std::string file_name = series.m_file_name;
 
-            // Iterate over all the image slice entries in the directory and put them in a vector
-            std::vector<fs::directory_entry> entries;
-            for (const auto &entry : fs::directory_iterator(file_dir))
+        // Iterate over all the image slice entries in the directory and put them in a vector
+        std::vector<fs::directory_entry> entries;
+        for (const auto &entry : fs::directory_iterator(file_dir))
+        {
+            if (entry.is_regular_file())
             {
-                if (entry.is_regular_file())
+                entries.push_back(entry);
+            }
+        }
+
+        // We have to get the slices in order so let's sort the entries vector
+        std::sort(entries.begin(), entries.end(), [](const fs::directory_entry &a, const fs::directory_entry &b)
+                  { return a.path().filename() < b.path().filename(); });
+
+        // Suffix, not included in originals directory name
+        std::string suffix = volume_suffix();
+
+        // The path of the saved file
+        fs::path destination_file = m_collection_dir / (file_name + suffix);
+        fs::path destination_file_packed = m_collection_dir / "packed" / (file_name + suffix);
+
+        // Iterate over the sorted slices, append them to the result image
+        try
+        {
+            if (m_memory_budget && m_format == RAW)
+            {
+                if (!convert_streamed(entries, destination_file, destination_file_packed, file_name, metadata))
+                    return false;
+                finish_conversion(metadata, file_dir, m_collection_dir, file_name);
+                return true;
+            }
+
+            Img volumetric_image;
+            MemoryGovernor::Reservation reservation;
+            SliceLoader slices(entries, m_io_pool);
+            Img image;
+            while (slices.next(image))
+            {
+                if (volumetric_image.is_empty())
                 {
-                    entries.push_back(entry);
+                    // Sized from the first slice, waits while concurrent conversions and encodes are using the memory
+                    reservation = MemoryGovernor::instance().reserve(
+                        CONVERSION_COPIES * image.width() * image.height() * (entries.size() + 1));
+                    volumetric_image = Img(image.width(), image.height(), 1, image.spectrum(), 0);
                 }
-            }
 
-            // We have to get the slices in order so let's sort the entries vector
-            std::sort(entries.begin(), entries.end(), [](const fs::directory_entry &a, const fs::directory_entry &b)
-                      { return a.path().filename() < b.path().filename(); });
+                volumetric_image.append(image, 'z');
+            }
 
-            // The result file name
-            std::string file_name =
-                metadata.m_collection + "_" +
-                metadata.m_modality + "_" +
-                std::to_string(m_modality_occurrences[metadata.m_modality] + 1);
+            // The volumetric image now contains all slices
+            // Cut away the zero border, the blank first slice it starts with goes too
+            const int full_width = volumetric_image.width(), full_height = volumetric_image.height(),
+                      full_depth = volumetric_image.depth();
+            CropBox crop_box;
+            if (m_crop_borders && volumetric_image.spectrum() == 1)
+            {
+                crop_box = BorderCropper::find_box(volumetric_image.data(), full_width, full_height, full_depth);
+                if (!crop_box.is_empty() && !crop_box.is_whole(full_width, full_height, full_depth))
+                {
+                    Img cropped(crop_box.m_width, crop_box.m_height, crop_box.m_depth, 1);
+                    BorderCropper::crop(volumetric_image.data(), full_width, full_height, crop_box, cropped.data());
+                    volumetric_image.swap(cropped);
+                }
+                else
+                {
+                    crop_box = CropBox(); // Nothing to cut, or nothing but background
+                }
+            }
 
-            // Suffix, not included in originals directory name
-            std::string suffix;
             switch (m_format)
             {
             case CIMG:
-                suffix = ".cimg";
+                volumetric_image.save_cimg(destination_file.c_str());
                 break;
             case RAW:
-                suffix = ".raw";
+            {
+                // Hashed slice by slice as it is written instead of reading the file back
+                VolumeDigest digest;
+                if (!write_raw(destination_file, volumetric_image.data(), volumetric_image.width(),
+                               volumetric_image.height(), volumetric_image.depth(), m_crc32c, digest))
+                    return false;
+                set_digest(metadata, digest);
+                break;
+            }
+            case BRICKED:
+            {
+                // Same voxels as the .raw would hold, so the same checksum and result cache entries
+                if (!BrickedVolume::write(destination_file, volumetric_image.data(), volumetric_image.width(),
+                                          volumetric_image.height(), volumetric_image.depth(), m_brick_size,
+                                          m_compress_bricks))
+                    return false;
+                VolumeDigest digest(0, m_crc32c);
+                digest.update(volumetric_image.data(), volumetric_image.size());
+                set_digest(metadata, digest);
                 break;
+            }
             default:
                 std::cerr << "Unsupported format" << std::endl;
                 return false;
             }
 
-            // The path of the saved file
-            fs::path destination_file = collection_dir / (file_name + suffix);
+            // Calculate histogram usage and update metadata with it
+            Hist histogram = get_histogram(volumetric_image);
+            calculate_histogram_usage(histogram, metadata);
+            metadata.set_compressibility(CompressibilityAnalyzer::analyze(
+                volumetric_image.data(), volumetric_image.width(), volumetric_image.height(), volumetric_image.depth()));
 
-            // Prepare the directory for packed images
-            fs::path destination_packed = collection_dir / "packed";
-            if (m_pack_histograms && !fs::exists(destination_packed))
+            // Pack the image if necessary
+            int did_pack = 0;
+            if (m_pack_histograms)
             {
-                if (!fs::create_directory(destination_packed))
+                // Doing it two-way because the methods are equivocal
+                if (is_sparse_histogram(metadata))
                 {
-                    std::cerr << "Unable to create packed directory" << std::endl;
-                    return false;
+                    Img packed_image = pack_volumetric_image(volumetric_image, histogram);
+                    did_pack = 1;
+                    switch (m_format)
+                    {
+                    case CIMG:
+                        packed_image.save_cimg(destination_file_packed.c_str());
+                        break;
+                    case RAW:
+                    {
+                        VolumeDigest packed_digest;
+                        if (!write_raw(destination_file_packed, packed_image.data(), packed_image.width(),
+                                       packed_image.height(), packed_image.depth(), m_crc32c, packed_digest))
+                            return false;
+                        break;
+                    }
+                    case BRICKED:
+                        if (!BrickedVolume::write(destination_file_packed, packed_image.data(), packed_image.width(),
+                                                  packed_image.height(), packed_image.depth(), m_brick_size,
+                                                  m_compress_bricks))
+                            return false;
+                        break;
+                    default:
+                        std::cerr << "Unsupported format" << std::endl;
+                        return false;
+                    }
                 }
             }
-            fs::path destination_file_packed = destination_packed / (file_name + suffix);
 
-            // Iterate over the sorted slices, append them to the result image
-            try
+            // Update metadata with the remaining parameters
+            metadata.set_image_params(
+                file_name,
+                volumetric_image.width(),
+                volumetric_image.height(),
+                volumetric_image.depth(),
+                did_pack);
+            if (!crop_box.is_empty())
+                metadata.set_crop(crop_box, full_width, full_height, full_depth);
+
+            // Grand finish
+            finish_conversion(metadata, file_dir, m_collection_dir, file_name);
+        }
+        catch (...) // Skip images with any kinds of problems
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Writes conv_metadata.csv and the dataset index of the series converted
+    bool write_metadata()
+    {
+        namespace fs = std::filesystem;
+        // Create our own metadata csv so we know what's what
+        fs::path converted_metadatas = m_collection_dir / "conv_metadata.csv";
+        std::ofstream conv_metadata(converted_metadatas);
+        if (conv_metadata)
+        {
+            std::string buffer = FileMetadata::get_info_header();
+            for (const auto &m : m_metadatas)
+            {
+                if (m.m_converted)
+                    m.get_info(buffer);
+            }
+            conv_metadata << buffer;
+        }
+        else
+        {
+            std::cerr << "Could not create final csv" << std::endl;
+        }
+
+        // And its binary twin, which the later stages read without parsing
+        std::vector<DatasetRow> rows;
+        for (const auto &m : m_metadatas)
+        {
+            if (!m.m_converted)
+                continue;
+            rows.emplace_back();
+            m.to_index(rows.back());
+        }
+        if (!DatasetIndex::write(DatasetIndex::path_for(m_collection_dir), rows))
+            std::cerr << "Could not create dataset index" << std::endl;
+
+        return true;
+    }
+
+    // One series after the other, see BatchConverter for converting many at once
+    bool convert(const std::filesystem::path &collections_dir, const std::string &collection_name)
+    {
+        if (!prepare(collections_dir, collection_name))
+            return false;
+        std::vector<PlannedSeries> wave;
+        for (;;)
+        {
+            if (!next_wave(wave))
+                return false;
+            if (wave.empty())
+                break;
+            for (const auto &series : wave)
+                convert_series(series);
+        }
+        return write_metadata();
+    }
+
+private:
+    // Rows of one directory's conv_metadata.csv
+    static bool read_converted(const std::filesystem::path &dir, std::vector<FileMetadata> &metadatas)
+    {
+        CSVReader reader;
+        if (!reader.open(dir / "conv_metadata.csv"))
+        {
+            std::cerr << "Error while opening converted metadata: " << strerror(errno);
+            return false;
+        }
+        CSVRow row;
+        auto schema = FileMetadata::converted_schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << dir / "conv_metadata.csv" << " lacks some of its columns" << std::endl;
+            return false;
+        }
+        FileMetadata metadata;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, metadata))
+                metadatas.push_back(metadata);
+        }
+        return true;
+    }
+
+    static bool write_converted(const std::filesystem::path &dir, const std::vector<FileMetadata> &metadatas)
+    {
+        std::ofstream conv_metadata(dir / "conv_metadata.csv");
+        std::string buffer = FileMetadata::get_info_header();
+        for (const auto &metadata : metadatas)
+            metadata.get_info(buffer);
+        conv_metadata << buffer;
+        conv_metadata.close();
+        if (!conv_metadata)
+        {
+            std::cerr << "Could not rewrite " << dir / "conv_metadata.csv" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces duplicate with a hard link to original if both hold the same bytes, renamed over so the name never
+    // goes missing; the sidecar of original is linked too
+    static bool link_duplicate(const std::filesystem::path &duplicate, const std::filesystem::path &original)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        if (fs::equivalent(duplicate, original, ec))
+            return true; // Linked on an earlier run
+        Hash128 duplicate_hash, original_hash;
+        if (fs::file_size(duplicate, ec) != fs::file_size(original, ec) || ec ||
+            (!VolumeDigest::cached_checksum(duplicate, duplicate_hash) && !XXH3::hash_file(duplicate, duplicate_hash)) ||
+            (!VolumeDigest::cached_checksum(original, original_hash) && !XXH3::hash_file(original, original_hash)) ||
+            duplicate_hash != original_hash)
+            return false; // Same series, but e.g. one still starts with the blank slice
+        auto link = [&ec](const fs::path &target, const fs::path &link_path)
+        {
+            fs::path temp_path = link_path;
+            temp_path += ".tmp";
+            fs::remove(temp_path, ec);
+            fs::create_hard_link(target, temp_path, ec);
+            if (!ec)
+                fs::rename(temp_path, link_path, ec);
+            if (ec)
+                std::cerr << "Could not link " << link_path << " to " << target << ": " << ec.message() << std::endl;
+            return !ec;
+        };
+        if (!link(original, duplicate))
+            return false;
+        fs::path sidecar = VolumeDigest::sidecar_for(original);
+        if (fs::exists(sidecar, ec))
+            link(sidecar, VolumeDigest::sidecar_for(duplicate));
+        else
+            fs::remove(VolumeDigest::sidecar_for(duplicate), ec);
+        return true;
+    }
+
+    // The stored volume of a converted row, .raw or bricked, if it is the 8 bit volume the row describes
+    static bool open_converted(const std::filesystem::path &dir, const FileMetadata &metadata, SlabReader &reader)
+    {
+        return reader.open(SlabReader::volume_path(dir, metadata.m_result_name), metadata.m_width, metadata.m_height,
+                           metadata.m_depth) &&
+               reader.width() == metadata.m_width && reader.height() == metadata.m_height &&
+               reader.depth() == metadata.m_depth;
+    }
+
+    // Every directory under collection_dir with a conv_metadata.csv
+    static std::vector<std::filesystem::path> converted_dirs(const std::filesystem::path &collection_dir)
+    {
+        std::vector<std::filesystem::path> dirs;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(collection_dir))
+        {
+            if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
+                dirs.push_back(entry.path().parent_path());
+        }
+        return dirs;
+    }
+
+public:
+    // Fills the compressibility columns of directories converted before there were any, from their .raw or
+    // bricked volumes; the index is rewritten too when it was up to date, keeping the codec results it holds
+    // Volumes larger than a nonzero memory_budget are analyzed slab by slab
+    static bool analyze_converted(const std::filesystem::path &collection_dir, unsigned threads = 0,
+                                  size_t memory_budget = 0)
+    {
+        namespace fs = std::filesystem;
+        try
+        {
+            for (const auto &dir : converted_dirs(collection_dir))
             {
-                Img volumetric_image;
-                for (const auto &entry : entries)
-                {
-                    Img image = Img::get_load_medcon_external(entry.path().c_str());
+                bool index_fresh = DatasetIndex::is_fresh(dir);
+                std::vector<FileMetadata> metadatas;
+                if (!read_converted(dir, metadatas))
+                    return false;
 
-                    if (image.is_empty())
+                std::map<std::string, Compressibility> analyzed;
+                for (auto &metadata : metadatas)
+                {
+                    SlabReader reader;
+                    std::vector<uint8_t> volume;
+                    Compressibility compressibility;
+                    size_t voxels = (size_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+                    bool streamed = memory_budget && voxels > memory_budget;
+                    if (!open_converted(dir, metadata, reader) ||
+                        !(streamed ? OutOfCore::analyze(reader, memory_budget, compressibility, threads)
+                                   : reader.read_all(volume, threads)))
                     {
-                        std::cerr << "Unexpected empty image; skipping" << std::endl;
+                        std::cerr << "Could not read " << metadata.m_result_name << " as an 8 bit volume of "
+                                  << metadata.m_width << "x" << metadata.m_height << "x" << metadata.m_depth << std::endl;
                         continue;
                     }
+                    if (!streamed)
+                        compressibility = CompressibilityAnalyzer::analyze(volume.data(), metadata.m_width,
+                                                                           metadata.m_height, metadata.m_depth, threads);
+                    metadata.set_compressibility(compressibility);
+                    analyzed[metadata.m_result_name] = compressibility;
+                }
+                if (!write_converted(dir, metadatas))
+                    return false;
 
-                    if (image.depth() > 1)
+                // Written after the csv so it stays the fresher of the two
+                DatasetIndex index;
+                if (index_fresh && index.open(DatasetIndex::path_for(dir)))
+                {
+                    std::vector<DatasetRow> rows;
+                    for (size_t i = 0; i < index.size(); ++i)
                     {
-                        std::cerr << "Unexpected 3D layers in 2D image; skipping" << std::endl;
-                        continue;
+                        rows.push_back(index.row(i));
+                        auto found = analyzed.find(rows.back().m_name);
+                        if (found != analyzed.end())
+                            rows.back().m_compressibility = found->second;
                     }
+                    if (!DatasetIndex::write(DatasetIndex::path_for(dir), rows))
+                        std::cerr << "Could not update dataset index of " << dir << std::endl;
+                }
+            }
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // crop_converted of one .raw volume, one slab at a time as convert_streamed does; false if it was left alone
+    static bool crop_streamed(SlabReader &reader, const std::filesystem::path &path, FileMetadata &metadata,
+                              size_t memory_budget, unsigned threads)
+    {
+        namespace fs = std::filesystem;
+        OutOfCore::Scan scan;
+        if (!OutOfCore::scan(reader, memory_budget, true, scan, threads))
+        {
+            std::cerr << "Could not read " << path << std::endl;
+            return false;
+        }
+        CropBox box = scan.m_box;
+        if (box.is_empty() || box.is_whole(metadata.m_width, metadata.m_height, metadata.m_depth))
+            return false;
+        fs::path temp_path = path;
+        temp_path += ".tmp";
+        VolumeDigest digest((size_t)box.m_width * box.m_height, !metadata.m_crc32c.empty());
+        if (!OutOfCore::write_box(reader, memory_budget, box, temp_path, nullptr, threads, &digest))
+        {
+            std::error_code ec;
+            fs::remove(temp_path, ec);
+            return false;
+        }
+        reader.close();
+        fs::rename(temp_path, path);
+        if (!digest.write(path))
+            return false;
+        metadata.set_crop(box, metadata.m_width, metadata.m_height, metadata.m_depth);
+        set_digest(metadata, digest);
+        Compressibility compressibility; // Unknown again if the cropped volume cannot be read back
+        if (metadata.compressibility().is_known())
+        {
+            if (!reader.open(path, box.m_width, box.m_height, box.m_depth) ||
+                !OutOfCore::analyze(reader, memory_budget, compressibility, threads))
+                compressibility = Compressibility();
+            metadata.set_compressibility(compressibility);
+        }
+        return true;
+    }
 
-                    if (image.spectrum() > 1)
+    // Crops the zero border of volumes converted without set_crop_borders, in place
+    // Their checksums change, so the index is rebuilt from the metadata and codec results in it are dropped;
+    // the result cache is keyed by content and simply encodes the cropped volumes again
+    // .raw volumes larger than a nonzero memory_budget are cropped slab by slab; bricked ones are written whole,
+    // those are left as they are
+    static bool crop_converted(const std::filesystem::path &collection_dir, unsigned threads = 0,
+                               size_t memory_budget = 0)
+    {
+        namespace fs = std::filesystem;
+        try
+        {
+            for (const auto &dir : converted_dirs(collection_dir))
+            {
+                std::vector<FileMetadata> metadatas;
+                if (!read_converted(dir, metadatas))
+                    return false;
+                unsigned cropped_count = 0;
+                for (auto &metadata : metadatas)
+                {
+                    SlabReader reader;
+                    if (metadata.is_cropped() || metadata.m_is_packed || !open_converted(dir, metadata, reader))
+                        continue; // Done already, packed versions would have to follow, or not 8 bit
+                    fs::path path = SlabReader::volume_path(dir, metadata.m_result_name);
+                    size_t voxels = (size_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+                    if (memory_budget && voxels > memory_budget)
                     {
-                        image = image.get_RGBtoYCbCr().get_channel(0);
+                        if (reader.is_bricked())
+                            std::cerr << "Not cropping " << path << ", it does not fit in the memory budget" << std::endl;
+                        else if (crop_streamed(reader, path, metadata, memory_budget, threads))
+                            ++cropped_count;
+                        continue;
                     }
-
-                    if (volumetric_image.is_empty())
+                    std::vector<uint8_t> volume;
+                    if (!reader.read_all(volume, threads))
                     {
-                        volumetric_image = Img(image.width(), image.height(), 1, image.spectrum(), 0);
+                        std::cerr << "Could not read " << path << std::endl;
+                        continue;
                     }
+                    bool bricked = reader.is_bricked();
+                    int brick_size = reader.brick_size();
+                    reader.close(); // Replaced below
+                    CropBox box = BorderCropper::find_box(volume.data(), metadata.m_width, metadata.m_height,
+                                                          metadata.m_depth, 0, threads);
+                    if (box.is_empty() || box.is_whole(metadata.m_width, metadata.m_height, metadata.m_depth))
+                        continue;
+                    std::vector<uint8_t> cropped((size_t)box.m_width * box.m_height * box.m_depth);
+                    BorderCropper::crop(volume.data(), metadata.m_width, metadata.m_height, box, cropped.data());
 
-                    volumetric_image.append(image, 'z');
+                    // Next to it and renamed over, a crash never leaves half a volume behind; bricked stays bricked
+                    VolumeDigest digest(0, !metadata.m_crc32c.empty());
+                    if (bricked)
+                    {
+                        if (!BrickedVolume::write(path, cropped.data(), box.m_width, box.m_height, box.m_depth,
+                                                  brick_size, true, threads))
+                            continue;
+                        digest.update(cropped.data(), cropped.size());
+                    }
+                    else if (!write_raw(path, cropped.data(), box.m_width, box.m_height, box.m_depth,
+                                        !metadata.m_crc32c.empty(), digest))
+                        continue;
+                    metadata.set_crop(box, metadata.m_width, metadata.m_height, metadata.m_depth);
+                    set_digest(metadata, digest);
+                    if (metadata.compressibility().is_known())
+                        metadata.set_compressibility(CompressibilityAnalyzer::analyze(
+                            cropped.data(), box.m_width, box.m_height, box.m_depth, threads));
+                    ++cropped_count;
                 }
-
-                // The volumetric image now contains all slices
-                switch (m_format)
-                {
-                case CIMG:
-                    volumetric_image.save_cimg(destination_file.c_str());
-                    break;
-                case RAW:
-                    volumetric_image.save_raw(destination_file.c_str());
-                    break;
-                default:
-                    std::cerr << "Unsupported format" << std::endl;
+                if (!cropped_count)
+                    continue;
+                if (!write_converted(dir, metadatas))
                     return false;
-                }
+                std::vector<DatasetRow> rows(metadatas.size());
+                for (size_t i = 0; i < metadatas.size(); ++i)
+                    metadatas[i].to_index(rows[i]);
+                if (!DatasetIndex::write(DatasetIndex::path_for(dir), rows))
+                    std::cerr << "Could not update dataset index of " << dir << std::endl;
+                std::cout << dir << ": cropped " << cropped_count << " of " << metadatas.size() << " volumes" << std::endl;
+            }
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-                // Calculate histogram usage and update metadata with it
-                Hist histogram = get_histogram(volumetric_image);
-                calculate_histogram_usage(histogram, metadata);
+    // Adds axis-permuted copies <name>_xz.raw / <name>_yz.raw of the XY volumes, as volumes of their own, so every
+    // codec also gets to predict along the other two axes; configs and results follow from their metadata rows
+    // Copies that exist already are left alone; codec results of the index are kept when it was up to date
+    // Volumes larger than a nonzero memory_budget are resliced slab by slab and get no compressibility
+    static bool reslice_converted(const std::filesystem::path &collection_dir,
+                                  const std::vector<Orientation> &orientations = {ORIENT_XZ, ORIENT_YZ},
+                                  unsigned threads = 0, size_t memory_budget = 0)
+    {
+        namespace fs = std::filesystem;
+        try
+        {
+            for (const auto &dir : converted_dirs(collection_dir))
+            {
+                bool index_fresh = DatasetIndex::is_fresh(dir);
+                std::vector<FileMetadata> metadatas;
+                if (!read_converted(dir, metadatas))
+                    return false;
+                std::set<std::string> names;
+                for (const auto &metadata : metadatas)
+                    names.insert(metadata.m_result_name);
 
-                // Pack the image if necessary
-                int did_pack = 0;
-                if (m_pack_histograms)
+                std::vector<FileMetadata> resliced;
+                for (const auto &metadata : metadatas)
                 {
-                    // Doing it two-way because the methods are equivocal
-                    if (is_sparse_histogram(metadata))
+                    if (metadata.orientation() != ORIENT_XY || metadata.is_duplicate())
+                        continue; // Duplicates are not encoded, neither would their copies be
+                    SlabReader reader;
+                    if (!open_converted(dir, metadata, reader))
+                        continue; // Not 8 bit
+                    fs::path path = SlabReader::volume_path(dir, metadata.m_result_name);
+                    size_t voxels = (size_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+                    std::error_code ec;
+                    std::vector<uint8_t> volume, out;
+                    bool streamed = memory_budget && voxels > memory_budget;
+                    for (Orientation orientation : orientations)
                     {
-                        Img packed_image = pack_volumetric_image(volumetric_image, histogram);
-                        did_pack = 1;
-                        switch (m_format)
+                        std::string suffix(orientation_name(orientation));
+                        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+                        std::string name = metadata.m_result_name + "_" + suffix;
+                        if (orientation == ORIENT_XY || names.count(name))
+                            continue;
+                        FileMetadata copy = metadata;
+                        copy.m_result_name = name;
+                        copy.m_orientation = std::string(orientation_name(orientation));
+                        Reslicer::dimensions(orientation, metadata.m_width, metadata.m_height, metadata.m_depth,
+                                             copy.m_width, copy.m_height, copy.m_depth);
+                        if (metadata.is_cropped())
                         {
-                        case CIMG:
-                            packed_image.save_cimg(destination_file_packed.c_str());
-                            break;
-                        case RAW:
-                            packed_image.save_raw(destination_file_packed.c_str());
-                            break;
-                        default:
-                            std::cerr << "Unsupported format" << std::endl;
-                            return false;
+                            Reslicer::map_point(orientation, metadata.m_crop_x, metadata.m_crop_y, metadata.m_crop_z,
+                                                copy.m_crop_x, copy.m_crop_y, copy.m_crop_z);
+                            Reslicer::dimensions(orientation, metadata.m_full_width, metadata.m_full_height,
+                                                 metadata.m_full_depth, copy.m_full_width, copy.m_full_height,
+                                                 copy.m_full_depth);
                         }
+
+                        // Copies of bricked volumes are bricked too, except streamed ones: bricks are cut from
+                        // a whole volume, so those become .raw
+                        bool bricked = reader.is_bricked() && !streamed;
+                        fs::path out_path = dir / (name + (bricked ? BrickedVolume::EXTENSION : ".raw"));
+                        bool crc32c = !metadata.m_crc32c.empty();
+                        VolumeDigest digest((size_t)copy.m_width * copy.m_height, crc32c);
+                        if (streamed)
+                        {
+                            fs::path temp_path = out_path;
+                            temp_path += ".tmp";
+                            if (!OutOfCore::reslice(reader, memory_budget, orientation, temp_path, &digest, threads))
+                            {
+                                std::cerr << "Could not reslice " << path << std::endl;
+                                fs::remove(temp_path, ec);
+                                continue;
+                            }
+                            // Next to it and renamed over, a crash never leaves half a volume behind
+                            fs::rename(temp_path, out_path);
+                            if (!digest.write(out_path))
+                                continue;
+                            copy.set_compressibility(Compressibility());
+                        }
+                        else
+                        {
+                            if (volume.empty() && !reader.read_all(volume, threads))
+                            {
+                                std::cerr << "Could not read " << path << std::endl;
+                                break;
+                            }
+                            out.resize(voxels);
+                            Reslicer::reslice(volume.data(), metadata.m_width, metadata.m_height, metadata.m_depth,
+                                              orientation, out.data(), threads);
+                            if (metadata.compressibility().is_known())
+                                copy.set_compressibility(CompressibilityAnalyzer::analyze(out.data(), copy.m_width,
+                                                                                          copy.m_height, copy.m_depth, threads));
+                            if (bricked)
+                            {
+                                if (!BrickedVolume::write(out_path, out.data(), copy.m_width, copy.m_height,
+                                                          copy.m_depth, reader.brick_size(), true, threads))
+                                    continue;
+                                digest = VolumeDigest(0, crc32c);
+                                digest.update(out.data(), out.size());
+                            }
+                            else if (!write_raw(out_path, out.data(), copy.m_width, copy.m_height, copy.m_depth,
+                                                crc32c, digest))
+                                continue;
+                        }
+                        set_digest(copy, digest);
+                        resliced.push_back(copy);
+                        names.insert(name);
                     }
                 }
+                if (resliced.empty())
+                    continue;
 
-                // Update metadata with the remaining parameters
-                metadata.set_image_params(
-                    file_name,
-                    volumetric_image.width(),
-                    volumetric_image.height(),
-                    volumetric_image.depth(),
-                    did_pack);
-
-                // Grand finish
-                metadata.m_converted = true;
-                m_modality_occurrences[metadata.m_modality] = m_modality_occurrences[metadata.m_modality] + 1;
-                if (m_copy_originals)
-                    std::filesystem::copy(file_dir, collection_dir / file_name, std::filesystem::copy_options::recursive);
-            }
-            catch (...) // Skip images with any kinds of problems
-            {
-                std::exception_ptr p = std::current_exception();
-                std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+                std::vector<DatasetRow> rows;
+                {
+                    DatasetIndex index;
+                    if (index_fresh && index.open(DatasetIndex::path_for(dir)))
+                    {
+                        for (size_t i = 0; i < index.size(); ++i)
+                            rows.push_back(index.row(i));
+                    }
+                }
+                if (rows.empty())
+                {
+                    for (const auto &metadata : metadatas)
+                        metadata.to_index(rows.emplace_back());
+                }
+                metadatas.insert(metadatas.end(), resliced.begin(), resliced.end());
+                if (!write_converted(dir, metadatas))
+                    return false;
+                for (const auto &metadata : resliced)
+                    metadata.to_index(rows.emplace_back());
+                if (!DatasetIndex::write(DatasetIndex::path_for(dir), rows))
+                    std::cerr << "Could not update dataset index of " << dir << std::endl;
+                std::cout << dir << ": added " << resliced.size() << " resliced volumes" << std::endl;
             }
         }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-        // Create our own metadata csv so we know what's what
-        fs::path converted_metadatas = collection_dir / "conv_metadata.csv";
-        std::ofstream conv_metadata(converted_metadatas);
-        if (conv_metadata)
+    // Marks the volumes whose series was converted before, in this or any other collection under collections_dir,
+    // with DuplicateOf, which CodecRunner and CodecConfigCreator skip; see SeriesIndex
+    // The index lives in collections_dir, so the first volume of a series stays the one encoded across runs
+    static bool dedup_converted(const std::filesystem::path &collections_dir, DuplicateAction action = DUPLICATE_SKIP,
+                                unsigned threads = 0)
+    {
+        namespace fs = std::filesystem;
+        try
         {
-            conv_metadata << FileMetadata::get_info_header();
-            for (const auto &m : m_metadatas)
+            SeriesIndex series;
+            fs::path series_path = SeriesIndex::path_for(collections_dir);
+            if (!series.load(series_path))
+                return false;
+            std::vector<fs::path> dirs = converted_dirs(collections_dir);
+            std::sort(dirs.begin(), dirs.end()); // Same originals whatever order the file system lists them in
+            for (const auto &dir : dirs)
             {
-                if (m.m_converted)
-                    conv_metadata << m.get_info() << "\n";
+                bool index_fresh = DatasetIndex::is_fresh(dir);
+                std::vector<FileMetadata> metadatas;
+                if (!read_converted(dir, metadatas))
+                    return false;
+
+                // Volumes without a sidecar are read, so they are fingerprinted in parallel
+                std::vector<SeriesRecord> records(metadatas.size());
+                std::vector<char> fingerprinted(metadatas.size(), 0);
+                fs::path relative_dir = dir.lexically_relative(collections_dir);
+                {
+                    ThreadPool pool(threads ? threads : std::max(1u, std::thread::hardware_concurrency()));
+                    for (size_t i = 0; i < metadatas.size(); ++i)
+                    {
+                        if (metadatas[i].is_duplicate())
+                        {
+                            // Marked on an earlier run, maybe without linking
+                            if (action == DUPLICATE_HARD_LINK)
+                                pool.submit([&, i]
+                                            {
+                                                link_duplicate(SlabReader::volume_path(dir, metadatas[i].m_result_name),
+                                                               SlabReader::volume_path(collections_dir, metadatas[i].m_duplicate_of));
+                                            });
+                            continue;
+                        }
+                        pool.submit([&, i]
+                                    {
+                                        const FileMetadata &metadata = metadatas[i];
+                                        records[i].m_location = (relative_dir / metadata.m_result_name).generic_string();
+                                        fingerprinted[i] = SeriesIndex::fingerprint(
+                                            SlabReader::volume_path(dir, metadata.m_result_name), metadata.m_width, metadata.m_height,
+                                            records[i].m_fingerprint, records[i].m_tail_fingerprint, records[i].m_slices);
+                                    });
+                    }
+                    pool.wait();
+                }
+
+                std::map<std::string, std::string> marked; // Name -> DuplicateOf
+                unsigned linked = 0;
+                for (size_t i = 0; i < metadatas.size(); ++i)
+                {
+                    if (!fingerprinted[i])
+                        continue;
+                    const SeriesRecord *first = series.find_or_add(records[i]);
+                    if (!first)
+                        continue;
+                    if (first->m_location == records[i].m_location)
+                    {
+                        series.replace(*first, records[i]); // Indexes written before tail fingerprints get one
+                        continue;
+                    }
+                    fs::path first_volume = SlabReader::volume_path(collections_dir, first->m_location);
+                    std::error_code ec;
+                    if (!fs::exists(first_volume, ec))
+                    {
+                        series.replace(*first, records[i]); // The first one was deleted, this one takes over
+                        continue;
+                    }
+                    FileMetadata &metadata = metadatas[i];
+                    metadata.m_duplicate_of = first->m_location;
+                    marked[metadata.m_result_name] = metadata.m_duplicate_of;
+                    if (action == DUPLICATE_HARD_LINK &&
+                        link_duplicate(SlabReader::volume_path(dir, metadata.m_result_name), first_volume))
+                        ++linked;
+                }
+                if (marked.empty())
+                    continue;
+
+                if (!write_converted(dir, metadatas))
+                    return false;
+                // Written after the csv so it stays the fresher of the two, with the codec results it holds
+                std::vector<DatasetRow> rows;
+                {
+                    DatasetIndex index;
+                    if (index_fresh && index.open(DatasetIndex::path_for(dir)))
+                    {
+                        for (size_t i = 0; i < index.size(); ++i)
+                        {
+                            rows.push_back(index.row(i));
+                            auto found = marked.find(rows.back().m_name);
+                            if (found != marked.end())
+                                rows.back().m_duplicate_of = found->second;
+                        }
+                    }
+                }
+                if (rows.empty())
+                {
+                    for (const auto &metadata : metadatas)
+                        metadata.to_index(rows.emplace_back());
+                }
+                if (!DatasetIndex::write(DatasetIndex::path_for(dir), rows))
+                    std::cerr << "Could not update dataset index of " << dir << std::endl;
+                std::cout << dir << ": " << marked.size() << " of " << metadatas.size() << " volumes are duplicates";
+                if (action == DUPLICATE_HARD_LINK)
+                    std::cout << ", " << linked << " linked";
+                std::cout << std::endl;
             }
+            if (!series.save(series_path))
+                return false;
         }
-        else
+        catch (...) // Too lazy to check what it can throw, just give me the error code
         {
-            std::cerr << "Could not create final csv" << std::endl;
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
         }
+        return true;
+    }
 
+    // The volume as converted, before its border was cropped, e.g. to check a decoded volume against
+    // the DICOM series; a volume that was not cropped is returned as stored
+    static bool restore_full_volume(const std::filesystem::path &raw_path, const FileMetadata &metadata,
+                                    std::vector<uint8_t> &volume)
+    {
+        size_t stored = (size_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+        std::vector<uint8_t> cropped(stored);
+        std::ifstream raw(raw_path, std::ios::binary);
+        if (!raw.read(reinterpret_cast<char *>(cropped.data()), (std::streamsize)stored))
+        {
+            std::cerr << "Could not read " << raw_path << std::endl;
+            return false;
+        }
+        if (!metadata.is_cropped())
+        {
+            volume.swap(cropped);
+            return true;
+        }
+        volume.resize((size_t)metadata.m_full_width * metadata.m_full_height * metadata.m_full_depth);
+        BorderCropper::uncrop(cropped.data(), metadata.crop_box(), metadata.m_full_width, metadata.m_full_height,
+                              metadata.m_full_depth, volume.data());
         return true;
     }
 };
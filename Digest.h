@@ -0,0 +1,250 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "Hash.h"
+
+// One row of a digest sidecar: a slice, or with m_slice -1 the whole volume
+class SliceDigest
+{
+public:
+    int m_slice = -1;
+    uintmax_t m_bytes = 0;
+    std::string m_xxh3;   // Hash128::to_string
+    std::string m_crc32c; // 8 hex digits, empty when it was not computed
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Slice", &SliceDigest::m_slice),
+            csv_column("Bytes", &SliceDigest::m_bytes),
+            csv_column("XXH3", &SliceDigest::m_xxh3),
+            csv_column("CRC32C", &SliceDigest::m_crc32c, false));
+    }
+
+    static std::string crc_string(uint32_t crc)
+    {
+        char text[9];
+        snprintf(text, sizeof(text), "%08x", crc);
+        return text;
+    }
+};
+
+// Per-slice and whole-volume XXH3-128 (and optionally CRC32C) of a volume, fed in order while it is written, so
+// nothing has to read the file back; <name>.digest.csv next to <name>.raw keeps them for the cache and for
+// verifying decoded volumes without touching the source
+class VolumeDigest
+{
+private:
+    size_t m_slice_size;
+    bool m_use_crc32c;
+    XXH3 m_whole, m_slice;
+    CRC32C m_whole_crc32c, m_slice_crc32c;
+    size_t m_in_slice = 0;
+    uintmax_t m_bytes = 0;
+    std::vector<SliceDigest> m_slices;
+
+    void finish_slice()
+    {
+        SliceDigest slice;
+        slice.m_slice = (int)m_slices.size();
+        slice.m_bytes = m_in_slice;
+        slice.m_xxh3 = m_slice.digest128().to_string();
+        if (m_use_crc32c)
+            slice.m_crc32c = SliceDigest::crc_string(m_slice_crc32c.digest());
+        m_slices.push_back(slice);
+        m_slice.reset();
+        m_slice_crc32c.reset();
+        m_in_slice = 0;
+    }
+
+public:
+    // slice_size 0 keeps only the whole-volume digests
+    explicit VolumeDigest(size_t slice_size = 0, bool crc32c = false) : m_slice_size(slice_size), m_use_crc32c(crc32c)
+    {
+    }
+
+    // Any chunks in order; slices are cut wherever they end
+    void update(const void *data, size_t size)
+    {
+        const uint8_t *input = static_cast<const uint8_t *>(data);
+        m_whole.update(input, size);
+        if (m_use_crc32c)
+            m_whole_crc32c.update(input, size);
+        m_bytes += size;
+        if (!m_slice_size)
+            return;
+        while (size)
+        {
+            size_t part = std::min(size, m_slice_size - m_in_slice);
+            m_slice.update(input, part);
+            if (m_use_crc32c)
+                m_slice_crc32c.update(input, part);
+            m_in_slice += part;
+            input += part;
+            size -= part;
+            if (m_in_slice == m_slice_size)
+                finish_slice();
+        }
+    }
+
+    size_t slice_size() const
+    {
+        return m_slice_size;
+    }
+
+    Hash128 checksum() const
+    {
+        return m_whole.digest128();
+    }
+
+    bool has_crc32c() const
+    {
+        return m_use_crc32c;
+    }
+
+    uint32_t crc32c() const
+    {
+        return m_whole_crc32c.digest();
+    }
+
+    uintmax_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    // Complete slices so far
+    const std::vector<SliceDigest> &slices() const
+    {
+        return m_slices;
+    }
+
+    SliceDigest whole() const
+    {
+        SliceDigest whole;
+        whole.m_bytes = m_bytes;
+        whole.m_xxh3 = checksum().to_string();
+        if (m_use_crc32c)
+            whole.m_crc32c = SliceDigest::crc_string(crc32c());
+        return whole;
+    }
+
+    static std::filesystem::path sidecar_for(const std::filesystem::path &volume_path)
+    {
+        return std::filesystem::path(volume_path).replace_extension(".digest.csv");
+    }
+
+    // Whole volume first, then the slices; written after the volume, so its time says it is current
+    bool write(const std::filesystem::path &volume_path) const
+    {
+        std::filesystem::path path = sidecar_for(volume_path);
+        auto schema = SliceDigest::schema();
+        std::string buffer;
+        schema.write_header(buffer);
+        schema.write(whole(), buffer);
+        for (const auto &slice : m_slices)
+            schema.write(slice, buffer);
+        std::ofstream file(path, std::ios::trunc);
+        file << buffer;
+        file.close();
+        if (!file)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // The sidecar of a volume, only if it is at least as new as the volume and covers all of it
+    static bool read(const std::filesystem::path &volume_path, SliceDigest &whole, std::vector<SliceDigest> &slices)
+    {
+        namespace fs = std::filesystem;
+        fs::path path = sidecar_for(volume_path);
+        std::error_code ec;
+        if (!fs::exists(path, ec) || fs::last_write_time(path, ec) < fs::last_write_time(volume_path, ec) || ec)
+            return false;
+        CSVReader reader;
+        if (!reader.open(path))
+            return false;
+        CSVRow row;
+        auto schema = SliceDigest::schema();
+        if (!reader.read_row(row) || !schema.bind(row))
+            return false;
+        SliceDigest digest;
+        bool has_whole = false;
+        slices.clear();
+        while (reader.read_row(row))
+        {
+            if (!schema.read(row, digest))
+                return false;
+            if (digest.m_slice < 0)
+            {
+                whole = digest;
+                has_whole = true;
+            }
+            else
+            {
+                slices.push_back(digest);
+            }
+        }
+        return has_whole && fs::file_size(volume_path, ec) == whole.m_bytes && !ec;
+    }
+
+    // Whole-volume XXH3 from a current sidecar, false if there is none
+    static bool cached_checksum(const std::filesystem::path &volume_path, Hash128 &hash)
+    {
+        SliceDigest whole;
+        std::vector<SliceDigest> slices;
+        return read(volume_path, whole, slices) && Hash128::from_string(whole.m_xxh3, hash);
+    }
+
+    // Digests a file, e.g. a decoded volume, in slices of slice_size
+    static bool of_file(const std::filesystem::path &path, size_t slice_size, bool crc32c, VolumeDigest &digest)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        digest = VolumeDigest(slice_size, crc32c);
+        std::vector<char> chunk(1 << 20);
+        while (file)
+        {
+            file.read(chunk.data(), chunk.size());
+            std::streamsize got = file.gcount();
+            if (got > 0)
+                digest.update(chunk.data(), (size_t)got);
+        }
+        return !file.bad();
+    }
+
+    // Whether file holds exactly the volume the sidecar describes; reads file only. mismatch is the first slice
+    // that differs, -1 if none does or the sizes differ already
+    static bool matches(const std::filesystem::path &file, const SliceDigest &whole,
+                        const std::vector<SliceDigest> &slices, int &mismatch)
+    {
+        mismatch = -1;
+        std::error_code ec;
+        if (std::filesystem::file_size(file, ec) != whole.m_bytes || ec)
+            return false;
+        VolumeDigest digest;
+        if (!of_file(file, slices.empty() ? 0 : (size_t)slices[0].m_bytes, false, digest))
+            return false;
+        if (digest.checksum().to_string() == whole.m_xxh3)
+            return true;
+        for (size_t i = 0; i < slices.size() && i < digest.slices().size(); ++i)
+        {
+            if (slices[i].m_xxh3 != digest.slices()[i].m_xxh3)
+            {
+                mismatch = (int)i;
+                break;
+            }
+        }
+        return false;
+    }
+};
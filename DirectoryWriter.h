@@ -0,0 +1,192 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Writes many small files into one directory through a single directory descriptor
+// Files are queued into one arena and written out in batches; each one appears under its name
+// complete or not at all: it is written as an O_TMPFILE and linked in, or, where the filesystem
+// has no O_TMPFILE (NFS, older kernels), written under a temporary name and renamed over
+class DirectoryWriter
+{
+private:
+    struct Pending
+    {
+        std::string m_name;
+        size_t m_offset, m_size;
+    };
+
+    std::filesystem::path m_dir;
+    int m_dir_fd = -1;
+    size_t m_batch_bytes;
+    std::string m_arena;
+    std::vector<Pending> m_pending;
+    bool m_tmpfile = true; // Until the filesystem says otherwise
+    unsigned m_written = 0;
+
+    // Unique per process, so writers of the same directory in several threads never collide
+    static std::string temp_name(const std::string &name)
+    {
+        static std::atomic<unsigned> counter{0};
+        return "." + name + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+    }
+
+    static bool write_all(int fd, const char *data, size_t size)
+    {
+        while (size)
+        {
+            ssize_t done = ::write(fd, data, size);
+            if (done < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += done;
+            size -= (size_t)done;
+        }
+        return true;
+    }
+
+    // Anonymous file linked in under its name; an existing file is replaced through a temporary link
+    // False with errno set, EOPNOTSUPP/EISDIR/EINVAL meaning there is no O_TMPFILE here
+    bool write_tmpfile(const std::string &name, const char *data, size_t size)
+    {
+        int fd = openat(m_dir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = write_all(fd, data, size);
+        if (ok)
+        {
+            // AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, going through /proc does not
+            std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+            ok = linkat(AT_FDCWD, proc_path.c_str(), m_dir_fd, name.c_str(), AT_SYMLINK_FOLLOW) == 0;
+            if (!ok && errno == EEXIST)
+            {
+                std::string temp = temp_name(name);
+                ok = linkat(AT_FDCWD, proc_path.c_str(), m_dir_fd, temp.c_str(), AT_SYMLINK_FOLLOW) == 0 &&
+                     renameat(m_dir_fd, temp.c_str(), m_dir_fd, name.c_str()) == 0;
+                if (!ok)
+                {
+                    int error = errno;
+                    unlinkat(m_dir_fd, temp.c_str(), 0);
+                    errno = error;
+                }
+            }
+        }
+        int error = errno;
+        close(fd);
+        errno = error;
+        return ok;
+    }
+
+    bool write_renamed(const std::string &name, const char *data, size_t size)
+    {
+        std::string temp = temp_name(name);
+        int fd = openat(m_dir_fd, temp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = write_all(fd, data, size);
+        int error = errno;
+        close(fd);
+        if (ok)
+            ok = renameat(m_dir_fd, temp.c_str(), m_dir_fd, name.c_str()) == 0;
+        else
+            errno = error;
+        if (!ok)
+        {
+            error = errno;
+            unlinkat(m_dir_fd, temp.c_str(), 0);
+            errno = error;
+        }
+        return ok;
+    }
+
+    bool write_file(const std::string &name, const char *data, size_t size)
+    {
+        if (m_tmpfile)
+        {
+            if (write_tmpfile(name, data, size))
+                return true;
+            if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL && errno != ENOENT)
+                return false;
+            m_tmpfile = false; // ENOENT: no /proc to link through
+        }
+        return write_renamed(name, data, size);
+    }
+
+public:
+    // batch_bytes is how much rendered text is held before it is written out
+    DirectoryWriter(size_t batch_bytes = 4 << 20) : m_batch_bytes(batch_bytes)
+    {
+    }
+
+    DirectoryWriter(const DirectoryWriter &) = delete;
+    DirectoryWriter &operator=(const DirectoryWriter &) = delete;
+
+    ~DirectoryWriter()
+    {
+        close_dir();
+    }
+
+    // False with errno set if the directory cannot be opened
+    bool open(const std::filesystem::path &dir)
+    {
+        close_dir();
+        m_dir = dir;
+        m_dir_fd = ::open(dir.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+        return m_dir_fd >= 0;
+    }
+
+    // Queues a file, it is written by the next flush; flushes by itself once the batch is full
+    bool add(std::string_view name, std::string_view data)
+    {
+        m_pending.push_back(Pending{std::string(name), m_arena.size(), data.size()});
+        m_arena.append(data);
+        if (m_arena.size() >= m_batch_bytes)
+            return flush();
+        return true;
+    }
+
+    // Writes everything queued; reports the first file that fails and drops the rest of the batch
+    bool flush()
+    {
+        bool ok = true;
+        for (const auto &pending : m_pending)
+        {
+            if (!write_file(pending.m_name, m_arena.data() + pending.m_offset, pending.m_size))
+            {
+                std::cerr << "Error writing " << (m_dir / pending.m_name) << ": " << strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+            ++m_written;
+        }
+        m_pending.clear();
+        m_arena.clear();
+        return ok;
+    }
+
+    // Files written so far
+    unsigned written() const
+    {
+        return m_written;
+    }
+
+    // Flushes what is left; call flush() first to learn whether that worked
+    void close_dir()
+    {
+        if (m_dir_fd < 0)
+            return;
+        flush();
+        ::close(m_dir_fd);
+        m_dir_fd = -1;
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include <charconv>
+#include <functional>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Codec.h"
+
+// Bits and time spent on one coded slice (one z slice of the volume, one POC/frame for the encoder)
+struct SliceStats
+{
+    int m_slice = 0;
+    std::string m_type;
+    uint64_t m_bits = 0;
+    double m_time = 0.0; // Seconds; HM and VTM only print whole seconds, JM prints milliseconds
+
+    static inline std::string get_info_header()
+    {
+        return "File,Slice,Type,Bits,Time\n";
+    }
+
+    std::string get_info(const std::string &file) const
+    {
+        return file
+        + "," + std::to_string(m_slice)
+        + "," + m_type
+        + "," + std::to_string(m_bits)
+        + "," + std::to_string(m_time);
+    }
+};
+
+// Line-at-a-time parsers for what the reference encoders print per frame, so the output can be
+// consumed as it is read without keeping it in memory:
+//   HM:  POC    0 TId: 0 ( I-SLICE, nQP 0 QP 0 )     193816 bits [Y 99.9900 dB ...] [ET     1 ] [L0 ] [L1 ]
+//   VTM: POC    0 LId:  0 TId: 0 ( IDR_N_LP, I-SLICE, QP 0 )     74168 bits [Y 99.9900 dB ...] [ET     2 ] ...
+//   JM:  00001( I )  146696   0  99.000  99.000  99.000       106       0    FRM    1
+// jp3d codes the volume as a whole and prints nothing per slice
+class EncoderLogParser
+{
+private:
+    Codec m_codec;
+
+    static std::string_view trim(std::string_view text)
+    {
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos)
+            return {};
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(start, end + 1 - start);
+    }
+
+    template <typename T>
+    static bool parse_number(std::string_view text, T &value)
+    {
+        text = trim(text);
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && ptr != text.data();
+    }
+
+    static std::vector<std::string_view> split_whitespace(std::string_view text)
+    {
+        std::vector<std::string_view> tokens;
+        size_t pos = 0;
+        while ((pos = text.find_first_not_of(" \t\r", pos)) != std::string_view::npos)
+        {
+            size_t end = text.find_first_of(" \t\r", pos);
+            if (end == std::string_view::npos)
+                end = text.size();
+            tokens.push_back(text.substr(pos, end - pos));
+            pos = end;
+        }
+        return tokens;
+    }
+
+    // HM and VTM share the layout apart from the fields inside the parentheses
+    static bool parse_poc_line(std::string_view line, SliceStats &stats)
+    {
+        line = trim(line);
+        if (line.substr(0, 4) != "POC ")
+            return false;
+        size_t open = line.find('('), close = line.find(')');
+        size_t bits_end = line.find(" bits", close);
+        if (open == std::string_view::npos || close == std::string_view::npos || bits_end == std::string_view::npos)
+            return false;
+        if (!parse_number(line.substr(4, line.find_first_not_of("0123456789 ", 4) - 4), stats.m_slice))
+            return false;
+        if (!parse_number(line.substr(close + 1, bits_end - close - 1), stats.m_bits))
+            return false;
+
+        // Slice type is the field ending in -SLICE
+        std::string_view inside = line.substr(open + 1, close - open - 1);
+        size_t slice = inside.find("-SLICE");
+        if (slice != std::string_view::npos)
+        {
+            size_t start = inside.find_last_of(" ,", slice);
+            start = (start == std::string_view::npos) ? 0 : start + 1;
+            stats.m_type = std::string(inside.substr(start, slice + 6 - start));
+        }
+
+        size_t et = line.find("[ET", bits_end);
+        if (et != std::string_view::npos)
+        {
+            size_t et_end = line.find(']', et);
+            double seconds = 0.0;
+            if (et_end != std::string_view::npos && parse_number(line.substr(et + 3, et_end - et - 3), seconds))
+                stats.m_time = seconds;
+        }
+        return true;
+    }
+
+    static bool parse_jm_line(std::string_view line, SliceStats &stats)
+    {
+        line = trim(line);
+        size_t open = line.find('('), close = line.find(')');
+        if (open == 0 || open == std::string_view::npos || close == std::string_view::npos || close < open)
+            return false;
+        if (line.substr(0, open).find_first_not_of("0123456789") != std::string_view::npos)
+            return false;
+        if (!parse_number(line.substr(0, open), stats.m_slice))
+            return false;
+        stats.m_type = std::string(trim(line.substr(open + 1, close - open - 1)));
+        if (stats.m_type == "NVB")
+            return false; // Parameter sets, not a frame
+
+        // Bit/pic QP SnrY SnrU SnrV Time(ms) ...
+        std::vector<std::string_view> tokens = split_whitespace(line.substr(close + 1));
+        double milliseconds = 0.0;
+        if (tokens.size() < 6 || !parse_number(tokens[0], stats.m_bits) || !parse_number(tokens[5], milliseconds))
+            return false;
+        stats.m_time = milliseconds / 1000.0;
+        return true;
+    }
+
+public:
+    EncoderLogParser(Codec codec) : m_codec(codec) {}
+
+    // True if the line described a coded slice
+    bool parse_line(std::string_view line, SliceStats &stats) const
+    {
+        stats = SliceStats();
+        switch (m_codec)
+        {
+        case (AVC):
+            return parse_jm_line(line, stats);
+        case (HEVC):
+        case (VVC):
+            return parse_poc_line(line, stats);
+        case (JP3D):
+            return false;
+        }
+        return false;
+    }
+
+    // Feeds the stream through the parser one line at a time, returns the number of slices found
+    size_t parse(std::istream &stream, const std::function<void(const SliceStats &)> &on_slice) const
+    {
+        size_t slices = 0;
+        std::string line;
+        SliceStats stats;
+        while (std::getline(stream, line))
+        {
+            if (parse_line(line, stats))
+            {
+                on_slice(stats);
+                ++slices;
+            }
+        }
+        return slices;
+    }
+};
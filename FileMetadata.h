@@ -1,5 +1,17 @@
+#pragma once
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <string>
 
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "Compressibility.h"
+#include "Crop.h"
+#include "DatasetIndex.h"
+#include "Reslice.h"
+
 class FileMetadata
 {
 private:
@@ -7,19 +19,31 @@ private:
     using sv = std::string_view;
 
 public:
-    s m_collection, m_modality, m_slices, m_folder, m_result_name;
-    int m_width, m_height, m_depth, m_active_levels, m_is_packed;
-    float m_histogram_usage;
+    s m_collection, m_modality, m_folder, m_result_name;
+    int m_slices = 0;
+    int m_width = 0, m_height = 0, m_depth = 0, m_active_levels = 0, m_is_packed = 0;
+    float m_histogram_usage = 0.0f;
+    uintmax_t m_raw_bytes = 0;
+    Hash128 m_checksum; // XXH3-128 of the converted file, zero if not known
+    s m_crc32c;         // CRC32C of it as 8 hex digits, empty if not computed; per-slice digests are in its sidecar
+    // Compressibility, flat so the schema can reach it; 0 until analyzed
+    float m_entropy = 0.0f, m_conditional_entropy = 0.0f, m_slice_entropy = 0.0f;
+    float m_mean_gradient = 0.0f, m_mean_slice_difference = 0.0f;
+    // Where the stored volume sits in the converted one when its background border was cropped away;
+    // full dimensions 0 when it was not
+    int m_crop_x = 0, m_crop_y = 0, m_crop_z = 0;
+    int m_full_width = 0, m_full_height = 0, m_full_depth = 0;
+    // Bits the levels of the stored volume need, and what its packed version needs; 0 if not known
+    int m_bit_depth = 0, m_packed_bit_depth = 0;
+    s m_orientation; // Resliced copies name their frame planes, see Reslicer; empty is XY
+    s m_duplicate_of; // <collection dir>/<name> of the same series converted before, see DicomConverter::dedup_converted
 
     bool m_converted = false;
 
-    FileMetadata(s &c, s &m, s &sl, s &f)
-        : m_collection(c), m_modality(m), m_slices(sl), m_folder(f)
-    {
-    }
+    FileMetadata() = default;
 
-    FileMetadata(sv c, sv m, sv sl, sv f)
-        : m_collection(s(c)), m_modality(s(m)), m_slices(s(sl)), m_folder(s(f))
+    FileMetadata(sv c, sv m, int sl, sv f)
+        : m_collection(s(c)), m_modality(s(m)), m_folder(s(f)), m_slices(sl)
     {
     }
 
@@ -32,28 +56,187 @@ public:
         m_is_packed = is_packed;
     }
 
-    static inline s get_info_header() {
-        return "Name,OriginFolder,Modality,Width,Height,Depth,ActiveLevels,HistogramUsage,HasPackedVersion\n";
+    // Series rows of a TCIA manifest (metadata.csv)
+    static constexpr auto manifest_schema()
+    {
+        return CSVSchema(
+            csv_column("Collection", &FileMetadata::m_collection),
+            csv_column("Modality", &FileMetadata::m_modality),
+            csv_column("Number of Images", &FileMetadata::m_slices),
+            csv_column("File Location", &FileMetadata::m_folder));
     }
 
-    s get_info() const
+    // Our conv_metadata.csv
+    static constexpr auto converted_schema()
     {
-        return m_result_name
-        + "," + m_folder
-        + "," + m_modality
-        + "," + std::to_string(m_width)
-        + "," + std::to_string(m_height)
-        + "," + std::to_string(m_depth)
-        + "," + std::to_string(m_active_levels)
-        + "," + std::to_string(m_histogram_usage)
-        + "," + std::to_string(m_is_packed);
+        return CSVSchema(
+            csv_column("Name", &FileMetadata::m_result_name),
+            csv_column("OriginFolder", &FileMetadata::m_folder),
+            csv_column("Modality", &FileMetadata::m_modality),
+            csv_column("Width", &FileMetadata::m_width),
+            csv_column("Height", &FileMetadata::m_height),
+            csv_column("Depth", &FileMetadata::m_depth),
+            csv_column("ActiveLevels", &FileMetadata::m_active_levels),
+            csv_column("HistogramUsage", &FileMetadata::m_histogram_usage),
+            csv_column("HasPackedVersion", &FileMetadata::m_is_packed),
+            csv_column("Entropy", &FileMetadata::m_entropy, false),
+            csv_column("ConditionalEntropy", &FileMetadata::m_conditional_entropy, false),
+            csv_column("SliceEntropy", &FileMetadata::m_slice_entropy, false),
+            csv_column("MeanGradient", &FileMetadata::m_mean_gradient, false),
+            csv_column("MeanSliceDifference", &FileMetadata::m_mean_slice_difference, false),
+            csv_column("CropX", &FileMetadata::m_crop_x, false),
+            csv_column("CropY", &FileMetadata::m_crop_y, false),
+            csv_column("CropZ", &FileMetadata::m_crop_z, false),
+            csv_column("FullWidth", &FileMetadata::m_full_width, false),
+            csv_column("FullHeight", &FileMetadata::m_full_height, false),
+            csv_column("FullDepth", &FileMetadata::m_full_depth, false),
+            csv_column("BitDepth", &FileMetadata::m_bit_depth, false),
+            csv_column("PackedBitDepth", &FileMetadata::m_packed_bit_depth, false),
+            csv_column("Orientation", &FileMetadata::m_orientation, false),
+            csv_column("Checksum", &FileMetadata::m_checksum, false),
+            csv_column("CRC32C", &FileMetadata::m_crc32c, false),
+            csv_column("DuplicateOf", &FileMetadata::m_duplicate_of, false));
     }
 
-    enum Field
+    Orientation orientation() const
     {
-        Collection = 1,
-        Modality = 10,
-        Slices = 13,
-        Folder = 15,
-    };
+        return parse_orientation(m_orientation);
+    }
+
+    // Bits needed to tell apart this many levels, at least 1
+    static int bits_for(int levels)
+    {
+        int bits = 1;
+        while (bits < 31 && (1 << bits) < levels)
+            ++bits;
+        return bits;
+    }
+
+    // Encoding it would only repeat the results of the one it duplicates
+    bool is_duplicate() const
+    {
+        return !m_duplicate_of.empty();
+    }
+
+    bool is_cropped() const
+    {
+        return m_full_width > 0;
+    }
+
+    // The stored volume within the full one; Width, Height and Depth are those of the box
+    CropBox crop_box() const
+    {
+        return CropBox{m_crop_x, m_crop_y, m_crop_z, m_width, m_height, m_depth};
+    }
+
+    // Records the crop of a full_width x full_height x full_depth volume, the dimensions become the box's
+    void set_crop(const CropBox &box, int full_width, int full_height, int full_depth)
+    {
+        m_crop_x = box.m_x;
+        m_crop_y = box.m_y;
+        m_crop_z = box.m_z;
+        m_full_width = full_width;
+        m_full_height = full_height;
+        m_full_depth = full_depth;
+        m_width = box.m_width;
+        m_height = box.m_height;
+        m_depth = box.m_depth;
+    }
+
+    Compressibility compressibility() const
+    {
+        return Compressibility{m_entropy, m_conditional_entropy, m_slice_entropy, m_mean_gradient, m_mean_slice_difference};
+    }
+
+    void set_compressibility(const Compressibility &compressibility)
+    {
+        m_entropy = compressibility.m_entropy;
+        m_conditional_entropy = compressibility.m_conditional_entropy;
+        m_slice_entropy = compressibility.m_slice_entropy;
+        m_mean_gradient = compressibility.m_mean_gradient;
+        m_mean_slice_difference = compressibility.m_mean_slice_difference;
+    }
+
+    static inline s get_info_header()
+    {
+        return converted_schema().header();
+    }
+
+    // Appends the conv_metadata.csv line
+    void get_info(s &buffer) const
+    {
+        converted_schema().write(*this, buffer);
+    }
+
+    void to_index(DatasetRow &row) const
+    {
+        row.m_name = m_result_name;
+        row.m_folder = m_folder;
+        row.m_modality = m_modality;
+        row.m_width = m_width;
+        row.m_height = m_height;
+        row.m_depth = m_depth;
+        row.m_active_levels = m_active_levels;
+        row.m_histogram_usage = m_histogram_usage;
+        row.m_is_packed = (uint8_t)m_is_packed;
+        row.m_raw_bytes = m_raw_bytes;
+        row.m_checksum = m_checksum;
+        uint32_t crc32c;
+        auto [end, ec] = std::from_chars(m_crc32c.data(), m_crc32c.data() + m_crc32c.size(), crc32c, 16);
+        row.m_crc32c = !m_crc32c.empty() && ec == std::errc() ? (uint64_t(1) << 32) | crc32c : 0;
+        row.m_compressibility = compressibility();
+        row.m_crop_x = m_crop_x;
+        row.m_crop_y = m_crop_y;
+        row.m_crop_z = m_crop_z;
+        row.m_full_width = m_full_width;
+        row.m_full_height = m_full_height;
+        row.m_full_depth = m_full_depth;
+        row.m_bit_depth = (uint8_t)m_bit_depth;
+        row.m_packed_bit_depth = (uint8_t)m_packed_bit_depth;
+        row.m_orientation = orientation();
+        row.m_duplicate_of = m_duplicate_of;
+    }
+
+    static FileMetadata from_index(const DatasetIndex &index, size_t row)
+    {
+        DatasetRow data = index.row(row);
+        FileMetadata metadata(sv(), data.m_modality, 0, data.m_folder);
+        metadata.set_image_params(data.m_name, data.m_width, data.m_height, data.m_depth, data.m_is_packed);
+        metadata.m_active_levels = data.m_active_levels;
+        metadata.m_histogram_usage = data.m_histogram_usage;
+        metadata.m_raw_bytes = data.m_raw_bytes;
+        metadata.m_checksum = data.m_checksum;
+        if (data.m_crc32c >> 32)
+        {
+            char crc32c[9];
+            snprintf(crc32c, sizeof(crc32c), "%08x", (uint32_t)data.m_crc32c);
+            metadata.m_crc32c = crc32c;
+        }
+        metadata.set_compressibility(data.m_compressibility);
+        metadata.m_crop_x = data.m_crop_x;
+        metadata.m_crop_y = data.m_crop_y;
+        metadata.m_crop_z = data.m_crop_z;
+        metadata.m_full_width = data.m_full_width;
+        metadata.m_full_height = data.m_full_height;
+        metadata.m_full_depth = data.m_full_depth;
+        metadata.m_bit_depth = data.m_bit_depth;
+        metadata.m_packed_bit_depth = data.m_packed_bit_depth;
+        metadata.m_orientation = s(orientation_name((Orientation)data.m_orientation));
+        metadata.m_duplicate_of = data.m_duplicate_of;
+        metadata.m_converted = true;
+        return metadata;
+    }
+
+    // conv_metadata.csv from the index, for tools that want the text version
+    static bool export_csv(const DatasetIndex &index, const std::filesystem::path &csv_path)
+    {
+        std::ofstream csv(csv_path);
+        if (!csv)
+            return false;
+        s buffer = get_info_header();
+        for (size_t i = 0; i < index.size(); ++i)
+            from_index(index, i).get_info(buffer);
+        csv << buffer;
+        return (bool)csv;
+    }
 };
\ No newline at end of file
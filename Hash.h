@@ -0,0 +1,675 @@
+#pragma once
+// XXH3 (64 and 128 bit, seed 0, default secret) as specified by https://github.com/Cyan4973/xxHash
+// Scalar implementation, one-shot and streaming; results match the reference xxhsum -H3 / -H2
+// CRC32C below it, for checks that want a standard CRC next to the hash
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define NTCOMP_CRC32C_HARDWARE
+#endif
+
+struct Hash128
+{
+    uint64_t m_low = 0, m_high = 0;
+
+    bool operator==(const Hash128 &other) const { return m_low == other.m_low && m_high == other.m_high; }
+    bool operator!=(const Hash128 &other) const { return !(*this == other); }
+    bool operator<(const Hash128 &other) const { return m_high < other.m_high || (m_high == other.m_high && m_low < other.m_low); }
+
+    // Canonical representation, same as xxhsum prints it
+    std::string to_string() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string out(32, '0');
+        for (int i = 0; i < 16; ++i)
+        {
+            out[15 - i] = digits[(m_high >> (4 * i)) & 0xF];
+            out[31 - i] = digits[(m_low >> (4 * i)) & 0xF];
+        }
+        return out;
+    }
+
+    static bool from_string(std::string_view str, Hash128 &hash)
+    {
+        if (str.size() != 32)
+            return false;
+        uint64_t parts[2] = {0, 0};
+        for (int i = 0; i < 32; ++i)
+        {
+            char c = str[i];
+            uint64_t v;
+            if (c >= '0' && c <= '9')
+                v = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                v = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                v = c - 'A' + 10;
+            else
+                return false;
+            parts[i / 16] = (parts[i / 16] << 4) | v;
+        }
+        hash.m_high = parts[0];
+        hash.m_low = parts[1];
+        return true;
+    }
+};
+
+class XXH3
+{
+private:
+    using u32 = uint32_t;
+    using u64 = uint64_t;
+
+    static constexpr u32 PRIME32_1 = 0x9E3779B1U;
+    static constexpr u32 PRIME32_2 = 0x85EBCA77U;
+    static constexpr u32 PRIME32_3 = 0xC2B2AE3DU;
+    static constexpr u64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    static constexpr u64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr u64 PRIME64_3 = 0x165667B19E3779F9ULL;
+    static constexpr u64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr u64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+    static constexpr u64 PRIME_MX1 = 0x165667919E3779F9ULL;
+    static constexpr u64 PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+    static constexpr size_t STRIPE_LEN = 64;
+    static constexpr size_t SECRET_CONSUME_RATE = 8;
+    static constexpr size_t ACC_NB = 8;
+    static constexpr size_t SECRET_SIZE = 192;
+    static constexpr size_t SECRET_SIZE_MIN = 136;
+    static constexpr size_t MIDSIZE_MAX = 240;
+    static constexpr size_t MIDSIZE_STARTOFFSET = 3;
+    static constexpr size_t MIDSIZE_LASTOFFSET = 17;
+    static constexpr size_t SECRET_LASTACC_START = 7;
+    static constexpr size_t SECRET_MERGEACCS_START = 11;
+    static constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+    static constexpr size_t BLOCK_LEN = STRIPE_LEN * STRIPES_PER_BLOCK;
+    static constexpr size_t BUFFER_SIZE = 256;
+
+    static const uint8_t *secret()
+    {
+        alignas(64) static const uint8_t k_secret[SECRET_SIZE] = {
+            0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+            0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+            0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+            0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+            0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+            0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+            0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+            0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+            0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+            0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+            0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+            0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+        };
+        return k_secret;
+    }
+
+    static u32 read32(const uint8_t *p)
+    {
+        u32 v;
+        memcpy(&v, p, sizeof(v));
+        return v; // Little endian hosts only, which is all we run on
+    }
+
+    static u64 read64(const uint8_t *p)
+    {
+        u64 v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static u64 rotl64(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+    static u32 rotl32(u32 x, int r) { return (x << r) | (x >> (32 - r)); }
+    static u32 swap32(u32 x) { return __builtin_bswap32(x); }
+    static u64 swap64(u64 x) { return __builtin_bswap64(x); }
+
+    static Hash128 mult64to128(u64 lhs, u64 rhs)
+    {
+        __uint128_t product = (__uint128_t)lhs * (__uint128_t)rhs;
+        return Hash128{(u64)product, (u64)(product >> 64)};
+    }
+
+    static u64 mul128_fold64(u64 lhs, u64 rhs)
+    {
+        Hash128 product = mult64to128(lhs, rhs);
+        return product.m_low ^ product.m_high;
+    }
+
+    static u64 xxh64_avalanche(u64 h)
+    {
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static u64 avalanche(u64 h)
+    {
+        h ^= h >> 37;
+        h *= PRIME_MX1;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static u64 rrmxmx(u64 h, u64 len)
+    {
+        h ^= rotl64(h, 49) ^ rotl64(h, 24);
+        h *= PRIME_MX2;
+        h ^= (h >> 35) + len;
+        h *= PRIME_MX2;
+        return h ^ (h >> 28);
+    }
+
+    static u64 mix16B(const uint8_t *input, const uint8_t *sec, u64 seed)
+    {
+        return mul128_fold64(read64(input) ^ (read64(sec) + seed), read64(input + 8) ^ (read64(sec + 8) - seed));
+    }
+
+    static void mix32B(Hash128 &acc, const uint8_t *input_1, const uint8_t *input_2, const uint8_t *sec, u64 seed)
+    {
+        acc.m_low += mix16B(input_1, sec, seed);
+        acc.m_low ^= read64(input_2) + read64(input_2 + 8);
+        acc.m_high += mix16B(input_2, sec + 16, seed);
+        acc.m_high ^= read64(input_1) + read64(input_1 + 8);
+    }
+
+    // Long input machinery, shared by both widths and by the streaming state
+    static void accumulate_512(u64 *acc, const uint8_t *input, const uint8_t *sec)
+    {
+        for (size_t i = 0; i < ACC_NB; ++i)
+        {
+            u64 data_val = read64(input + 8 * i);
+            u64 data_key = data_val ^ read64(sec + 8 * i);
+            acc[i ^ 1] += data_val;
+            acc[i] += (u64)(u32)data_key * (data_key >> 32);
+        }
+    }
+
+    static void scramble(u64 *acc, const uint8_t *sec)
+    {
+        for (size_t i = 0; i < ACC_NB; ++i)
+        {
+            u64 a = acc[i];
+            a ^= a >> 47;
+            a ^= read64(sec + 8 * i);
+            a *= PRIME32_1;
+            acc[i] = a;
+        }
+    }
+
+    static void accumulate(u64 *acc, const uint8_t *input, const uint8_t *sec, size_t nb_stripes)
+    {
+        for (size_t n = 0; n < nb_stripes; ++n)
+            accumulate_512(acc, input + n * STRIPE_LEN, sec + n * SECRET_CONSUME_RATE);
+    }
+
+    static void init_acc(u64 *acc)
+    {
+        const u64 init[ACC_NB] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+        memcpy(acc, init, sizeof(init));
+    }
+
+    static void hash_long_loop(u64 *acc, const uint8_t *input, size_t len)
+    {
+        size_t nb_blocks = (len - 1) / BLOCK_LEN;
+        for (size_t n = 0; n < nb_blocks; ++n)
+        {
+            accumulate(acc, input + n * BLOCK_LEN, secret(), STRIPES_PER_BLOCK);
+            scramble(acc, secret() + SECRET_SIZE - STRIPE_LEN);
+        }
+        size_t nb_stripes = ((len - 1) - (BLOCK_LEN * nb_blocks)) / STRIPE_LEN;
+        accumulate(acc, input + nb_blocks * BLOCK_LEN, secret(), nb_stripes);
+        accumulate_512(acc, input + len - STRIPE_LEN, secret() + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+    }
+
+    static u64 merge_accs(const u64 *acc, const uint8_t *sec, u64 start)
+    {
+        u64 result = start;
+        for (size_t i = 0; i < 4; ++i)
+            result += mul128_fold64(acc[2 * i] ^ read64(sec + 16 * i), acc[2 * i + 1] ^ read64(sec + 16 * i + 8));
+        return avalanche(result);
+    }
+
+    static u64 finalize_long_64(const u64 *acc, u64 len)
+    {
+        return merge_accs(acc, secret() + SECRET_MERGEACCS_START, len * PRIME64_1);
+    }
+
+    static Hash128 finalize_long_128(const u64 *acc, u64 len)
+    {
+        return Hash128{
+            merge_accs(acc, secret() + SECRET_MERGEACCS_START, len * PRIME64_1),
+            merge_accs(acc, secret() + SECRET_SIZE - STRIPE_LEN - SECRET_MERGEACCS_START, ~(len * PRIME64_2))};
+    }
+
+    // Short and mid sized inputs, 64 bit
+    static u64 hash64_short(const uint8_t *input, size_t len)
+    {
+        const uint8_t *sec = secret();
+        const u64 seed = 0;
+        if (len > 8)
+        {
+            u64 bitflip1 = (read64(sec + 24) ^ read64(sec + 32)) + seed;
+            u64 bitflip2 = (read64(sec + 40) ^ read64(sec + 48)) - seed;
+            u64 input_lo = read64(input) ^ bitflip1;
+            u64 input_hi = read64(input + len - 8) ^ bitflip2;
+            u64 acc = len + swap64(input_lo) + input_hi + mul128_fold64(input_lo, input_hi);
+            return avalanche(acc);
+        }
+        if (len >= 4)
+        {
+            u64 input1 = read32(input);
+            u64 input2 = read32(input + len - 4);
+            u64 bitflip = (read64(sec + 8) ^ read64(sec + 16)) - seed;
+            u64 input64 = input2 + (input1 << 32);
+            return rrmxmx(input64 ^ bitflip, len);
+        }
+        if (len > 0)
+        {
+            u32 c1 = input[0], c2 = input[len >> 1], c3 = input[len - 1];
+            u32 combined = (c1 << 16) | (c2 << 24) | (c3 << 0) | ((u32)len << 8);
+            u64 bitflip = (u64)(read32(sec) ^ read32(sec + 4)) + seed;
+            return xxh64_avalanche((u64)combined ^ bitflip);
+        }
+        return xxh64_avalanche(seed ^ (read64(sec + 56) ^ read64(sec + 64)));
+    }
+
+    static u64 hash64_mid(const uint8_t *input, size_t len)
+    {
+        const uint8_t *sec = secret();
+        u64 acc = len * PRIME64_1;
+        if (len <= 128)
+        {
+            if (len > 32)
+            {
+                if (len > 64)
+                {
+                    if (len > 96)
+                    {
+                        acc += mix16B(input + 48, sec + 96, 0);
+                        acc += mix16B(input + len - 64, sec + 112, 0);
+                    }
+                    acc += mix16B(input + 32, sec + 64, 0);
+                    acc += mix16B(input + len - 48, sec + 80, 0);
+                }
+                acc += mix16B(input + 16, sec + 32, 0);
+                acc += mix16B(input + len - 32, sec + 48, 0);
+            }
+            acc += mix16B(input + 0, sec + 0, 0);
+            acc += mix16B(input + len - 16, sec + 16, 0);
+            return avalanche(acc);
+        }
+        size_t nb_rounds = len / 16;
+        for (size_t i = 0; i < 8; ++i)
+            acc += mix16B(input + 16 * i, sec + 16 * i, 0);
+        acc = avalanche(acc);
+        for (size_t i = 8; i < nb_rounds; ++i)
+            acc += mix16B(input + 16 * i, sec + 16 * (i - 8) + MIDSIZE_STARTOFFSET, 0);
+        acc += mix16B(input + len - 16, sec + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET, 0);
+        return avalanche(acc);
+    }
+
+    // Short and mid sized inputs, 128 bit
+    static Hash128 hash128_short(const uint8_t *input, size_t len)
+    {
+        const uint8_t *sec = secret();
+        const u64 seed = 0;
+        if (len > 8)
+        {
+            u64 bitflipl = (read64(sec + 32) ^ read64(sec + 40)) - seed;
+            u64 bitfliph = (read64(sec + 48) ^ read64(sec + 56)) + seed;
+            u64 input_lo = read64(input);
+            u64 input_hi = read64(input + len - 8);
+            Hash128 m128 = mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1);
+            m128.m_low += (u64)(len - 1) << 54;
+            input_hi ^= bitfliph;
+            m128.m_high += input_hi + (u64)(u32)input_hi * (PRIME32_2 - 1);
+            m128.m_low ^= swap64(m128.m_high);
+            Hash128 h128 = mult64to128(m128.m_low, PRIME64_2);
+            h128.m_high += m128.m_high * PRIME64_2;
+            h128.m_low = avalanche(h128.m_low);
+            h128.m_high = avalanche(h128.m_high);
+            return h128;
+        }
+        if (len >= 4)
+        {
+            u64 input_lo = read32(input);
+            u64 input_hi = read32(input + len - 4);
+            u64 input64 = input_lo + (input_hi << 32);
+            u64 bitflip = (read64(sec + 16) ^ read64(sec + 24)) + seed;
+            Hash128 m128 = mult64to128(input64 ^ bitflip, PRIME64_1 + (len << 2));
+            m128.m_high += (m128.m_low << 1);
+            m128.m_low ^= (m128.m_high >> 3);
+            m128.m_low ^= m128.m_low >> 35;
+            m128.m_low *= PRIME_MX2;
+            m128.m_low ^= m128.m_low >> 28;
+            m128.m_high = avalanche(m128.m_high);
+            return m128;
+        }
+        if (len > 0)
+        {
+            u32 c1 = input[0], c2 = input[len >> 1], c3 = input[len - 1];
+            u32 combinedl = (c1 << 16) | (c2 << 24) | (c3 << 0) | ((u32)len << 8);
+            u32 combinedh = rotl32(swap32(combinedl), 13);
+            u64 bitflipl = (u64)(read32(sec) ^ read32(sec + 4)) + seed;
+            u64 bitfliph = (u64)(read32(sec + 8) ^ read32(sec + 12)) - seed;
+            return Hash128{xxh64_avalanche((u64)combinedl ^ bitflipl), xxh64_avalanche((u64)combinedh ^ bitfliph)};
+        }
+        return Hash128{
+            xxh64_avalanche(seed ^ (read64(sec + 64) ^ read64(sec + 72))),
+            xxh64_avalanche(seed ^ (read64(sec + 80) ^ read64(sec + 88)))};
+    }
+
+    static Hash128 hash128_mid(const uint8_t *input, size_t len)
+    {
+        const uint8_t *sec = secret();
+        const u64 seed = 0;
+        Hash128 acc{len * PRIME64_1, 0};
+        if (len <= 128)
+        {
+            if (len > 32)
+            {
+                if (len > 64)
+                {
+                    if (len > 96)
+                        mix32B(acc, input + 48, input + len - 64, sec + 96, seed);
+                    mix32B(acc, input + 32, input + len - 48, sec + 64, seed);
+                }
+                mix32B(acc, input + 16, input + len - 32, sec + 32, seed);
+            }
+            mix32B(acc, input, input + len - 16, sec, seed);
+        }
+        else
+        {
+            for (size_t i = 32; i < 160; i += 32)
+                mix32B(acc, input + i - 32, input + i - 16, sec + i - 32, seed);
+            acc.m_low = avalanche(acc.m_low);
+            acc.m_high = avalanche(acc.m_high);
+            for (size_t i = 160; i <= len; i += 32)
+                mix32B(acc, input + i - 32, input + i - 16, sec + MIDSIZE_STARTOFFSET + i - 160, seed);
+            mix32B(acc, input + len - 16, input + len - 32, sec + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET - 16, (u64)0 - seed);
+        }
+        Hash128 h128;
+        h128.m_low = acc.m_low + acc.m_high;
+        h128.m_high = (acc.m_low * PRIME64_1) + (acc.m_high * PRIME64_4) + ((len - seed) * PRIME64_2);
+        h128.m_low = avalanche(h128.m_low);
+        h128.m_high = (u64)0 - avalanche(h128.m_high);
+        return h128;
+    }
+
+    // Streaming state
+    alignas(64) u64 m_acc[ACC_NB];
+    alignas(64) uint8_t m_buffer[BUFFER_SIZE];
+    size_t m_buffered = 0;
+    size_t m_stripes_so_far = 0;
+    u64 m_total_len = 0;
+
+    void consume_stripes(u64 *acc, size_t &stripes_so_far, const uint8_t *input, size_t nb_stripes) const
+    {
+        const uint8_t *sec = secret();
+        const uint8_t *stripe_secret = sec + stripes_so_far * SECRET_CONSUME_RATE;
+        if (nb_stripes >= STRIPES_PER_BLOCK - stripes_so_far)
+        {
+            // Crossing one or more block boundaries, scramble at each of them
+            size_t this_block = STRIPES_PER_BLOCK - stripes_so_far;
+            do
+            {
+                accumulate(acc, input, stripe_secret, this_block);
+                scramble(acc, sec + SECRET_SIZE - STRIPE_LEN);
+                input += this_block * STRIPE_LEN;
+                nb_stripes -= this_block;
+                this_block = STRIPES_PER_BLOCK;
+                stripe_secret = sec;
+            } while (nb_stripes >= STRIPES_PER_BLOCK);
+            stripes_so_far = 0;
+        }
+        if (nb_stripes > 0)
+        {
+            accumulate(acc, input, stripe_secret, nb_stripes);
+            stripes_so_far += nb_stripes;
+        }
+    }
+
+    void digest_long(u64 *acc) const
+    {
+        memcpy(acc, m_acc, sizeof(m_acc));
+        uint8_t last_stripe[STRIPE_LEN];
+        const uint8_t *last_stripe_ptr;
+        if (m_buffered >= STRIPE_LEN)
+        {
+            size_t nb_stripes = (m_buffered - 1) / STRIPE_LEN;
+            size_t stripes_so_far = m_stripes_so_far;
+            consume_stripes(acc, stripes_so_far, m_buffer, nb_stripes);
+            last_stripe_ptr = m_buffer + m_buffered - STRIPE_LEN;
+        }
+        else
+        {
+            // The previous stripe was kept at the end of the buffer for this
+            size_t catchup = STRIPE_LEN - m_buffered;
+            memcpy(last_stripe, m_buffer + BUFFER_SIZE - catchup, catchup);
+            memcpy(last_stripe + catchup, m_buffer, m_buffered);
+            last_stripe_ptr = last_stripe;
+        }
+        accumulate_512(acc, last_stripe_ptr, secret() + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+    }
+
+public:
+    XXH3() { reset(); }
+
+    void reset()
+    {
+        init_acc(m_acc);
+        m_buffered = 0;
+        m_stripes_so_far = 0;
+        m_total_len = 0;
+    }
+
+    void update(const void *data, size_t len)
+    {
+        const uint8_t *input = static_cast<const uint8_t *>(data);
+        m_total_len += len;
+        if (m_buffered + len <= BUFFER_SIZE)
+        {
+            if (len)
+                memcpy(m_buffer + m_buffered, input, len);
+            m_buffered += len;
+            return;
+        }
+        if (m_buffered)
+        {
+            size_t load = BUFFER_SIZE - m_buffered;
+            memcpy(m_buffer + m_buffered, input, load);
+            input += load;
+            len -= load;
+            consume_stripes(m_acc, m_stripes_so_far, m_buffer, BUFFER_SIZE / STRIPE_LEN);
+            m_buffered = 0;
+        }
+        if (len > BUFFER_SIZE)
+        {
+            // Always leave at least one byte behind, the last stripe is special
+            size_t nb_stripes = (len - 1) / STRIPE_LEN;
+            consume_stripes(m_acc, m_stripes_so_far, input, nb_stripes);
+            memcpy(m_buffer + BUFFER_SIZE - STRIPE_LEN, input + nb_stripes * STRIPE_LEN - STRIPE_LEN, STRIPE_LEN);
+            input += nb_stripes * STRIPE_LEN;
+            len -= nb_stripes * STRIPE_LEN;
+        }
+        memcpy(m_buffer, input, len);
+        m_buffered = len;
+    }
+
+    uint64_t digest64() const
+    {
+        if (m_total_len > MIDSIZE_MAX)
+        {
+            alignas(64) u64 acc[ACC_NB];
+            digest_long(acc);
+            return finalize_long_64(acc, m_total_len);
+        }
+        return hash64(m_buffer, (size_t)m_total_len);
+    }
+
+    Hash128 digest128() const
+    {
+        if (m_total_len > MIDSIZE_MAX)
+        {
+            alignas(64) u64 acc[ACC_NB];
+            digest_long(acc);
+            return finalize_long_128(acc, m_total_len);
+        }
+        return hash128(m_buffer, (size_t)m_total_len);
+    }
+
+    static uint64_t hash64(const void *data, size_t len)
+    {
+        const uint8_t *input = static_cast<const uint8_t *>(data);
+        if (len <= 16)
+            return hash64_short(input, len);
+        if (len <= MIDSIZE_MAX)
+            return hash64_mid(input, len);
+        alignas(64) u64 acc[ACC_NB];
+        init_acc(acc);
+        hash_long_loop(acc, input, len);
+        return finalize_long_64(acc, len);
+    }
+
+    static Hash128 hash128(const void *data, size_t len)
+    {
+        const uint8_t *input = static_cast<const uint8_t *>(data);
+        if (len <= 16)
+            return hash128_short(input, len);
+        if (len <= MIDSIZE_MAX)
+            return hash128_mid(input, len);
+        alignas(64) u64 acc[ACC_NB];
+        init_acc(acc);
+        hash_long_loop(acc, input, len);
+        return finalize_long_128(acc, len);
+    }
+
+    static Hash128 hash128(const std::string &str)
+    {
+        return hash128(str.data(), str.size());
+    }
+
+    // Streams the whole file through the hasher
+    static bool hash_file(const std::filesystem::path &path, Hash128 &hash)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        XXH3 state;
+        std::vector<char> chunk(1 << 20);
+        while (file)
+        {
+            file.read(chunk.data(), chunk.size());
+            std::streamsize got = file.gcount();
+            if (got > 0)
+                state.update(chunk.data(), (size_t)got);
+        }
+        if (file.bad())
+            return false;
+        hash = state.digest128();
+        return true;
+    }
+};
+
+// CRC-32C (Castagnoli, as in iSCSI and ext4), streaming
+// Uses the SSE4.2 crc32 instruction when the CPU has it, checked at run time so the build needs no -msse4.2,
+// and a byte-wise table otherwise; both give the same digests
+class CRC32C
+{
+private:
+    static constexpr uint32_t POLYNOMIAL = 0x82F63B78U; // Reflected
+
+    uint32_t m_state = 0xFFFFFFFFU;
+
+    static const std::array<uint32_t, 256> &table()
+    {
+        static const std::array<uint32_t, 256> table = []
+        {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+                entries[i] = crc;
+            }
+            return entries;
+        }();
+        return table;
+    }
+
+    static uint32_t update_table(uint32_t crc, const uint8_t *data, size_t len)
+    {
+        const auto &entries = table();
+        for (size_t i = 0; i < len; ++i)
+            crc = (crc >> 8) ^ entries[(crc ^ data[i]) & 0xFF];
+        return crc;
+    }
+
+#ifdef NTCOMP_CRC32C_HARDWARE
+    __attribute__((target("sse4.2"))) static uint32_t update_hardware(uint32_t crc, const uint8_t *data, size_t len)
+    {
+        uint64_t crc64 = crc;
+        for (; len >= 8; data += 8, len -= 8)
+        {
+            uint64_t word;
+            memcpy(&word, data, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+        for (; len; ++data, --len)
+            crc = _mm_crc32_u8(crc, *data);
+        return crc;
+    }
+#endif
+
+public:
+    static bool has_hardware()
+    {
+#ifdef NTCOMP_CRC32C_HARDWARE
+        static const bool has = __builtin_cpu_supports("sse4.2");
+        return has;
+#else
+        return false;
+#endif
+    }
+
+    void reset()
+    {
+        m_state = 0xFFFFFFFFU;
+    }
+
+    void update(const void *data, size_t len)
+    {
+        const uint8_t *input = static_cast<const uint8_t *>(data);
+#ifdef NTCOMP_CRC32C_HARDWARE
+        if (has_hardware())
+        {
+            m_state = update_hardware(m_state, input, len);
+            return;
+        }
+#endif
+        m_state = update_table(m_state, input, len);
+    }
+
+    uint32_t digest() const
+    {
+        return m_state ^ 0xFFFFFFFFU;
+    }
+
+    static uint32_t hash(const void *data, size_t len)
+    {
+        CRC32C crc;
+        crc.update(data, len);
+        return crc.digest();
+    }
+};
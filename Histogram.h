@@ -0,0 +1,196 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Exact integer histogram of 8 or 16 bit samples, one bin per level
+// Counting goes through four sub-histograms, one per sample of an unrolled group of four, so runs of equal
+// samples (air, background) do not make every increment wait for the store of the one before it
+// Large inputs are split between threads, each with sub-histograms of its own, and merged at the end
+template <typename T>
+class Histogram
+{
+    static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, uint16_t>, "8 or 16 bit samples only");
+
+public:
+    static constexpr size_t LEVELS = size_t(1) << (8 * sizeof(T));
+
+private:
+    // Below this many samples a thread of its own costs more than it saves
+    static constexpr size_t MIN_SAMPLES_PER_THREAD = 1 << 20;
+    // Sub-histogram counters are 32 bit, every sample goes to one of four, so this many never overflow one
+    static constexpr size_t MAX_SAMPLES_PER_PASS = size_t(1) << 32;
+
+    std::vector<uint64_t> m_counts;
+
+    // One pass, at most MAX_SAMPLES_PER_PASS samples
+    void count_pass(const T *data, size_t count, std::vector<uint32_t> &sub)
+    {
+        std::fill(sub.begin(), sub.end(), 0);
+        uint32_t *sub0 = sub.data(), *sub1 = sub0 + LEVELS, *sub2 = sub1 + LEVELS, *sub3 = sub2 + LEVELS;
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            ++sub0[data[i]];
+            ++sub1[data[i + 1]];
+            ++sub2[data[i + 2]];
+            ++sub3[data[i + 3]];
+        }
+        for (; i < count; ++i)
+            ++sub0[data[i]];
+        for (size_t level = 0; level < LEVELS; ++level)
+            m_counts[level] += (uint64_t)sub0[level] + sub1[level] + sub2[level] + sub3[level];
+    }
+
+    static unsigned threads_for(size_t count, unsigned threads)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        return (unsigned)std::max<size_t>(1, std::min<size_t>(threads, count / MIN_SAMPLES_PER_THREAD));
+    }
+
+public:
+    Histogram() : m_counts(LEVELS, 0)
+    {
+    }
+
+    // Counts the samples into this histogram on the calling thread
+    void add(const T *data, size_t count)
+    {
+        std::vector<uint32_t> sub(4 * LEVELS);
+        while (count)
+        {
+            size_t pass = std::min(count, MAX_SAMPLES_PER_PASS);
+            count_pass(data, pass, sub);
+            data += pass;
+            count -= pass;
+        }
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (size_t level = 0; level < LEVELS; ++level)
+            m_counts[level] += other.m_counts[level];
+    }
+
+    // A whole volume, threads 0 means one per core
+    static Histogram of(const T *data, size_t count, unsigned threads = 0)
+    {
+        threads = threads_for(count, threads);
+        Histogram histogram;
+        if (threads == 1)
+        {
+            histogram.add(data, count);
+            return histogram;
+        }
+        std::vector<Histogram> partials(threads);
+        size_t chunk = (count + threads - 1) / threads;
+        {
+            ThreadPool pool(threads);
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                size_t begin = std::min(count, t * chunk);
+                size_t end = std::min(count, begin + chunk);
+                pool.submit([&partials, t, data, begin, end] { partials[t].add(data + begin, end - begin); });
+            }
+            pool.wait();
+        }
+        for (const auto &partial : partials)
+            histogram.merge(partial);
+        return histogram;
+    }
+
+    // One histogram per slab of slab_depth slices, the last slab may be thinner; slab_depth 1 is per slice
+    static std::vector<Histogram> per_slab(const T *data, size_t slice_samples, size_t slices, size_t slab_depth,
+                                           unsigned threads = 0)
+    {
+        slab_depth = std::max<size_t>(1, slab_depth);
+        size_t slabs = (slices + slab_depth - 1) / slab_depth;
+        std::vector<Histogram> histograms(slabs);
+        threads = (unsigned)std::min<size_t>(std::max<size_t>(1, slabs), threads_for(slice_samples * slices, threads));
+        ThreadPool pool(threads);
+        for (size_t slab = 0; slab < slabs; ++slab)
+        {
+            size_t first = slab * slab_depth;
+            size_t depth = std::min(slab_depth, slices - first);
+            pool.submit([&histograms, slab, data, first, depth, slice_samples]
+                        { histograms[slab].add(data + first * slice_samples, depth * slice_samples); });
+        }
+        pool.wait();
+        return histograms;
+    }
+
+    static std::vector<Histogram> per_slice(const T *data, size_t slice_samples, size_t slices, unsigned threads = 0)
+    {
+        return per_slab(data, slice_samples, slices, 1, threads);
+    }
+
+    uint64_t operator[](size_t level) const
+    {
+        return m_counts[level];
+    }
+
+    static constexpr size_t size()
+    {
+        return LEVELS;
+    }
+
+    uint64_t total() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : m_counts)
+            total += count;
+        return total;
+    }
+
+    // Levels that occur at all
+    int active_levels() const
+    {
+        int active = 0;
+        for (uint64_t count : m_counts)
+            active += count != 0;
+        return active;
+    }
+
+    // Lowest and highest occurring level, -1 for both if there are no samples
+    int min_level() const
+    {
+        for (size_t level = 0; level < LEVELS; ++level)
+            if (m_counts[level])
+                return (int)level;
+        return -1;
+    }
+
+    int max_level() const
+    {
+        for (size_t level = LEVELS; level-- > 0;)
+            if (m_counts[level])
+                return (int)level;
+        return -1;
+    }
+
+    // Share of the levels between the lowest and highest one that occur, 0 without samples
+    float usage() const
+    {
+        int low = min_level();
+        if (low < 0)
+            return 0.0f;
+        return (float)active_levels() / (float)(1 + max_level() - low);
+    }
+
+    // Level -> index among the occurring levels, for packing the histogram; unused levels map to 0
+    std::vector<T> packing_table() const
+    {
+        std::vector<T> table(LEVELS, 0);
+        T packed = 0;
+        for (size_t level = 0; level < LEVELS; ++level)
+            if (m_counts[level])
+                table[level] = packed++;
+        return table;
+    }
+};
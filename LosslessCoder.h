@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Small and fast lossless byte coder: left-neighbour delta followed by PackBits run-length coding
+// Nowhere near the real codecs, but zero borders and flat regions collapse and it never fails to round trip
+class LosslessCoder
+{
+public:
+    // Appends the coded bytes to out
+    static void encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+    {
+        std::vector<uint8_t> residual(size);
+        uint8_t previous = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            residual[i] = (uint8_t)(data[i] - previous);
+            previous = data[i];
+        }
+
+        // PackBits: control n < 128 means n + 1 literals follow, n > 128 means the next byte repeats 257 - n times
+        size_t i = 0;
+        while (i < size)
+        {
+            size_t run = 1;
+            while (i + run < size && run < 128 && residual[i + run] == residual[i])
+                ++run;
+            if (run >= 3)
+            {
+                out.push_back((uint8_t)(257 - run));
+                out.push_back(residual[i]);
+                i += run;
+                continue;
+            }
+            size_t literal_start = i;
+            size_t literals = 0;
+            while (i < size && literals < 128)
+            {
+                if (i + 2 < size && residual[i] == residual[i + 1] && residual[i] == residual[i + 2])
+                    break;
+                ++i;
+                ++literals;
+            }
+            out.push_back((uint8_t)(literals - 1));
+            out.insert(out.end(), residual.begin() + literal_start, residual.begin() + literal_start + literals);
+        }
+    }
+
+    // Decodes exactly size bytes, false if the input is truncated or does not add up
+    static bool decode(const uint8_t *coded, size_t coded_size, uint8_t *data, size_t size)
+    {
+        size_t in = 0, out = 0;
+        while (out < size)
+        {
+            if (in >= coded_size)
+                return false;
+            uint8_t control = coded[in++];
+            if (control < 128)
+            {
+                size_t literals = (size_t)control + 1;
+                if (in + literals > coded_size || out + literals > size)
+                    return false;
+                for (size_t k = 0; k < literals; ++k)
+                    data[out++] = coded[in++];
+            }
+            else if (control > 128)
+            {
+                size_t run = 257 - (size_t)control;
+                if (in >= coded_size || out + run > size)
+                    return false;
+                uint8_t value = coded[in++];
+                for (size_t k = 0; k < run; ++k)
+                    data[out++] = value;
+            }
+        }
+
+        // Undo the delta
+        uint8_t previous = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = (uint8_t)(data[i] + previous);
+            previous = data[i];
+        }
+        return in == coded_size;
+    }
+};
@@ -0,0 +1,249 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string.h>
+
+#include "CSVReader.h"
+#include "CSVSchema.h"
+
+// Largest resident memory seen per voxel of input for one kind of work, e.g. one codec's encoder
+class MemoryHistory
+{
+public:
+    std::string m_kind;
+    double m_bytes_per_voxel = 0.0;
+    uintmax_t m_samples = 0;
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Kind", &MemoryHistory::m_kind),
+            csv_column("BytesPerVoxel", &MemoryHistory::m_bytes_per_voxel),
+            csv_column("Samples", &MemoryHistory::m_samples));
+    }
+};
+
+// Process-wide account of the memory that running conversions and encodes are expected to take
+// Work reserves its estimate before it starts and waits while the reservations would exceed the budget;
+// estimates come from the dimensions of the volume and what the same kind of work peaked at before
+class MemoryGovernor
+{
+public:
+    // Releases its bytes when it goes out of scope
+    class Reservation
+    {
+    private:
+        MemoryGovernor *m_governor = nullptr;
+        uintmax_t m_bytes = 0;
+
+    public:
+        Reservation() = default;
+        Reservation(MemoryGovernor *governor, uintmax_t bytes) : m_governor(governor), m_bytes(bytes)
+        {
+        }
+        Reservation(const Reservation &) = delete;
+        Reservation &operator=(const Reservation &) = delete;
+        Reservation(Reservation &&other) noexcept : m_governor(other.m_governor), m_bytes(other.m_bytes)
+        {
+            other.m_governor = nullptr;
+        }
+        Reservation &operator=(Reservation &&other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                m_governor = other.m_governor;
+                m_bytes = other.m_bytes;
+                other.m_governor = nullptr;
+            }
+            return *this;
+        }
+        ~Reservation()
+        {
+            release();
+        }
+
+        void release()
+        {
+            if (m_governor)
+                m_governor->release(m_bytes);
+            m_governor = nullptr;
+        }
+
+        uintmax_t bytes() const
+        {
+            return m_bytes;
+        }
+    };
+
+private:
+    // Without history, guesses on the high side; the encoders keep a few frames and their search structures,
+    // jp3d the whole wavelet transformed volume, conversion the volume, its cropped and packed copies
+    static constexpr double DEFAULT_BYTES_PER_VOXEL = 16.0;
+    static constexpr uintmax_t BASE_BYTES = 64ull << 20; // Binary, libraries and buffers of any process
+    static constexpr double MARGIN = 1.25;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    uintmax_t m_budget = 0, m_reserved = 0, m_peak_reserved = 0;
+    std::map<std::string, MemoryHistory> m_history;
+
+    void release(uintmax_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_reserved -= std::min(bytes, m_reserved);
+        }
+        m_released.notify_all();
+    }
+
+public:
+    MemoryGovernor() = default;
+    MemoryGovernor(const MemoryGovernor &) = delete;
+
+    // The one every converter and runner of the process shares
+    static MemoryGovernor &instance()
+    {
+        static MemoryGovernor governor;
+        return governor;
+    }
+
+    // Bytes the reservations may add up to, 0 admits everything
+    void set_budget(uintmax_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_budget = bytes;
+        }
+        m_released.notify_all();
+    }
+
+    uintmax_t budget() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget;
+    }
+
+    uintmax_t reserved() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_reserved;
+    }
+
+    // Most that was ever reserved at once, to check a budget against what the work needed
+    uintmax_t peak_reserved() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_peak_reserved;
+    }
+
+    // Waits until bytes fit; more than the whole budget is admitted once nothing else is reserved, so that one
+    // oversized volume runs alone instead of never
+    Reservation reserve(uintmax_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_released.wait(lock, [this, bytes]
+                        { return !m_budget || m_reserved + bytes <= m_budget || m_reserved == 0; });
+        m_reserved += bytes;
+        m_peak_reserved = std::max(m_peak_reserved, m_reserved);
+        return Reservation(this, bytes);
+    }
+
+    // Like reserve, but gives up instead of waiting; the reservation holds 0 bytes if it did not fit
+    bool try_reserve(uintmax_t bytes, Reservation &reservation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_budget && m_reserved + bytes > m_budget && m_reserved != 0)
+            return false;
+        m_reserved += bytes;
+        m_peak_reserved = std::max(m_peak_reserved, m_reserved);
+        reservation = Reservation(this, bytes);
+        return true;
+    }
+
+    // Expected peak of one kind of work on a volume of that many voxels
+    uintmax_t estimate(const std::string &kind, uintmax_t voxels) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_history.find(kind);
+        double per_voxel = found != m_history.end() ? found->second.m_bytes_per_voxel : DEFAULT_BYTES_PER_VOXEL;
+        return BASE_BYTES + (uintmax_t)(per_voxel * MARGIN * (double)voxels);
+    }
+
+    // What a finished job peaked at, e.g. ProcessResult::m_peak_rss; the history keeps the largest per voxel
+    void record(const std::string &kind, uintmax_t voxels, uintmax_t peak_rss)
+    {
+        if (!voxels || !peak_rss)
+            return;
+        double per_voxel = (double)(peak_rss > BASE_BYTES ? peak_rss - BASE_BYTES : 0) / (double)voxels;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        MemoryHistory &history = m_history[kind];
+        history.m_kind = kind;
+        // The first sample replaces the default, later ones only raise it
+        history.m_bytes_per_voxel = history.m_samples ? std::max(history.m_bytes_per_voxel, per_voxel) : per_voxel;
+        ++history.m_samples;
+    }
+
+    bool load_history(const std::filesystem::path &path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!std::filesystem::exists(path))
+            return true; // Nothing measured yet
+        CSVReader reader;
+        if (!reader.open(path))
+        {
+            std::cerr << "Error while opening memory history: " << strerror(errno);
+            return false;
+        }
+        CSVRow row;
+        auto schema = MemoryHistory::schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << "Memory history has an unknown header, starting from scratch" << std::endl;
+            return true;
+        }
+        MemoryHistory history;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, history))
+                m_history[history.m_kind] = history;
+        }
+        return true;
+    }
+
+    bool save_history(const std::filesystem::path &path) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::filesystem::path temp_file = path;
+        temp_file += ".tmp";
+        {
+            std::ofstream file(temp_file);
+            auto schema = MemoryHistory::schema();
+            std::string buffer;
+            schema.write_header(buffer);
+            for (const auto &[kind, history] : m_history)
+                schema.write(history, buffer);
+            file << buffer;
+            if (!file)
+            {
+                std::cerr << "Could not write memory history: " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_file, path, ec);
+        if (ec)
+        {
+            std::cerr << "Could not replace memory history: " << ec.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "Hash.h"
+
+// Open-addressing (linear probing) map from names to small integers, usually indices into a vector
+// The names are not copied: whatever the views point at has to outlive the index
+class NameIndex
+{
+private:
+    struct Slot
+    {
+        std::string_view m_name;
+        uint64_t m_hash = 0;
+        uint32_t m_value = 0;
+        bool m_used = false;
+    };
+
+    std::vector<Slot> m_slots;
+    size_t m_mask = 0;
+    size_t m_size = 0;
+
+    void grow()
+    {
+        std::vector<Slot> old;
+        old.swap(m_slots);
+        m_slots.resize(old.empty() ? 16 : old.size() * 2);
+        m_mask = m_slots.size() - 1;
+        for (const auto &slot : old)
+        {
+            if (!slot.m_used)
+                continue;
+            size_t i = slot.m_hash & m_mask;
+            while (m_slots[i].m_used)
+                i = (i + 1) & m_mask;
+            m_slots[i] = slot;
+        }
+    }
+
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    NameIndex(size_t expected = 0)
+    {
+        size_t capacity = 16;
+        while (capacity < expected * 2) // Keep the load factor at or below one half
+            capacity *= 2;
+        m_slots.resize(capacity);
+        m_mask = capacity - 1;
+    }
+
+    // False if the name is already in, in which case its value is left alone
+    bool insert(std::string_view name, uint32_t value)
+    {
+        if ((m_size + 1) * 2 > m_slots.size())
+            grow();
+        uint64_t hash = XXH3::hash64(name.data(), name.size());
+        size_t i = hash & m_mask;
+        while (m_slots[i].m_used)
+        {
+            if (m_slots[i].m_hash == hash && m_slots[i].m_name == name)
+                return false;
+            i = (i + 1) & m_mask;
+        }
+        m_slots[i].m_name = name;
+        m_slots[i].m_hash = hash;
+        m_slots[i].m_value = value;
+        m_slots[i].m_used = true;
+        ++m_size;
+        return true;
+    }
+
+    // Value stored for the name, npos if there is none
+    uint32_t find(std::string_view name) const
+    {
+        uint64_t hash = XXH3::hash64(name.data(), name.size());
+        for (size_t i = hash & m_mask; m_slots[i].m_used; i = (i + 1) & m_mask)
+        {
+            if (m_slots[i].m_hash == hash && m_slots[i].m_name == name)
+                return m_slots[i].m_value;
+        }
+        return npos;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+};
@@ -0,0 +1,355 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Per-job limits, zero means unlimited
+struct ProcessLimits
+{
+    double m_wall_time = 0.0;           // Seconds
+    uintmax_t m_max_rss = 0;            // Bytes of resident memory for the whole process tree
+    uintmax_t m_max_address_space = 0;  // Bytes, RLIMIT_AS backstop; VTM maps a lot more than it touches, so keep it generous
+};
+
+struct ProcessResult
+{
+    bool m_started = false;
+    int m_exit_code = -1;
+    double m_elapsed = 0.0; // Wall time in seconds, like the date +%s.%N pairs in run.sh
+    bool m_timed_out = false;
+    bool m_memory_exceeded = false;
+    uintmax_t m_peak_rss = 0; // Bytes, largest process of the tree
+};
+
+class Process
+{
+private:
+    // A cgroup v2 leaf of our own cgroup with memory.max set, if the hierarchy is delegated to us
+    class MemoryCgroup
+    {
+    private:
+        std::filesystem::path m_path;
+
+        static std::filesystem::path own_cgroup()
+        {
+            std::ifstream cgroup("/proc/self/cgroup");
+            std::string line;
+            while (std::getline(cgroup, line))
+            {
+                if (line.rfind("0::", 0) == 0)
+                    return std::filesystem::path("/sys/fs/cgroup") / line.substr(4);
+            }
+            return {};
+        }
+
+        static bool write_file(const std::filesystem::path &path, const std::string &text)
+        {
+            std::ofstream file(path);
+            file << text;
+            file.flush();
+            return (bool)file;
+        }
+
+    public:
+        bool create(uintmax_t max_rss)
+        {
+            namespace fs = std::filesystem;
+            static std::atomic<unsigned> counter{0};
+            std::error_code ec;
+            if (!fs::exists("/sys/fs/cgroup/cgroup.controllers", ec))
+                return false; // Not cgroup v2
+            fs::path parent = own_cgroup();
+            if (parent.empty())
+                return false;
+            m_path = parent / ("ntcomp-" + std::to_string(getpid()) + "-" + std::to_string(counter++));
+            if (!fs::create_directory(m_path, ec))
+            {
+                m_path.clear();
+                return false;
+            }
+            if (!fs::exists(m_path / "memory.max", ec))
+                write_file(parent / "cgroup.subtree_control", "+memory");
+            if (!write_file(m_path / "memory.max", std::to_string(max_rss)))
+            {
+                remove();
+                return false;
+            }
+            write_file(m_path / "memory.swap.max", "0"); // Swapping is what we are trying to avoid
+            return true;
+        }
+
+        std::string procs_path() const
+        {
+            return (m_path / "cgroup.procs").string();
+        }
+
+        bool oom_killed() const
+        {
+            std::ifstream events(m_path / "memory.events");
+            std::string key;
+            uintmax_t value;
+            while (events >> key >> value)
+            {
+                if (key == "oom_kill" && value > 0)
+                    return true;
+            }
+            return false;
+        }
+
+        void remove()
+        {
+            if (!m_path.empty())
+                rmdir(m_path.c_str());
+            m_path.clear();
+        }
+    };
+
+    // Resident bytes of the process and everything it started, e.g. jp3d under the bash of a JP3D script
+    static uintmax_t tree_rss(pid_t pid)
+    {
+        static const long page_size = sysconf(_SC_PAGESIZE);
+        uintmax_t rss = 0;
+        std::vector<pid_t> pending{pid};
+        while (!pending.empty())
+        {
+            pid_t current = pending.back();
+            pending.pop_back();
+            std::ifstream statm("/proc/" + std::to_string(current) + "/statm");
+            uintmax_t size = 0, resident = 0;
+            if (statm >> size >> resident)
+                rss += resident * (uintmax_t)page_size;
+            std::ifstream children("/proc/" + std::to_string(current) + "/task/" + std::to_string(current) + "/children");
+            pid_t child;
+            while (children >> child)
+                pending.push_back(child);
+        }
+        return rss;
+    }
+
+public:
+    // Runs args[0] (searched in PATH unless it contains a slash) inside working_dir and waits for it
+    // With stdout_path set, the child's standard output goes to that file (relative to working_dir)
+    // inherited_fds stay open across exec even if they are close-on-exec, e.g. MemoryFile::fd()
+    // Limits are enforced on the whole process group: the wall time by the waiting thread, memory by a
+    // cgroup v2 memory.max when we are allowed to create one, otherwise by polling /proc
+    static ProcessResult run(const std::vector<std::string> &args, const std::filesystem::path &working_dir,
+                             const std::filesystem::path &stdout_path = {}, const ProcessLimits &limits = {},
+                             const std::vector<int> &inherited_fds = {})
+    {
+        ProcessResult result;
+        if (args.empty())
+            return result;
+        const int *keep_fds = inherited_fds.data();
+        size_t keep_count = inherited_fds.size();
+
+        std::vector<char *> argv;
+        for (const auto &arg : args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        MemoryCgroup cgroup;
+        bool use_cgroup = limits.m_max_rss && cgroup.create(limits.m_max_rss);
+        std::string procs_path = use_cgroup ? cgroup.procs_path() : std::string();
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::cerr << "Error while forking " << args[0] << ": " << strerror(errno) << std::endl;
+            cgroup.remove();
+            return result;
+        }
+        if (pid == 0)
+        {
+            // Only async-signal-safe calls from here on
+            setpgid(0, 0);
+            if (use_cgroup)
+            {
+                int fd = open(procs_path.c_str(), O_WRONLY);
+                if (fd < 0 || write(fd, "0", 1) != 1)
+                    _exit(126);
+                close(fd);
+            }
+            if (limits.m_max_address_space)
+            {
+                struct rlimit rl;
+                rl.rlim_cur = rl.rlim_max = (rlim_t)limits.m_max_address_space;
+                setrlimit(RLIMIT_AS, &rl);
+            }
+            if (chdir(working_dir.c_str()) != 0)
+                _exit(126);
+            for (size_t i = 0; i < keep_count; ++i)
+                fcntl(keep_fds[i], F_SETFD, 0);
+            if (!stdout_path.empty())
+            {
+                int fd = open(stdout_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+                    _exit(126);
+                close(fd);
+            }
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        setpgid(pid, pid); // Same as the child does, whoever comes first
+
+        // A pidfd wakes us the moment the child exits; without one we fall back to short sleeps
+#ifdef SYS_pidfd_open
+        int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+        int pidfd = -1;
+#endif
+        bool poll_rss = limits.m_max_rss && !use_cgroup;
+        bool watching = limits.m_wall_time > 0.0 || poll_rss;
+        int status = 0;
+        struct rusage usage;
+        memset(&usage, 0, sizeof(usage));
+        for (;;)
+        {
+            pid_t waited = wait4(pid, &status, watching ? WNOHANG : 0, &usage);
+            if (waited == pid)
+                break;
+            if (waited < 0 && errno != EINTR)
+            {
+                std::cerr << "Error while waiting for " << args[0] << ": " << strerror(errno) << std::endl;
+                if (pidfd >= 0)
+                    close(pidfd);
+                cgroup.remove();
+                return result;
+            }
+            if (!watching)
+                continue;
+
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!result.m_timed_out && limits.m_wall_time > 0.0 && elapsed > limits.m_wall_time)
+            {
+                result.m_timed_out = true;
+                kill(-pid, SIGKILL);
+            }
+            if (!result.m_memory_exceeded && poll_rss && tree_rss(pid) > limits.m_max_rss)
+            {
+                result.m_memory_exceeded = true;
+                kill(-pid, SIGKILL);
+            }
+
+            int wait_ms = 100;
+            if (limits.m_wall_time > 0.0)
+                wait_ms = std::max(1, std::min(wait_ms, (int)((limits.m_wall_time - elapsed) * 1000.0) + 1));
+            if (pidfd >= 0)
+            {
+                struct pollfd pfd = {pidfd, POLLIN, 0};
+                poll(&pfd, 1, wait_ms);
+            }
+            else
+            {
+                usleep(std::min(wait_ms, 5) * 1000);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        if (pidfd >= 0)
+            close(pidfd);
+
+        if (use_cgroup)
+        {
+            result.m_memory_exceeded = result.m_memory_exceeded || cgroup.oom_killed();
+            cgroup.remove();
+        }
+
+        result.m_started = true;
+        result.m_elapsed = std::chrono::duration<double>(end - start).count();
+        result.m_peak_rss = (uintmax_t)usage.ru_maxrss * 1024;
+        if (WIFEXITED(status))
+            result.m_exit_code = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            result.m_exit_code = 128 + WTERMSIG(status);
+        return result;
+    }
+};
+
+// Anonymous in-memory file a child opens as /proc/self/fd/N, so a config never touches the disk
+// A memfd where the kernel has them, otherwise a pipe already holding the contents; either way it is
+// close-on-exec here and has to be passed to Process::run as an inherited fd
+class MemoryFile
+{
+private:
+    int m_fd = -1;
+
+    static bool write_all(int fd, const char *data, size_t size)
+    {
+        while (size)
+        {
+            ssize_t done = write(fd, data, size);
+            if (done < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += done;
+            size -= (size_t)done;
+        }
+        return true;
+    }
+
+public:
+    MemoryFile() = default;
+    MemoryFile(const MemoryFile &) = delete;
+    MemoryFile &operator=(const MemoryFile &) = delete;
+
+    ~MemoryFile()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    // False with errno set
+    bool create(const std::string &name, const std::string &contents)
+    {
+#ifdef MFD_CLOEXEC
+        m_fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+        if (m_fd >= 0)
+            return write_all(m_fd, contents.data(), contents.size());
+        if (errno != ENOSYS)
+            return false;
+#endif
+        // A pipe is read once from the start, which is all a config reader does; the contents have to fit
+        // its buffer, 64 KiB by default, since nobody reads before the child starts
+        if (contents.size() > 64 * 1024)
+        {
+            errno = EFBIG;
+            return false;
+        }
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0)
+            return false;
+        bool ok = write_all(fds[1], contents.data(), contents.size());
+        close(fds[1]);
+        m_fd = fds[0];
+        return ok;
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    // Valid in any child the fd is inherited by, under the same number
+    std::string path() const
+    {
+        return "/proc/self/fd/" + std::to_string(m_fd);
+    }
+};
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ThreadPool.h"
+
+// Which planes of a volume are its frames, the remaining axis is coded as time
+enum Orientation : uint8_t
+{
+    ORIENT_XY, // As converted, slices along z
+    ORIENT_XZ, // Frames of x by z, one per y
+    ORIENT_YZ, // Frames of y by z, one per x
+    ORIENT_COUNT,
+};
+
+static constexpr std::string_view ORIENTATION_NAMES[ORIENT_COUNT] = {"XY", "XZ", "YZ"};
+
+inline std::string_view orientation_name(Orientation orientation)
+{
+    return orientation < ORIENT_COUNT ? ORIENTATION_NAMES[orientation] : std::string_view();
+}
+
+// Empty names are volumes from before reslicing existed, which are all XY
+inline Orientation parse_orientation(std::string_view name)
+{
+    for (uint8_t o = 0; o < ORIENT_COUNT; ++o)
+        if (name == ORIENTATION_NAMES[o])
+            return (Orientation)o;
+    return ORIENT_XY;
+}
+
+// Axis-permuted copies of 8 bit volumes
+// XZ moves whole rows; YZ transposes every slice, in 64x64 tiles of 16x16 SSE2 byte transposes so reads and
+// writes both stay within a few cache lines per row; slices are split between threads
+class Reslicer
+{
+private:
+    static constexpr int TILE = 64;
+
+#ifdef __SSE2__
+    // 16x16 bytes from src (rows src_stride apart) transposed into dst (rows dst_stride apart)
+    static void transpose16(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride)
+    {
+        __m128i r[16];
+        for (int i = 0; i < 16; ++i)
+            r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * src_stride));
+        // Interleave 8, 16, 32 and 64 bit units of row pairs; after four rounds each register is one column
+        __m128i t[16];
+        for (int i = 0; i < 8; ++i) // t[i]: columns 0-7 of rows 2i, 2i+1; t[i + 8]: columns 8-15
+        {
+            t[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+            t[i + 8] = _mm_unpackhi_epi8(r[2 * i], r[2 * i + 1]);
+        }
+        for (int i = 0; i < 4; ++i) // r[4g + i]: columns 4g to 4g+3 of rows 4i to 4i+3
+        {
+            r[i] = _mm_unpacklo_epi16(t[2 * i], t[2 * i + 1]);
+            r[i + 4] = _mm_unpackhi_epi16(t[2 * i], t[2 * i + 1]);
+            r[i + 8] = _mm_unpacklo_epi16(t[2 * i + 8], t[2 * i + 9]);
+            r[i + 12] = _mm_unpackhi_epi16(t[2 * i + 8], t[2 * i + 9]);
+        }
+        for (int g = 0; g < 4; ++g) // t[4g + p]: columns 4g, 4g+1 of rows 8p to 8p+7; t[4g + p + 2]: 4g+2, 4g+3
+        {
+            for (int p = 0; p < 2; ++p)
+            {
+                t[4 * g + p] = _mm_unpacklo_epi32(r[4 * g + 2 * p], r[4 * g + 2 * p + 1]);
+                t[4 * g + p + 2] = _mm_unpackhi_epi32(r[4 * g + 2 * p], r[4 * g + 2 * p + 1]);
+            }
+        }
+        for (int g = 0; g < 4; ++g) // Top and bottom halves of each column together
+        {
+            for (int k = 0; k < 2; ++k)
+            {
+                int column = 4 * g + 2 * k;
+                __m128i low = _mm_unpacklo_epi64(t[column], t[column + 1]);
+                __m128i high = _mm_unpackhi_epi64(t[column], t[column + 1]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + column * dst_stride), low);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + (column + 1) * dst_stride), high);
+            }
+        }
+    }
+#endif
+
+    // One rows x columns block, element by element, for the edges and where there is no SSE2
+    static void transpose_scalar(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, int rows,
+                                 int columns)
+    {
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < columns; ++j)
+                dst[j * dst_stride + i] = src[i * src_stride + j];
+    }
+
+    // A height x width plane into width rows of height, row x of the result at dst + x * dst_stride
+    static void transpose_plane(const uint8_t *src, int width, int height, uint8_t *dst, size_t dst_stride)
+    {
+        for (int y0 = 0; y0 < height; y0 += TILE)
+        {
+            for (int x0 = 0; x0 < width; x0 += TILE)
+            {
+                int y_end = std::min(y0 + TILE, height), x_end = std::min(x0 + TILE, width);
+                for (int y = y0; y < y_end; y += 16)
+                {
+                    for (int x = x0; x < x_end; x += 16)
+                    {
+                        const uint8_t *from = src + (size_t)y * width + x;
+                        uint8_t *to = dst + (size_t)x * dst_stride + y;
+#ifdef __SSE2__
+                        if (y + 16 <= y_end && x + 16 <= x_end)
+                        {
+                            transpose16(from, (size_t)width, to, dst_stride);
+                            continue;
+                        }
+#endif
+                        transpose_scalar(from, (size_t)width, to, dst_stride, std::min(16, y_end - y),
+                                         std::min(16, x_end - x));
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    // Dimensions of the resliced volume
+    static void dimensions(Orientation orientation, int width, int height, int depth, int &out_width, int &out_height,
+                           int &out_depth)
+    {
+        switch (orientation)
+        {
+        case ORIENT_XZ:
+            out_width = width, out_height = depth, out_depth = height;
+            break;
+        case ORIENT_YZ:
+            out_width = height, out_height = depth, out_depth = width;
+            break;
+        default:
+            out_width = width, out_height = height, out_depth = depth;
+            break;
+        }
+    }
+
+    // out holds the same number of voxels as data; threads 0 means one per core
+    static void reslice(const uint8_t *data, int width, int height, int depth, Orientation orientation, uint8_t *out,
+                        unsigned threads = 0)
+    {
+        size_t slice_size = (size_t)width * height;
+        if (orientation == ORIENT_XY)
+        {
+            memcpy(out, data, slice_size * depth);
+            return;
+        }
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::max(1u, std::min<unsigned>(threads, (unsigned)depth));
+        ThreadPool pool(threads);
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            int first = (int)((long long)depth * t / threads), last = (int)((long long)depth * (t + 1) / threads);
+            pool.submit([=]
+                        {
+                            for (int z = first; z < last; ++z)
+                            {
+                                const uint8_t *slice = data + z * slice_size;
+                                if (orientation == ORIENT_XZ)
+                                {
+                                    // Row y of slice z is row z of frame y
+                                    for (int y = 0; y < height; ++y)
+                                        memcpy(out + ((size_t)y * depth + z) * width, slice + (size_t)y * width, width);
+                                }
+                                else
+                                {
+                                    // Column x of slice z is row z of frame x
+                                    transpose_plane(slice, width, height, out + (size_t)z * height, (size_t)depth * height);
+                                }
+                            }
+                        });
+        }
+        pool.wait();
+    }
+
+    // Where a point (or a box corner) of the volume lands in the resliced one, the same mapping as dimensions()
+    static void map_point(Orientation orientation, int x, int y, int z, int &out_x, int &out_y, int &out_z)
+    {
+        dimensions(orientation, x, y, z, out_x, out_y, out_z);
+    }
+};
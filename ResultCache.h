@@ -0,0 +1,321 @@
+#pragma once
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string.h>
+
+#include "CSVReader.h"
+#include "CSVSchema.h"
+#include "Codec.h"
+#include "Digest.h"
+#include "Hash.h"
+
+class CacheEntry
+{
+private:
+    using s = std::string;
+
+public:
+    s m_key, m_codec, m_name, m_input_hash;
+    s m_file_name; // Config the run was for, <name> or <name>@<variant>; empty in entries from older caches
+    uintmax_t m_bitstream_size = 0;
+    double m_encoding_time = 0.0, m_decoding_time = 0.0;
+    bool m_verified = false;
+    long long m_timestamp = 0;
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Key", &CacheEntry::m_key),
+            csv_column("Codec", &CacheEntry::m_codec),
+            csv_column("Name", &CacheEntry::m_name),
+            csv_column("InputHash", &CacheEntry::m_input_hash),
+            csv_column("BitstreamSize", &CacheEntry::m_bitstream_size),
+            csv_column("EncodingTime", &CacheEntry::m_encoding_time),
+            csv_column("DecodingTime", &CacheEntry::m_decoding_time),
+            csv_column("Verified", &CacheEntry::m_verified),
+            csv_column("Timestamp", &CacheEntry::m_timestamp),
+            csv_column("FileName", &CacheEntry::m_file_name, false));
+    }
+};
+
+// Content-addressed store of codec runs
+// The key covers the input volume, the codec binaries and the rendered config,
+// so a hit means encoding again would produce exactly the same bitstream
+class ResultCache
+{
+private:
+    std::filesystem::path m_cache_file;
+    std::map<std::string, CacheEntry> m_entries;
+    std::map<std::string, Hash128> m_file_hashes; // Hashed files by path, valid for the lifetime of the cache object
+    mutable std::mutex m_mutex; // The runner works on the cache from several jobs at once
+    mutable bool m_journal_started = false; // Whether the journal has its header, i.e. it exists
+
+    std::filesystem::path journal_path() const
+    {
+        std::filesystem::path path = m_cache_file;
+        path += ".journal";
+        return path;
+    }
+
+    bool read_entries(const std::filesystem::path &path)
+    {
+        CSVReader reader;
+        if (!reader.open(path))
+        {
+            std::cerr << "Error while opening result cache: " << strerror(errno);
+            return false;
+        }
+        CSVRow row;
+        auto schema = CacheEntry::schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << path << " has an unknown header, not using it" << std::endl;
+            return true;
+        }
+        CacheEntry entry;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, entry))
+                m_entries[entry.m_key] = entry;
+            else // A mangled line only costs us a re-encode
+                std::cerr << "Skipping malformed cache entry" << std::endl;
+        }
+        return true;
+    }
+
+    // Appends one entry to the journal, so a stored entry survives a crash without rewriting the whole cache
+    void append_to_journal(const CacheEntry &entry)
+    {
+        namespace fs = std::filesystem;
+        std::string buffer;
+        auto schema = CacheEntry::schema();
+        if (!m_journal_started)
+        {
+            if (!fs::exists(journal_path()))
+                schema.write_header(buffer);
+            else if (!ends_with_newline(journal_path()))
+                buffer += '\n'; // A crash cut the last entry short, don't glue the next one onto it
+            m_journal_started = true;
+        }
+        schema.write(entry, buffer);
+        std::ofstream journal(journal_path(), std::ios::app);
+        journal << buffer << std::flush;
+        if (!journal)
+            std::cerr << "Could not append to result cache journal: " << strerror(errno) << std::endl;
+    }
+
+    static bool ends_with_newline(const std::filesystem::path &path)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file || file.tellg() <= 0)
+            return true;
+        file.seekg(-1, std::ios::end);
+        return file.get() == '\n';
+    }
+
+public:
+    ResultCache(const std::filesystem::path &cache_file) : m_cache_file(cache_file)
+    {
+    }
+
+    ResultCache(const ResultCache &) = delete;
+
+    bool load()
+    {
+        namespace fs = std::filesystem;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_journal_started = false;
+        if (fs::exists(m_cache_file) && !read_entries(m_cache_file))
+            return false;
+        // Entries stored after the last save, newer than the ones in the cache file
+        if (fs::exists(journal_path()) && !read_entries(journal_path()))
+            return false;
+        return true;
+    }
+
+    bool save() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Write next to the real file first so an interrupted save cannot eat the cache
+        std::filesystem::path temp_file = m_cache_file;
+        temp_file += ".tmp";
+        {
+            std::ofstream cache(temp_file);
+            if (!cache)
+            {
+                std::cerr << "Could not write result cache: " << strerror(errno) << std::endl;
+                return false;
+            }
+            auto schema = CacheEntry::schema();
+            std::string buffer;
+            schema.write_header(buffer);
+            for (const auto &[key, entry] : m_entries)
+                schema.write(entry, buffer);
+            cache << buffer;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_file, m_cache_file, ec);
+        if (ec)
+        {
+            std::cerr << "Could not replace result cache: " << ec.message() << std::endl;
+            return false;
+        }
+        // Everything in the journal is in the cache file now
+        std::filesystem::remove(journal_path(), ec);
+        m_journal_started = false;
+        return true;
+    }
+
+    bool hash_file(const std::filesystem::path &path, Hash128 &hash)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_file_hashes.find(path.string());
+            if (found != m_file_hashes.end())
+            {
+                hash = found->second;
+                return true;
+            }
+        }
+        // Hash without holding the lock, two jobs racing on one file just hash it twice; a current digest sidecar
+        // written during conversion spares reading the volume
+        if (!VolumeDigest::cached_checksum(path, hash) && !XXH3::hash_file(path, hash))
+            return false;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file_hashes[path.string()] = hash;
+        return true;
+    }
+
+    // Hash of every tool the codec needs, a rebuilt encoder or a changed default config invalidates its results
+    bool hash_codec(const std::filesystem::path &tools_dir, Codec codec, Hash128 &hash)
+    {
+        std::string hashes;
+        for (const auto &tool : get_codec_files(codec).m_tools)
+        {
+            Hash128 tool_hash;
+            if (!hash_file(tools_dir / tool, tool_hash))
+                return false;
+            hashes += tool_hash.to_string();
+        }
+        hash = XXH3::hash128(hashes);
+        return true;
+    }
+
+    // The volume name is masked out of the config so a renamed volume with the same content still hits
+    static std::string make_key(const Hash128 &input, const Hash128 &codec, std::string config_text, const std::string &name)
+    {
+        if (!name.empty())
+        {
+            size_t pos = 0;
+            while ((pos = config_text.find(name, pos)) != std::string::npos)
+            {
+                config_text.replace(pos, name.size(), "XnameX");
+                pos += 6;
+            }
+        }
+        std::string material = input.to_string() + codec.to_string() + config_text;
+        return XXH3::hash128(material).to_string();
+    }
+
+    bool lookup(const std::string &key, CacheEntry &entry) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_entries.find(key);
+        if (found == m_entries.end())
+            return false;
+        entry = found->second;
+        return true;
+    }
+
+    // Most recent lossless run of one config of a volume with the given content, used when the run artifacts
+    // and the codec tools are gone; entries that do not name their config could be any variant and never match
+    bool lookup_latest(Codec codec, const std::string &file_name, const Hash128 &input, CacheEntry &entry) const
+    {
+        std::string codec_name = get_codec_files(codec).m_name;
+        std::string input_hash = input.to_string();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool found = false;
+        for (const auto &[key, candidate] : m_entries)
+        {
+            if (candidate.m_codec == codec_name && candidate.m_file_name == file_name &&
+                candidate.m_input_hash == input_hash && candidate.m_verified &&
+                (!found || candidate.m_timestamp > entry.m_timestamp))
+            {
+                entry = candidate;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Persisted right away through the journal; save() folds the journal into the cache file
+    void store(CacheEntry entry)
+    {
+        if (entry.m_timestamp == 0)
+            entry.m_timestamp = (long long)std::time(nullptr);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries[entry.m_key] = entry;
+        append_to_journal(entry);
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+
+    // Eviction, all of these return the number of removed entries; call save() to persist
+    size_t evict(const std::function<bool(const CacheEntry &)> &predicate)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t evicted = 0;
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (predicate(it->second))
+            {
+                it = m_entries.erase(it);
+                ++evicted;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return evicted;
+    }
+
+    size_t evict_all()
+    {
+        return evict([](const CacheEntry &) { return true; });
+    }
+
+    size_t evict_codec(Codec codec)
+    {
+        std::string codec_name = get_codec_files(codec).m_name;
+        return evict([&](const CacheEntry &entry) { return entry.m_codec == codec_name; });
+    }
+
+    size_t evict_name(const std::string &name)
+    {
+        return evict([&](const CacheEntry &entry) { return entry.m_name == name; });
+    }
+
+    size_t evict_older_than(std::chrono::hours age)
+    {
+        long long threshold = (long long)std::time(nullptr) - (long long)std::chrono::duration_cast<std::chrono::seconds>(age).count();
+        return evict([&](const CacheEntry &entry) { return entry.m_timestamp < threshold; });
+    }
+
+    size_t evict_unverified()
+    {
+        return evict([](const CacheEntry &entry) { return !entry.m_verified; });
+    }
+};
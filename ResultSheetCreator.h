@@ -1,69 +1,574 @@
-#include "CSVRow.h"
+#pragma once
+#include "CSVReader.h"
+#include "Codec.h"
+#include "DatasetIndex.h"
+#include "FileMetadata.h"
+#include "CodecSweep.h"
+#include "NameIndex.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string.h>
+#include <tuple>
 #include <format>
 #include <regex>
 
-enum Codec
-{
-    AVC,
-    HEVC,
-    VVC,
-    JP3D,
-};
-
 class Result
 {
 private:
     using s = std::string;
-    using sv = std::string_view;
 
 public:
-    s m_name, m_width, m_height, m_depth, m_encoding_time, m_decoding_time;
-    double m_encoding_rate, m_decoding_rate, m_bits_per_pixel;
+    s m_name;
+    int m_width = 0, m_height = 0, m_depth = 0;
+    int m_bit_depth = 0; // Effective bit depth of the volume, 0 if not known
+    s m_orientation = "XY"; // Frame planes the volume was coded as, see Reslicer
+    double m_encoding_time = -1.0, m_decoding_time = -1.0; // Negative until a run is logged
+    double m_encoding_rate = 0.0, m_decoding_rate = 0.0, m_bits_per_pixel = 0.0;
+    uintmax_t m_bitstream_size = 0; // Set from the result cache, or from the bitstream once the sheet is computed
+    bool m_enc_failed = false, m_dec_failed = false; // Latest run was killed or crashed
 
-    Result(const s &name, const s &width, const s &height, const s &depth)
+    Result(const s &name, int width, int height, int depth)
         : m_name(name), m_width(width), m_height(height), m_depth(depth) {}
 
-    Result(sv name, sv width, sv height, sv depth)
-        : m_name(s(name)), m_width(s(width)), m_height(s(height)), m_depth(s(depth)) {}
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Name", &Result::m_name),
+            csv_column("Width", &Result::m_width),
+            csv_column("Height", &Result::m_height),
+            csv_column("Depth", &Result::m_depth),
+            csv_column("EncodingTime", &Result::m_encoding_time),
+            csv_column("EncodingRate", &Result::m_encoding_rate),
+            csv_column("DecodingTime", &Result::m_decoding_time),
+            csv_column("DecodingRate", &Result::m_decoding_rate),
+            csv_column("BPP", &Result::m_bits_per_pixel),
+            csv_column("BitDepth", &Result::m_bit_depth, false),
+            csv_column("Orientation", &Result::m_orientation, false));
+    }
 
-    enum FieldConv
+    static inline s get_info_header()
     {
-        Name = 0,
-        Width = 3,
-        Height = 4,
-        Depth = 5,
-    };
-    enum FieldTime
+        return schema().header();
+    }
+
+    bool has_times() const
     {
-        FileName = 0,
-        Time = 1,
-    };
+        return m_encoding_time >= 0.0 && m_decoding_time >= 0.0;
+    }
 
-    static inline s get_info_header()
+    // Rates and bits per pixel from the sizes and times
+    void compute_rates(uintmax_t bitstream_size)
     {
-        return "Name,Width,Height,Depth,EncodingTime,EncodingRate,DecodingTime,DecodingRate,BPP\n";
+        uintmax_t pixels = (uintmax_t)m_width * m_height * m_depth;
+        m_bitstream_size = bitstream_size;
+        // Bits per pixel [bits/pixels]
+        m_bits_per_pixel = (double)(bitstream_size * 8) / (double)pixels;
+        // Encoding and decoding rate [10^6 * pixels/seconds]
+        m_encoding_rate = ((double)pixels / m_encoding_time) / 1000000.0;
+        m_decoding_rate = ((double)pixels / m_decoding_time) / 1000000.0;
     }
 
-    s get_info() const
+    void to_index(DatasetRow::CodecResult &result) const
     {
-        return m_name
-        + "," + m_width
-        + "," + m_height
-        + "," + m_depth
-        + "," + m_encoding_time
-        + "," + std::to_string(m_encoding_rate)
-        + "," + m_decoding_time
-        + "," + std::to_string(m_decoding_rate)
-        + "," + std::to_string(m_bits_per_pixel);
+        result.m_encoding_time = m_encoding_time;
+        result.m_decoding_time = m_decoding_time;
+        result.m_bitstream_size = m_bitstream_size;
+        result.m_status = DatasetIndex::OK;
+    }
+
+    // Volume of the index row, with the codec's timings if it has any
+    static Result from_index(const DatasetIndex &index, size_t row, Codec codec)
+    {
+        DatasetRow data = index.row(row);
+        Result result(data.m_name, data.m_width, data.m_height, data.m_depth);
+        result.m_bit_depth = data.m_bit_depth;
+        result.m_orientation = s(orientation_name((Orientation)data.m_orientation));
+        const DatasetRow::CodecResult &run = data.m_results[codec];
+        if (run.m_status == DatasetIndex::OK)
+        {
+            result.m_encoding_time = run.m_encoding_time;
+            result.m_decoding_time = run.m_decoding_time;
+            result.compute_rates(run.m_bitstream_size);
+        }
+        result.m_enc_failed = result.m_dec_failed = run.m_status == DatasetIndex::FAILED;
+        return result;
+    }
+
+    // <CODEC>-results.csv from the index, for tools that want the text version
+    static bool export_csv(const DatasetIndex &index, Codec codec, const std::filesystem::path &csv_path)
+    {
+        const uint8_t *status = index.column<uint8_t>(DatasetIndex::codec_column(codec, "Status"), DatasetIndex::U8);
+        std::ofstream csv(csv_path);
+        if (!csv || !status)
+            return false;
+        s buffer = get_info_header();
+        for (size_t i = 0; i < index.size(); ++i)
+        {
+            if (status[i] == DatasetIndex::OK)
+                from_index(index, i, codec).get_info(buffer);
+        }
+        csv << buffer;
+        return (bool)csv;
+    }
+
+    // Appends the sheet line
+    void get_info(s &buffer) const
+    {
+        schema().write(*this, buffer);
+    }
+};
+
+// One volume coded with one sweep variant
+class SweepResult
+{
+private:
+    using s = std::string;
+
+public:
+    s m_name, m_modality, m_variant;
+    double m_encoding_time = 0.0, m_decoding_time = 0.0;
+    double m_encoding_rate = 0.0, m_decoding_rate = 0.0, m_bits_per_pixel = 0.0;
+    bool m_lossless = false;
+    double m_predicted_bits_per_pixel = 0.0; // From the volume's compressibility, 0 if not analyzed
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Name", &SweepResult::m_name),
+            csv_column("Modality", &SweepResult::m_modality),
+            csv_column("Variant", &SweepResult::m_variant),
+            csv_column("EncodingTime", &SweepResult::m_encoding_time),
+            csv_column("EncodingRate", &SweepResult::m_encoding_rate),
+            csv_column("DecodingTime", &SweepResult::m_decoding_time),
+            csv_column("DecodingRate", &SweepResult::m_decoding_rate),
+            csv_column("BPP", &SweepResult::m_bits_per_pixel),
+            csv_column("Lossless", &SweepResult::m_lossless),
+            csv_column("PredictedBPP", &SweepResult::m_predicted_bits_per_pixel, false));
+    }
+};
+
+// Speed versus bpp of one variant over all volumes of one modality
+class SweepSummary
+{
+private:
+    using s = std::string;
+
+public:
+    s m_modality, m_variant;
+    unsigned m_volumes = 0;
+    double m_mean_bits_per_pixel = 0.0, m_mean_encoding_rate = 0.0, m_mean_decoding_rate = 0.0;
+    bool m_lossless = true, m_fastest_lossless = false;
+
+    static constexpr auto schema()
+    {
+        return CSVSchema(
+            csv_column("Modality", &SweepSummary::m_modality),
+            csv_column("Variant", &SweepSummary::m_variant),
+            csv_column("Volumes", &SweepSummary::m_volumes),
+            csv_column("MeanBPP", &SweepSummary::m_mean_bits_per_pixel),
+            csv_column("MeanEncodingRate", &SweepSummary::m_mean_encoding_rate),
+            csv_column("MeanDecodingRate", &SweepSummary::m_mean_decoding_rate),
+            csv_column("Lossless", &SweepSummary::m_lossless),
+            csv_column("FastestLossless", &SweepSummary::m_fastest_lossless));
     }
 };
 
 class ResultSheetCreator
 {
+private:
+    ResultCache *m_cache;
+    std::filesystem::path m_tools_dir; // Of CodecRunner, to recompute cache keys; empty if not known
+
+    // The cached run of one config of a volume: by its exact key when the config file and the codec tools are
+    // at hand, so a changed config or encoder never borrows old numbers; otherwise the latest lossless run of
+    // that config, e.g. for configs that were only handed over in memory
+    bool cached_run(const std::filesystem::path &dir, Codec codec, const std::string &name, const std::string &file_name,
+                    CacheEntry &entry) const
+    {
+        namespace fs = std::filesystem;
+        CodecFiles files = get_codec_files(codec);
+        Hash128 input_hash, codec_hash;
+        if (!m_cache->hash_file(dir / (name + ".raw"), input_hash))
+            return false;
+        fs::path config_path = dir / (file_name + files.m_config_ext);
+        if (m_tools_dir.empty() || !fs::exists(config_path))
+            return m_cache->lookup_latest(codec, file_name, input_hash, entry);
+
+        std::ifstream config(config_path, std::ios::binary);
+        std::string config_text((std::istreambuf_iterator<char>(config)), std::istreambuf_iterator<char>());
+        if (!config || !m_cache->hash_codec(m_tools_dir / files.m_name, codec, codec_hash))
+            return false;
+        return m_cache->lookup(ResultCache::make_key(input_hash, codec_hash, config_text, name), entry) &&
+               entry.m_verified;
+    }
+
+    // Killed, timed out or crashed, as logged by CodecRunner; MISMATCH runs did finish and are reported
+    static bool is_failed_run(const LogEntry &entry)
+    {
+        return !entry.m_status.empty() && entry.m_status != "OK" && entry.m_status != "MISMATCH";
+    }
+
+    // Time and status of every run in a log, keyed by config file name without ./ and extension
+    // Logs are appended to, so the latest run of a config wins
+    static bool read_log(const std::filesystem::path &log_path, std::map<std::string, std::pair<double, bool>> &runs)
+    {
+        CSVReader reader;
+        if (!reader.open(log_path))
+            return false;
+        CSVRow row;
+        auto schema = LogEntry::schema();
+        if (reader.read_row(row))
+            schema.bind(row);
+        LogEntry entry;
+        while (reader.read_row(row))
+        {
+            if (!schema.read(row, entry))
+                continue; // Repeated header
+            std::string_view name = entry.config_name();
+            if (!name.empty())
+                runs[std::string(name)] = {entry.m_time, entry.m_status.empty() || entry.m_status == "OK"};
+        }
+        return true;
+    }
+
+    // Index of the results by name, views into their m_name; duplicate volumes are reported and dropped
+    static NameIndex index_results(std::vector<Result> &results, const std::filesystem::path &metadata_path)
+    {
+        NameIndex index(results.size());
+        std::vector<bool> duplicate(results.size(), false);
+        bool any_duplicate = false;
+        for (uint32_t i = 0; i < results.size(); ++i)
+        {
+            if (!index.insert(results[i].m_name, i))
+            {
+                std::cerr << metadata_path << ": " << results[i].m_name << " is listed more than once, keeping the first" << std::endl;
+                duplicate[i] = true;
+                any_duplicate = true;
+            }
+        }
+        if (!any_duplicate)
+            return index;
+        size_t kept = 0;
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (duplicate[i])
+                continue;
+            if (kept != i)
+                results[kept] = std::move(results[i]);
+            ++kept;
+        }
+        results.erase(results.begin() + kept, results.end());
+        return index_results(results, metadata_path); // Moving the names invalidated the views
+    }
+
+    // Fills the encoding or decoding times from a log; the latest run of a volume wins since logs are appended to
+    // Rows for volumes missing from conv_metadata.csv and volumes logged more than once are reported
+    static bool join_log(const std::filesystem::path &log_path, const NameIndex &index, std::vector<Result> &results, bool encoding)
+    {
+        CSVReader reader;
+        if (!reader.open(log_path))
+            return false;
+        std::vector<bool> seen(results.size(), false);
+        std::vector<std::string> unmatched, repeated; // First few of each, for the report
+        size_t unmatched_rows = 0, repeated_rows = 0;
+        CSVRow row;
+        auto schema = LogEntry::schema();
+        if (reader.read_row(row))
+            schema.bind(row);
+        LogEntry entry;
+        while (reader.read_row(row))
+        {
+            if (!schema.read(row, entry))
+                continue; // Repeated header
+            std::string_view name = entry.config_name();
+            if (name.empty())
+                continue;
+            if (name.find(VARIANT_SEPARATOR) != std::string_view::npos)
+                continue; // Sweep variants, see run_sweep
+
+            uint32_t i = index.find(name);
+            if (i == NameIndex::npos)
+            {
+                if (unmatched.size() < 5)
+                    unmatched.emplace_back(name);
+                ++unmatched_rows;
+                continue;
+            }
+            if (seen[i])
+            {
+                if (repeated.size() < 5)
+                    repeated.emplace_back(name);
+                ++repeated_rows;
+            }
+            seen[i] = true;
+
+            Result &result = results[i];
+            bool failed = is_failed_run(entry);
+            (encoding ? result.m_enc_failed : result.m_dec_failed) = failed;
+            (encoding ? result.m_encoding_time : result.m_decoding_time) = failed ? -1.0 : entry.m_time;
+        }
+
+        auto report = [&log_path](size_t rows, const std::vector<std::string> &names, const char *what) {
+            if (!rows)
+                return;
+            std::cerr << log_path << ": " << rows << " rows " << what << " (";
+            for (size_t i = 0; i < names.size(); ++i)
+                std::cerr << (i ? ", " : "") << names[i];
+            std::cerr << (rows > names.size() ? ", ...)" : ")") << std::endl;
+        };
+        report(unmatched_rows, unmatched, "for volumes not in conv_metadata.csv");
+        report(repeated_rows, repeated, "repeating an earlier run, the latest was kept");
+        return true;
+    }
+
+    // 1. conv_metadata.csv of one directory, read and indexed once for the sheets of all codecs
+    struct Collection
+    {
+        std::filesystem::path m_dir;
+        std::vector<Result> m_results;
+        NameIndex m_index; // Views into m_results, so a Collection stays where it was built
+
+        // Finished sheets and the volumes whose runs failed, per codec, for the dataset index
+        std::mutex m_mutex;
+        std::map<Codec, std::vector<Result>> m_sheets;
+        std::map<Codec, std::vector<std::string>> m_failed;
+    };
+
+    // From the dataset index when it is up to date, otherwise from conv_metadata.csv
+    static bool read_metadata(const std::filesystem::path &metadata_path, Collection &collection)
+    {
+        collection.m_dir = metadata_path.parent_path();
+        DatasetIndex index;
+        if (DatasetIndex::is_fresh(collection.m_dir) && index.open(DatasetIndex::path_for(collection.m_dir)))
+        {
+            const int32_t *widths = index.column<int32_t>("Width", DatasetIndex::I32);
+            const int32_t *heights = index.column<int32_t>("Height", DatasetIndex::I32);
+            const int32_t *depths = index.column<int32_t>("Depth", DatasetIndex::I32);
+            const uint8_t *bit_depths = index.column<uint8_t>("BitDepth", DatasetIndex::U8);
+            const uint8_t *orientations = index.column<uint8_t>("Orientation", DatasetIndex::U8);
+            if (widths && heights && depths)
+            {
+                for (size_t i = 0; i < index.size(); ++i)
+                {
+                    collection.m_results.push_back(Result(std::string(index.name(i)), widths[i], heights[i], depths[i]));
+                    collection.m_results.back().m_bit_depth = bit_depths ? bit_depths[i] : 0;
+                    if (orientations)
+                        collection.m_results.back().m_orientation = std::string(orientation_name((Orientation)orientations[i]));
+                }
+                collection.m_index = index_results(collection.m_results, metadata_path);
+                return true;
+            }
+        }
+
+        CSVReader reader;
+        if (!reader.open(metadata_path))
+            return false;
+        CSVRow row;
+        auto schema = FileMetadata::converted_schema();
+        if (reader.read_row(row) && !schema.bind(row))
+        {
+            std::cerr << metadata_path << " lacks some of its columns" << std::endl;
+            return false;
+        }
+        FileMetadata metadata;
+        while (reader.read_row(row))
+        {
+            if (schema.read(row, metadata))
+            {
+                collection.m_results.push_back(Result(metadata.m_result_name, metadata.m_width, metadata.m_height, metadata.m_depth));
+                collection.m_results.back().m_bit_depth = metadata.m_bit_depth;
+                collection.m_results.back().m_orientation = std::string(orientation_name(metadata.orientation()));
+            }
+        }
+        collection.m_index = index_results(collection.m_results, metadata_path);
+        return true;
+    }
+
+    // 2.-5. One codec's sheet of one directory, on a copy of the shared results
+    bool create_sheet(Collection &collection, Codec codec) const
+    {
+        namespace fs = std::filesystem;
+        try
+        {
+            std::vector<Result> results = collection.m_results;
+            // We assume that we have all the necessary artifacts for producing results
+            const fs::path &parent_path = collection.m_dir;
+            // Set codec specific names
+            CodecFiles files = get_codec_files(codec);
+            std::string log_enc_name = files.m_log_enc_name;
+            std::string log_dec_name = files.m_log_dec_name;
+            std::string enc_ext = files.m_enc_ext;
+            std::string result_file_name = files.m_result_file_name;
+            { // 2.-3. Join the encoding and decoding logs through the index of the volume names
+                if (!join_log(parent_path / log_enc_name, collection.m_index, results, true))
+                {
+                    // CSVReader::open leaves errno set
+                    std::cerr << "Error while opening encoding log: " << strerror(errno);
+                    return false;
+                }
+                if (!join_log(parent_path / log_dec_name, collection.m_index, results, false))
+                {
+                    // CSVReader::open leaves errno set
+                    std::cerr << "Error while opening decoding log: " << strerror(errno);
+                    return false;
+                }
+            }
+            if (m_cache)
+            { // 3b. Fill in whatever the logs and bitstreams no longer tell us from earlier runs
+                for (auto &result : results)
+                {
+                    bool has_bitstream = fs::exists(parent_path / (result.m_name + enc_ext));
+                    if (result.m_enc_failed || result.m_dec_failed)
+                        continue;
+                    if (has_bitstream && result.has_times())
+                        continue;
+                    CacheEntry entry;
+                    if (!cached_run(parent_path, codec, result.m_name, result.m_name, entry))
+                        continue;
+                    if (result.m_encoding_time < 0.0)
+                        result.m_encoding_time = entry.m_encoding_time;
+                    if (result.m_decoding_time < 0.0)
+                        result.m_decoding_time = entry.m_decoding_time;
+                    if (!has_bitstream)
+                        result.m_bitstream_size = entry.m_bitstream_size;
+                }
+            }
+            { // 3c. Runs the runner killed or saw crash have nothing to report
+                std::vector<std::string> failed_names;
+                for (const auto &result : results)
+                {
+                    if (result.m_enc_failed || result.m_dec_failed)
+                        failed_names.push_back(result.m_name);
+                }
+                std::lock_guard<std::mutex> lock(collection.m_mutex);
+                collection.m_failed[codec] = std::move(failed_names);
+                auto failed = std::remove_if(results.begin(), results.end(), [&](const Result &result) {
+                    bool skip = result.m_enc_failed || result.m_dec_failed || !result.has_times();
+                    if (skip)
+                        std::cerr << "Skipping " << files.m_name << " " << result.m_name << ": no successful run logged" << std::endl;
+                    else if (!result.m_bitstream_size && !fs::exists(parent_path / (result.m_name + enc_ext)))
+                    {
+                        // Neither the bitstream nor a cached run of the config as it is now
+                        std::cerr << "Skipping " << files.m_name << " " << result.m_name << ": no bitstream" << std::endl;
+                        skip = true;
+                    }
+                    return skip;
+                });
+                results.erase(failed, results.end());
+            }
+            { // 4. Calculate the rest of the parameters
+                for (auto &result : results)
+                    result.compute_rates(result.m_bitstream_size ? result.m_bitstream_size : fs::file_size(parent_path / (result.m_name + enc_ext)));
+            }
+            { // 5. Save results in csv
+                fs::path result_file_path = parent_path / result_file_name;
+                std::ofstream result_fstream(result_file_path);
+                if (result_fstream)
+                {
+                    std::string buffer = Result::get_info_header();
+                    for (const auto &r : results)
+                        r.get_info(buffer);
+                    result_fstream << buffer;
+                }
+                else
+                {
+                    std::cerr << "Could not create final result csv" << std::endl;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(collection.m_mutex);
+                collection.m_sheets[codec] = results;
+            }
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Writes the finished sheets into the dataset index of the directory, creating it from conv_metadata.csv
+    // if there is none yet; codecs that were not part of this run keep what the index had
+    static bool update_index(Collection &collection)
+    {
+        namespace fs = std::filesystem;
+        std::vector<DatasetRow> rows;
+        {
+            DatasetIndex index;
+            if (DatasetIndex::is_fresh(collection.m_dir) && index.open(DatasetIndex::path_for(collection.m_dir)))
+            {
+                for (size_t i = 0; i < index.size(); ++i)
+                    rows.push_back(index.row(i));
+            }
+            else
+            {
+                CSVReader reader;
+                if (!reader.open(collection.m_dir / "conv_metadata.csv"))
+                    return false;
+                CSVRow row;
+                auto schema = FileMetadata::converted_schema();
+                if (reader.read_row(row) && !schema.bind(row))
+                    return false;
+                FileMetadata metadata;
+                while (reader.read_row(row))
+                {
+                    if (!schema.read(row, metadata))
+                        continue;
+                    std::error_code ec;
+                    uintmax_t raw_bytes = fs::file_size(collection.m_dir / (metadata.m_result_name + ".raw"), ec);
+                    metadata.m_raw_bytes = ec ? 0 : raw_bytes;
+                    rows.emplace_back();
+                    metadata.to_index(rows.back());
+                }
+            }
+        }
+
+        NameIndex names(rows.size());
+        for (uint32_t i = 0; i < rows.size(); ++i)
+            names.insert(rows[i].m_name, i);
+        for (const auto &[codec, sheet] : collection.m_sheets)
+        {
+            for (auto &row : rows)
+                row.m_results[codec] = DatasetRow::CodecResult();
+            for (const auto &result : sheet)
+            {
+                uint32_t i = names.find(result.m_name);
+                if (i != NameIndex::npos)
+                    result.to_index(rows[i].m_results[codec]);
+            }
+            for (const auto &name : collection.m_failed[codec])
+            {
+                uint32_t i = names.find(name);
+                if (i != NameIndex::npos)
+                    rows[i].m_results[codec].m_status = DatasetIndex::FAILED;
+            }
+        }
+        return DatasetIndex::write(DatasetIndex::path_for(collection.m_dir), rows);
+    }
+
 public:
-    bool run(const std::filesystem::path &collection_dir, Codec codec)
+    ResultSheetCreator(ResultCache *cache = nullptr) : m_cache(cache) {}
+
+    // The tools directory CodecRunner was given, lets the cache be searched by exact keys
+    void set_tools_dir(const std::filesystem::path &tools_dir)
+    {
+        m_tools_dir = tools_dir;
+    }
+
+    // Per-variant speed-vs-bpp tables for configs written in CodecConfigCreator sweep mode
+    // <CODEC>-sweep-results.csv has one row per volume and variant,
+    // <CODEC>-sweep-summary.csv averages them per modality and marks the fastest lossless variant
+    bool run_sweep(const std::filesystem::path &collection_dir, Codec codec)
     {
         namespace fs = std::filesystem;
         try
@@ -72,166 +577,133 @@ public:
             {
                 if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
                 {
-                    std::vector<Result> results;
-                    { // 1. Open conv_metadata.csv
-                        std::ifstream csvFile(entry.path().string());
-                        if (csvFile)
-                        {
-                            CSVRow row;
-                            row.readNextRow(csvFile); // Skip the header
-                            while (row.readNextRow(csvFile))
-                            {
-                                using RFC = Result::FieldConv;
-                                results.push_back(
-                                    Result(
-                                        row[RFC::Name],
-                                        row[RFC::Width],
-                                        row[RFC::Height],
-                                        row[RFC::Depth]));
-                            }
-                        }
-                        else
-                        {
-                            // Weird ifstream error reporting part
-                            std::cerr << "Error while opening converted metadata: " << strerror(errno);
-                            return false;
-                        }
-                    }
-                    // We assume that we have all the necessary artifacts for producing results
                     fs::path parent_path = entry.path().parent_path();
-                    std::string log_enc_name, log_dec_name, enc_ext, result_file_name;
-                    // Set codec specific names
-                    switch (codec)
+                    CodecFiles files = get_codec_files(codec);
+
+                    // 1. Volume shapes and modalities
+                    std::map<std::string, std::tuple<std::string, uintmax_t, double>> volumes; // Name -> modality, pixels, predicted bpp
                     {
-                    case (AVC):
-                        log_enc_name = "AVC-enc.log";
-                        log_dec_name = "AVC-dec.log";
-                        enc_ext = ".264e";
-                        result_file_name = "AVC-results.csv";
-                        break;
-                    case (HEVC):
-                        log_enc_name = "HEVC-enc.log";
-                        log_dec_name = "HEVC-dec.log";
-                        enc_ext = ".265e";
-                        result_file_name = "HEVC-results.csv";
-                        break;
-                    case (VVC):
-                        log_enc_name = "VVC-enc.log";
-                        log_dec_name = "VVC-dec.log";
-                        enc_ext = ".266e";
-                        result_file_name = "VVC-results.csv";
-                        break;
-                    case (JP3D):
-                        log_enc_name = "JP3D-enc.log";
-                        log_dec_name = "JP3D-dec.log";
-                        enc_ext = ".jp3de";
-                        result_file_name = "JP3D-results.csv";
-                        break;
-                    }
-                    { // 2. Open encoding log
-                        fs::path log_path = parent_path / log_enc_name;
-                        std::ifstream csvFile(log_path.string());
-                        if (csvFile)
+                        CSVReader reader;
+                        if (!reader.open(entry.path()))
                         {
-                            CSVRow row;
-                            row.readNextRow(csvFile); // Skip the header
-                            while (row.readNextRow(csvFile))
-                            {
-                                using RFT = Result::FieldTime;
-                                using s = std::string;
-                                s name = s(row[RFT::FileName]);
-                                size_t dot_index = name.find_last_of("."); // Remove .cfg*
-                                if (dot_index != s::npos)
-                                    name = name.substr(2, dot_index - 2);
-                                for (auto &result : results)
-                                {
-                                    if (result.m_name == name)
-                                    {
-                                        result.m_encoding_time = s(row[RFT::Time]);
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            // Weird ifstream error reporting part
-                            std::cerr << "Error while opening encoding log: " << strerror(errno);
+                            std::cerr << "Error while opening converted metadata: " << strerror(errno);
                             return false;
                         }
-                    }
-                    { // 3. Open decoding log
-                        fs::path log_path = parent_path / log_dec_name;
-                        std::ifstream csvFile(log_path.string());
-                        if (csvFile)
-                        {
-                            CSVRow row;
-                            row.readNextRow(csvFile); // Skip the header
-                            while (row.readNextRow(csvFile))
-                            {
-                                using RFT = Result::FieldTime;
-                                using s = std::string;
-                                s name = s(row[RFT::FileName]);
-                                size_t dot_index = name.find_last_of("."); // Remove .cfg*
-                                if (dot_index != s::npos)
-                                    name = name.substr(2, dot_index - 2);
-                                for (auto &result : results)
-                                {
-                                    if (result.m_name == name)
-                                    {
-                                        result.m_decoding_time = s(row[RFT::Time]);
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        else
+                        CSVRow row;
+                        auto schema = FileMetadata::converted_schema();
+                        if (reader.read_row(row) && !schema.bind(row))
                         {
-                            // Weird ifstream error reporting part
-                            std::cerr << "Error while opening decoding log: " << strerror(errno);
+                            std::cerr << entry.path() << " lacks some of its columns" << std::endl;
                             return false;
                         }
-                    }
-                    { // 4. Calculate the rest of the parameters
-                        for (auto &result : results)
+                        FileMetadata metadata;
+                        while (reader.read_row(row))
                         {
-                            // Pixels
-                            int w = std::stoi(result.m_width);
-                            int h = std::stoi(result.m_height);
-                            int d = std::stoi(result.m_depth);
-                            uintmax_t pixels = w * h * d;
-
-                            // Bits per pixel [bits/pixels]
-                            uintmax_t enc_size_in_bits = fs::file_size(parent_path / (result.m_name + enc_ext)) * 8;
-                            double bpp = (double)enc_size_in_bits / (double)pixels;
-                            result.m_bits_per_pixel = bpp;
-
-                            // Encoding rate [10^6 * pixels/seconds]
-                            double enc_time = std::stod(result.m_encoding_time);
-                            double encoding_rate = ((double)pixels / (double)enc_time) / 1000000.0;
-                            result.m_encoding_rate = encoding_rate;
-
-                            // Decoding rate [10^6 * pixels/seconds]
-                            double dec_time = std::stod(result.m_decoding_time);
-                            double decoding_rate = ((double)pixels / (double)dec_time) / 1000000.0;
-                            result.m_decoding_rate = decoding_rate;
+                            if (!schema.read(row, metadata))
+                                continue;
+                            uintmax_t pixels = (uintmax_t)metadata.m_width * metadata.m_height * metadata.m_depth;
+                            Compressibility compressibility = metadata.compressibility();
+                            double predicted = compressibility.is_known() ? compressibility.predicted_bpp() : 0.0;
+                            volumes[metadata.m_result_name] = {metadata.m_modality, pixels, predicted};
                         }
                     }
-                    { // 5. Save results in csv
-                        fs::path result_file_path = parent_path / result_file_name;
-                        std::ofstream result_fstream(result_file_path);
-                        if (result_fstream)
-                        {
-                            result_fstream << Result::get_info_header();
-                            for (const auto &r : results)
-                            {
-                                result_fstream << r.get_info() << "\n";
-                            }
-                        }
+
+                    // 2. Encoding and decoding logs
+                    std::map<std::string, std::pair<double, bool>> enc_runs, dec_runs;
+                    if (!read_log(parent_path / files.m_log_enc_name, enc_runs) ||
+                        !read_log(parent_path / files.m_log_dec_name, dec_runs))
+                    {
+                        std::cerr << "Error while opening logs: " << strerror(errno);
+                        return false;
+                    }
+
+                    // 3. One row per run that has both an encode and a decode
+                    std::vector<SweepResult> results;
+                    for (const auto &[file_name, enc_run] : enc_runs)
+                    {
+                        auto [name, variant] = ConfigVariant::split_file_name(file_name);
+                        auto volume = volumes.find(name);
+                        auto dec_run = dec_runs.find(file_name);
+                        if (volume == volumes.end() || dec_run == dec_runs.end() || !enc_run.second)
+                            continue;
+                        // Runs the runner answered from the cache left no bitstream, the cache has its size
+                        fs::path bitstream = parent_path / (file_name + files.m_enc_ext);
+                        uintmax_t bitstream_size = 0;
+                        CacheEntry entry;
+                        if (fs::exists(bitstream))
+                            bitstream_size = fs::file_size(bitstream);
+                        else if (m_cache && cached_run(parent_path, codec, name, file_name, entry))
+                            bitstream_size = entry.m_bitstream_size;
                         else
                         {
-                            std::cerr << "Could not create final result csv" << std::endl;
+                            std::cerr << "Skipping " << files.m_name << " " << file_name << ": no bitstream" << std::endl;
+                            continue;
                         }
+
+                        const auto &[modality, volume_pixels, predicted] = volume->second;
+                        double pixels = (double)volume_pixels;
+                        SweepResult result;
+                        result.m_name = name;
+                        result.m_modality = modality;
+                        result.m_predicted_bits_per_pixel = predicted;
+                        result.m_variant = variant.empty() ? "default" : variant;
+                        result.m_encoding_time = enc_run.first;
+                        result.m_decoding_time = dec_run->second.first;
+                        result.m_encoding_rate = (pixels / enc_run.first) / 1000000.0;
+                        result.m_decoding_rate = (pixels / dec_run->second.first) / 1000000.0;
+                        result.m_bits_per_pixel = (double)(bitstream_size * 8) / pixels;
+                        result.m_lossless = dec_run->second.second;
+                        results.push_back(result);
+                    }
+
+                    // 4. Average per modality and variant
+                    std::map<std::pair<std::string, std::string>, SweepSummary> summaries;
+                    for (const auto &result : results)
+                    {
+                        SweepSummary &summary = summaries[{result.m_modality, result.m_variant}];
+                        summary.m_modality = result.m_modality;
+                        summary.m_variant = result.m_variant;
+                        summary.m_volumes++;
+                        summary.m_mean_bits_per_pixel += result.m_bits_per_pixel;
+                        summary.m_mean_encoding_rate += result.m_encoding_rate;
+                        summary.m_mean_decoding_rate += result.m_decoding_rate;
+                        summary.m_lossless = summary.m_lossless && result.m_lossless;
+                    }
+                    std::map<std::string, SweepSummary *> fastest; // Modality -> fastest lossless variant
+                    for (auto &[key, summary] : summaries)
+                    {
+                        summary.m_mean_bits_per_pixel /= summary.m_volumes;
+                        summary.m_mean_encoding_rate /= summary.m_volumes;
+                        summary.m_mean_decoding_rate /= summary.m_volumes;
+                        SweepSummary *&best = fastest[summary.m_modality];
+                        if (summary.m_lossless && (!best || summary.m_mean_encoding_rate > best->m_mean_encoding_rate))
+                            best = &summary;
+                    }
+                    for (auto &[modality, best] : fastest)
+                        if (best)
+                            best->m_fastest_lossless = true;
+
+                    // 5. Save both tables
+                    std::ofstream results_fstream(parent_path / (files.m_name + "-sweep-results.csv"));
+                    std::ofstream summary_fstream(parent_path / (files.m_name + "-sweep-summary.csv"));
+                    if (results_fstream && summary_fstream)
+                    {
+                        std::string buffer;
+                        auto result_schema = SweepResult::schema();
+                        result_schema.write_header(buffer);
+                        for (const auto &r : results)
+                            result_schema.write(r, buffer);
+                        results_fstream << buffer;
+                        buffer.clear();
+                        auto summary_schema = SweepSummary::schema();
+                        summary_schema.write_header(buffer);
+                        for (const auto &[key, summary] : summaries)
+                            summary_schema.write(summary, buffer);
+                        summary_fstream << buffer;
+                    }
+                    else
+                    {
+                        std::cerr << "Could not create sweep result csv" << std::endl;
                     }
                 }
             }
@@ -244,4 +716,66 @@ public:
         }
         return true;
     }
+
+    // Walks the tree once, reads every conv_metadata.csv once, then writes the sheets of all the codecs
+    // for all the directories in parallel
+    bool run(const std::filesystem::path &collection_dir, const std::vector<Codec> &codecs,
+             unsigned jobs = std::thread::hardware_concurrency())
+    {
+        namespace fs = std::filesystem;
+        std::vector<std::unique_ptr<Collection>> collections;
+        try
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(collection_dir))
+            {
+                if (entry.is_regular_file() && entry.path().filename() == "conv_metadata.csv")
+                {
+                    auto collection = std::make_unique<Collection>();
+                    if (!read_metadata(entry.path(), *collection))
+                    {
+                        // CSVReader::open leaves errno set
+                        std::cerr << "Error while opening converted metadata: " << strerror(errno);
+                        return false;
+                    }
+                    collections.push_back(std::move(collection));
+                }
+            }
+        }
+        catch (...) // Too lazy to check what it can throw, just give me the error code
+        {
+            std::exception_ptr p = std::current_exception();
+            std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            return false;
+        }
+
+        std::atomic<bool> ok{true};
+        ThreadPool pool(jobs);
+        for (const auto &collection : collections)
+        {
+            for (Codec codec : codecs)
+            {
+                Collection *shared = collection.get();
+                pool.submit([this, shared, codec, &ok] {
+                    if (!create_sheet(*shared, codec))
+                        ok = false;
+                });
+            }
+        }
+        pool.wait();
+
+        for (const auto &collection : collections)
+        {
+            if (!update_index(*collection))
+            {
+                std::cerr << "Could not update the dataset index in " << collection->m_dir << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    bool run(const std::filesystem::path &collection_dir, Codec codec)
+    {
+        return run(collection_dir, std::vector<Codec>{codec}, 1);
+    }
 };
\ No newline at end of file
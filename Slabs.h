@@ -0,0 +1,447 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Bricks.h"
+#include "Compressibility.h"
+#include "Crop.h"
+#include "Digest.h"
+#include "Hash.h"
+#include "Histogram.h"
+#include "Reslice.h"
+#include "ThreadPool.h"
+
+// A converted 8 bit volume, .raw or bricked, handed out a slab of whole slices at a time so that only a bounded
+// part of it is ever in memory. Slabs of a .raw are the mapping itself, the next one is asked for ahead and the
+// finished one given back to the kernel; slabs of a bricked file are decoded into two buffers, the next one
+// while the current one is being visited.
+class SlabReader
+{
+private:
+    const uint8_t *m_data = nullptr; // Mapped .raw
+    size_t m_size = 0;
+    BrickedVolume m_bricked;
+    bool m_is_bricked = false;
+    int m_width = 0, m_height = 0, m_depth = 0;
+
+    static size_t page_size()
+    {
+        static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    // madvise wants whole pages; WILLNEED may round outwards, DONTNEED must not touch the neighbours' pages
+    void advise(size_t begin, size_t end, int advice) const
+    {
+        size_t page = page_size();
+        if (advice == MADV_DONTNEED)
+        {
+            begin = (begin + page - 1) / page * page;
+            end = end / page * page;
+        }
+        else
+        {
+            begin = begin / page * page;
+            end = std::min(m_size, (end + page - 1) / page * page);
+        }
+        if (begin < end)
+            madvise(const_cast<uint8_t *>(m_data) + begin, end - begin, advice);
+    }
+
+public:
+    SlabReader() = default;
+    SlabReader(const SlabReader &) = delete;
+    SlabReader &operator=(const SlabReader &) = delete;
+    ~SlabReader()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if (m_data && m_size)
+            munmap(const_cast<uint8_t *>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_is_bricked = false;
+        m_width = m_height = m_depth = 0;
+    }
+
+    // The stored volume of a converted row: <name>.raw, or <name>.ntbrick where the collection was converted
+    // BRICKED and there is no .raw of it
+    static std::filesystem::path volume_path(const std::filesystem::path &dir, const std::string &name)
+    {
+        std::filesystem::path raw_path = dir / (name + ".raw");
+        std::filesystem::path bricked_path = dir / (name + BrickedVolume::EXTENSION);
+        std::error_code ec;
+        return !std::filesystem::exists(raw_path, ec) && std::filesystem::exists(bricked_path, ec) ? bricked_path : raw_path;
+    }
+
+    // A .raw of the given dimensions, or a bricked volume (which knows its own); false with errno set on failure
+    bool open(const std::filesystem::path &path, int width = 0, int height = 0, int depth = 0)
+    {
+        close();
+        if (path.extension() == BrickedVolume::EXTENSION)
+        {
+            if (!m_bricked.open(path))
+                return false;
+            m_is_bricked = true;
+            m_width = m_bricked.width();
+            m_height = m_bricked.height();
+            m_depth = m_bricked.depth();
+            return true;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        size_t voxels = (size_t)width * height * depth;
+        if (fstat(fd, &st) != 0 || !voxels || (size_t)st.st_size != voxels)
+        {
+            ::close(fd);
+            errno = EINVAL;
+            return false;
+        }
+        void *data = mmap(nullptr, voxels, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            errno = error;
+            return false;
+        }
+        m_data = static_cast<const uint8_t *>(data);
+        m_size = voxels;
+        m_width = width;
+        m_height = height;
+        m_depth = depth;
+        madvise(data, voxels, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    int width() const
+    {
+        return m_width;
+    }
+
+    int height() const
+    {
+        return m_height;
+    }
+
+    int depth() const
+    {
+        return m_depth;
+    }
+
+    size_t slice_size() const
+    {
+        return (size_t)m_width * m_height;
+    }
+
+    bool is_bricked() const
+    {
+        return m_is_bricked;
+    }
+
+    // Of a bricked volume, 0 for a .raw
+    int brick_size() const
+    {
+        return m_is_bricked ? m_bricked.brick_size() : 0;
+    }
+
+    // The whole volume in memory, for the steps that are not done slab by slab
+    bool read_all(std::vector<uint8_t> &volume, unsigned threads = 0) const
+    {
+        if (m_is_bricked)
+            return m_bricked.read_all(volume, threads);
+        if (!m_data)
+            return false;
+        volume.assign(m_data, m_data + m_size);
+        return true;
+    }
+
+    // Slices per slab when the slab being visited and the one read ahead have to fit budget bytes together,
+    // whole bricks deep where bricks fit; never less than one slice
+    int slab_depth(size_t budget) const
+    {
+        size_t slices = slice_size() ? budget / 2 / slice_size() : 1;
+        slices = std::clamp<size_t>(slices, 1, (size_t)std::max(1, m_depth));
+        if (m_is_bricked && slices >= (size_t)m_bricked.brick_size())
+            slices -= slices % m_bricked.brick_size();
+        return (int)slices;
+    }
+
+    // Calls visit(slab, first, slices) for consecutive slabs from the top, false as soon as a read or visit fails
+    // The slab pointer is only valid during the call; threads are for decoding bricks, 0 means one per core
+    bool for_each(size_t budget, const std::function<bool(const uint8_t *, int, int)> &visit, unsigned threads = 0) const
+    {
+        int slab = slab_depth(budget);
+        if (!m_is_bricked)
+        {
+            if (!m_data)
+                return false;
+            size_t slice = slice_size();
+            for (int first = 0; first < m_depth; first += slab)
+            {
+                int slices = std::min(slab, m_depth - first);
+                size_t begin = first * slice, end = begin + slices * slice;
+                advise(end, std::min(m_size, end + slab * slice), MADV_WILLNEED);
+                if (!visit(m_data + begin, first, slices))
+                    return false;
+                advise(begin, end, MADV_DONTNEED);
+            }
+            return true;
+        }
+
+        std::vector<uint8_t> current((size_t)slab * slice_size()), next(current.size());
+        if (!m_bricked.read_slab(0, std::min(slab, m_depth), current.data(), threads))
+            return false;
+        ThreadPool reader(1);
+        for (int first = 0; first < m_depth; first += slab)
+        {
+            int slices = std::min(slab, m_depth - first), ahead = first + slab;
+            bool read_ok = true;
+            if (ahead < m_depth)
+                reader.submit([&, ahead] { read_ok = m_bricked.read_slab(ahead, std::min(slab, m_depth - ahead), next.data(), threads); });
+            bool go_on = visit(current.data(), first, slices);
+            reader.wait();
+            if (!go_on || !read_ok)
+                return false;
+            current.swap(next);
+        }
+        return true;
+    }
+};
+
+// Whole-volume steps of the converter, done slab by slab over a SlabReader within a memory budget in bytes
+// Each slab is worked on in parallel as far as the step allows
+class OutOfCore
+{
+public:
+    // What one pass over a volume finds out
+    struct Scan
+    {
+        Histogram<uint8_t> m_histogram;
+        Hash128 m_checksum;
+        CropBox m_box; // Around the voxels that are not 0, empty if there are none or it was not asked for
+    };
+
+private:
+    // Appends to a file and hashes what it appended, the volume it writes is checksummed for free
+    struct HashedWriter
+    {
+        std::ofstream m_file;
+        XXH3 m_hash;
+        VolumeDigest *m_digest;
+
+        HashedWriter(const std::filesystem::path &path, VolumeDigest *digest)
+            : m_file(path, std::ios::binary | std::ios::trunc), m_digest(digest)
+        {
+        }
+
+        bool write(const uint8_t *data, size_t size)
+        {
+            m_hash.update(data, size);
+            if (m_digest)
+                m_digest->update(data, size);
+            return (bool)m_file.write(reinterpret_cast<const char *>(data), (std::streamsize)size);
+        }
+    };
+
+    static void grow(CropBox &box, const CropBox &slab_box, int first)
+    {
+        if (slab_box.is_empty())
+            return;
+        CropBox found = slab_box;
+        found.m_z += first;
+        if (box.is_empty())
+        {
+            box = found;
+            return;
+        }
+        int x1 = std::max(box.m_x + box.m_width, found.m_x + found.m_width);
+        int y1 = std::max(box.m_y + box.m_height, found.m_y + found.m_height);
+        int z1 = std::max(box.m_z + box.m_depth, found.m_z + found.m_depth);
+        box.m_x = std::min(box.m_x, found.m_x);
+        box.m_y = std::min(box.m_y, found.m_y);
+        box.m_z = std::min(box.m_z, found.m_z);
+        box.m_width = x1 - box.m_x;
+        box.m_height = y1 - box.m_y;
+        box.m_depth = z1 - box.m_z;
+    }
+
+public:
+    // Histogram, checksum and, with find_box, the crop box in one pass; the checksum is hashed on a thread of its
+    // own next to the rest, it is the one part that cannot be split; digest, if given, is fed the volume as well
+    static bool scan(const SlabReader &reader, size_t budget, bool find_box, Scan &result, unsigned threads = 0,
+                     VolumeDigest *digest = nullptr)
+    {
+        result = Scan();
+        XXH3 hash;
+        ThreadPool hasher(1);
+        bool ok = reader.for_each(budget, [&](const uint8_t *slab, int first, int slices)
+                                  {
+                                      size_t size = reader.slice_size() * slices;
+                                      hasher.submit([&hash, digest, slab, size]
+                                                    {
+                                                        hash.update(slab, size);
+                                                        if (digest)
+                                                            digest->update(slab, size);
+                                                    });
+                                      result.m_histogram.merge(Histogram<uint8_t>::of(slab, size, threads));
+                                      if (find_box)
+                                          grow(result.m_box, BorderCropper::find_box(slab, reader.width(), reader.height(), slices, 0, threads), first);
+                                      hasher.wait();
+                                      return true;
+                                  }, threads);
+        result.m_checksum = hash.digest128();
+        return ok;
+    }
+
+    // CompressibilityAnalyzer::analyze of the volume, one slab at a time
+    static bool analyze(const SlabReader &reader, size_t budget, Compressibility &result, unsigned threads = 0)
+    {
+        CompressibilityAnalyzer::Accumulator accumulator(reader.width(), reader.height());
+        bool ok = reader.for_each(budget, [&](const uint8_t *slab, int, int slices)
+                                  {
+                                      accumulator.add(slab, slices, threads);
+                                      return true;
+                                  }, threads);
+        result = accumulator.result();
+        return ok;
+    }
+
+    // The box of the volume into its own .raw; written, if given, gets the histogram and checksum of what was written
+    static bool write_box(const SlabReader &reader, size_t budget, const CropBox &box, const std::filesystem::path &path,
+                          Scan *written = nullptr, unsigned threads = 0, VolumeDigest *digest = nullptr)
+    {
+        HashedWriter out(path, digest);
+        std::vector<uint8_t> rows;
+        if (written)
+            written->m_histogram = Histogram<uint8_t>(); // Of the box only, not of the scan it may come from
+        bool ok = reader.for_each(budget, [&](const uint8_t *slab, int first, int slices)
+                                  {
+                                      int z0 = std::max(first, box.m_z), z1 = std::min(first + slices, box.m_z + box.m_depth);
+                                      if (z0 >= z1)
+                                          return true;
+                                      CropBox part{box.m_x, box.m_y, z0 - first, box.m_width, box.m_height, z1 - z0};
+                                      rows.resize((size_t)part.m_width * part.m_height * part.m_depth);
+                                      BorderCropper::crop(slab, reader.width(), reader.height(), part, rows.data());
+                                      if (written)
+                                          written->m_histogram.merge(Histogram<uint8_t>::of(rows.data(), rows.size(), threads));
+                                      return out.write(rows.data(), rows.size());
+                                  }, threads);
+        out.m_file.close();
+        if (!ok || !out.m_file)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        if (written)
+            written->m_checksum = out.m_hash.digest128();
+        return true;
+    }
+
+    // Every voxel through a level table, e.g. Histogram::packing_table, into a .raw of the same dimensions
+    static bool map_levels(const SlabReader &reader, size_t budget, const std::vector<uint8_t> &table,
+                           const std::filesystem::path &path, unsigned threads = 0, VolumeDigest *digest = nullptr)
+    {
+        if (table.size() < 256)
+            return false;
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        HashedWriter out(path, digest);
+        std::vector<uint8_t> mapped;
+        ThreadPool pool(threads);
+        bool ok = reader.for_each(budget, [&](const uint8_t *slab, int, int slices)
+                                  {
+                                      size_t size = reader.slice_size() * slices;
+                                      mapped.resize(size);
+                                      for (unsigned t = 0; t < threads; ++t)
+                                      {
+                                          size_t begin = size * t / threads, end = size * (t + 1) / threads;
+                                          pool.submit([&, begin, end]
+                                                      {
+                                                          for (size_t i = begin; i < end; ++i)
+                                                              mapped[i] = table[slab[i]];
+                                                      });
+                                      }
+                                      pool.wait();
+                                      return out.write(mapped.data(), size);
+                                  }, threads);
+        out.m_file.close();
+        if (!ok || !out.m_file)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // The volume resliced into a .raw at path; the slab and its resliced copy share the budget with the slab read
+    // ahead. Resliced, a slab is one contiguous run per output frame, so each goes out with a single pwrite
+    static bool reslice(const SlabReader &reader, size_t budget, Orientation orientation, const std::filesystem::path &path,
+                        VolumeDigest *digest = nullptr, unsigned threads = 0)
+    {
+        int width = reader.width(), height = reader.height(), depth = reader.depth();
+        size_t voxels = reader.slice_size() * depth;
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)voxels) != 0)
+        {
+            std::cerr << "Error creating " << path << ": " << strerror(errno) << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        // Frames are width wide for XZ, height wide for YZ, and there is one of them per row or column of a slice
+        size_t frame_row = orientation == ORIENT_YZ ? (size_t)height : (size_t)width;
+        int frames = orientation == ORIENT_YZ ? width : orientation == ORIENT_XZ ? height : 1;
+        std::vector<uint8_t> resliced;
+        bool ok = reader.for_each(budget / 3 * 2, [&](const uint8_t *slab, int first, int slices)
+                                  {
+                                      size_t size = reader.slice_size() * slices;
+                                      resliced.resize(size);
+                                      Reslicer::reslice(slab, width, height, slices, orientation, resliced.data(), threads);
+                                      size_t run = size / frames;
+                                      for (int frame = 0; frame < frames; ++frame)
+                                      {
+                                          off_t offset = (off_t)(((size_t)frame * depth + first) * frame_row);
+                                          if (orientation == ORIENT_XY)
+                                              offset = (off_t)(first * reader.slice_size());
+                                          const uint8_t *from = resliced.data() + frame * run;
+                                          size_t done = 0;
+                                          while (done < run)
+                                          {
+                                              ssize_t put = pwrite(fd, from + done, run - done, offset + (off_t)done);
+                                              if (put < 0 && errno == EINTR)
+                                                  continue;
+                                              if (put <= 0)
+                                                  return false;
+                                              done += (size_t)put;
+                                          }
+                                      }
+                                      return true;
+                                  }, threads);
+        ok = ::close(fd) == 0 && ok;
+        if (!ok)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        // Frames are written out of order, so the digest is one more sequential read
+        return !digest || VolumeDigest::of_file(path, digest->slice_size(), digest->has_crc32c(), *digest);
+    }
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers draining a FIFO of jobs
+class ThreadPool
+{
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_job_ready, m_all_done;
+    unsigned m_busy = 0;
+    bool m_stopping = false;
+
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_ready.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                    return; // Stopping and nothing left
+                job = std::move(m_jobs.front());
+                m_jobs.pop();
+                ++m_busy;
+            }
+            try
+            {
+                job();
+            }
+            catch (...) // Jobs report their own errors, a throwing one must not take the worker down
+            {
+                std::exception_ptr p = std::current_exception();
+                std::cerr << (p ? p.__cxa_exception_type()->name() : "null") << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_busy;
+                if (m_busy == 0 && m_jobs.empty())
+                    m_all_done.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+    {
+        if (threads == 0)
+            threads = 1;
+        for (unsigned i = 0; i < threads; ++i)
+            m_workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_job_ready.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    unsigned size() const
+    {
+        return (unsigned)m_workers.size();
+    }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push(std::move(job));
+        }
+        m_job_ready.notify_one();
+    }
+
+    // Blocks until every submitted job has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_all_done.wait(lock, [this] { return m_busy == 0 && m_jobs.empty(); });
+    }
+};
@@ -1,14 +1,31 @@
 // #define CONVERT_DICOM
+//#define ANALYZE_COMPRESSIBILITY
+//#define CROP_CONVERTED
+//#define DEDUP_CONVERTED
+//#define RESLICE_CONVERTED
  //#define CREATE_CONFIGS
 //#define SANDBOX
+//#define RUN_CODECS
+//#define USE_MOCK_CODECS
+//#define IN_MEMORY_CONFIGS
+//#define AUTO_TUNE
+//#define EVICT_CACHE
+//#define EXPORT_CSV_FROM_INDEX
  #define CREATE_RESULTS_FOR_CODEC
 
-#ifdef CONVERT_DICOM
+#if defined(CONVERT_DICOM) || defined(ANALYZE_COMPRESSIBILITY) || defined(CROP_CONVERTED) || defined(DEDUP_CONVERTED) || \
+    defined(RESLICE_CONVERTED)
 #include "DicomConverter.h"
 #endif
+#ifdef CONVERT_DICOM
+#include "BatchConverter.h"
+#endif
 #ifdef CREATE_CONFIGS
 #include "CodecConfigCreator.h"
 #endif
+#ifdef AUTO_TUNE
+#include "AutoTuner.h"
+#endif
 #ifdef SANDBOX
 #include "CImg.h"
 #include "FileMetadata.h"
@@ -17,7 +34,13 @@
 #include <fstream>
 #include <filesystem>
 #endif
-#ifdef CREATE_RESULTS_FOR_CODEC
+#ifdef RUN_CODECS
+#include "CodecRunner.h"
+#endif
+#if defined(RUN_CODECS) || defined(EVICT_CACHE) || defined(CREATE_RESULTS_FOR_CODEC)
+#include "ResultCache.h"
+#endif
+#if defined(CREATE_RESULTS_FOR_CODEC) || defined(EXPORT_CSV_FROM_INDEX)
 #include "ResultSheetCreator.h"
 #endif
 
@@ -40,7 +63,7 @@ int main()
             Img img = Img::get_load_cimg(entry.path().c_str());
             img.save_raw(newpath.c_str());
 
-            FileMetadata meta = FileMetadata(bruy, bruy, bruy, bruy);
+            FileMetadata meta = FileMetadata(bruy, bruy, 0, bruy);
 
             std::string fname = newpath.filename();
             meta.set_image_params(
@@ -58,79 +81,165 @@ int main()
     std::ofstream conv_metadata(converted_metadatas);
     if (conv_metadata)
     {
-        conv_metadata << FileMetadata::get_info_header();
+        std::string buffer = FileMetadata::get_info_header();
         for (const auto &m : metas)
         {
             if (m.m_converted)
-                conv_metadata << m.get_info() << "\n";
+                m.get_info(buffer);
         }
+        conv_metadata << buffer;
     }
 #endif
 
 #ifdef CONVERT_DICOM
-    using F = ImageFormat;
-    // {
-    //     // QIN-BREAST -> manifest-1542731172463
-    //     DicomConverter QINBREAST(8, 50, 3, false, false, F::RAW);
-    //     QINBREAST.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1542731172463");
-    //     QINBREAST.convert("/media/hamster/Hamster Old/NTWI/OurSet", "QIN-BREAST");
-    // }
-    // {
-    //     // CPTAC-LUAD -> manifest-1677266397124
-    //     DicomConverter CPTACLUAD(8, 50, 3, false, false, F::RAW);
-    //     CPTACLUAD.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1677266397124");
-    //     CPTACLUAD.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CPTAC-LUAD");
-    // }
-    // {
-    //     // CPTAC-SAR  -> manifest-1677267704131
-    //     DicomConverter CPTACSAR(8, 50, 3, false, false, F::RAW);
-    //     CPTACSAR.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1677267704131");
-    //     CPTACSAR.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CPTAC-SAR");
-    // }
-    // {
-    //     // CPTAC-PDA  -> manifest-1692386697723
-    //     DicomConverter CPTACPDA(8, 50, 3, false, false, F::RAW);
-    //     CPTACPDA.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1692386697723");
-    //     CPTACPDA.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CPTAC-PDA");
-    // }
-    // {
-    //     // CPTAC-UCEC -> manifest-1712342731330
-    //     DicomConverter CPTACUCEC(8, 50, 3, false, false, F::RAW);
-    //     CPTACUCEC.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1712342731330");
-    //     CPTACUCEC.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CPTAC-UCEC");
-    // }
-    // {
-    //     // CMB-CRC    -> manifest-1722776407088
-    //     DicomConverter CMBCRC(8, 50, 3, false, false, F::RAW);
-    //     CMBCRC.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1722776407088");
-    //     CMBCRC.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CMB-CRC");
-    // }
-    // {
-    //     // CMB-LCA    -> manifest-1722777127284
-    //     DicomConverter CMBLCA(8, 50, 3, false, false, F::RAW);
-    //     CMBLCA.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1722777127284");
-    //     CMBLCA.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CMB-LCA");
-    // }
+    // Every collection at once, each series on the pool; the same entries can come from a csv with
+    // batch.load(".../collections.csv"), columns ManifestDir,Collection and optionally the quotas
+    BatchConverter batch("/media/hamster/Hamster Old/NTWI/OurSet", ImageFormat::RAW);
+    //batch.set_defaults(8, 50, 3); // Per modality, min slices, min slices of US
+    batch.configure([](DicomConverter & /*converter*/)
+                    {
+                        //converter.set_crop_borders();
+                        //converter.set_brick_options(64); // With ImageFormat::BRICKED instead of RAW
+                        //converter.set_memory_budget(size_t(4) << 30); // Series larger than RAM
+                        //converter.set_crc32c(); // CRC32C in the digest sidecars as well
+                    });
+    const std::string data_dir = "/media/hamster/Hamster Old/NTWI/Data/";
+    //batch.add({data_dir + "manifest-1542731172463", "QIN-BREAST"});
+    //batch.add({data_dir + "manifest-1677266397124", "CPTAC-LUAD"});
+    //batch.add({data_dir + "manifest-1677267704131", "CPTAC-SAR"});
+    //batch.add({data_dir + "manifest-1692386697723", "CPTAC-PDA"});
+    //batch.add({data_dir + "manifest-1712342731330", "CPTAC-UCEC"});
+    //batch.add({data_dir + "manifest-1722776407088", "CMB-CRC"});
+    //batch.add({data_dir + "manifest-1722777127284", "CMB-LCA"});
+    batch.add({data_dir + "manifest-1722777380915", "CMB-MEL"});
+    // Conversions hold whole volumes, let the governor admit them
+    //MemoryGovernor::instance().set_budget(48ull << 30);
+    batch.run();
+#endif
+
+#ifdef CROP_CONVERTED
+    // Zero borders off volumes converted without set_crop_borders, before anything is encoded
+    DicomConverter::crop_converted("/media/hamster/Hamster Old/NTWI/OurSet"/*, 0, size_t(4) << 30*/);
+#endif
+
+#ifdef DEDUP_CONVERTED
+    // Series TCIA lists more than once, across all collections, are encoded once; after cropping, before reslicing
+    DicomConverter::dedup_converted("/media/hamster/Hamster Old/NTWI/OurSet"/*, DUPLICATE_HARD_LINK*/);
+#endif
+
+#ifdef RESLICE_CONVERTED
+    // XZ and YZ copies of every volume next to it, configs and runs then cover all three coding axes
+    DicomConverter::reslice_converted("/media/hamster/Hamster Old/NTWI/OurSet");
+#endif
+
+#ifdef ANALYZE_COMPRESSIBILITY
+    // Entropy and gradient columns for collections converted before conversion computed them
+    DicomConverter::analyze_converted("/media/hamster/Hamster Old/NTWI/OurSet"/*, 0, size_t(4) << 30*/);
+#endif
+
+#ifdef AUTO_TUNE
+    // Per-volume settings from a few encoded slabs, left in <CODEC>-tuning.csv for use_tuning below
+    for (Codec codec : {JP3D, HEVC, VVC})
     {
-        // CMB-MEL    -> manifest-1722777127284
-        DicomConverter CMBMEL(8, 50, 3, false, false, F::RAW);
-        CMBMEL.load_metadatas("/media/hamster/Hamster Old/NTWI/Data/manifest-1722777380915");
-        CMBMEL.convert("/media/hamster/Hamster Old/NTWI/OurSet", "CMB-MEL");
+        AutoTuner tuner(codec, std::filesystem::path(__FILE__).parent_path() / "tools");
+        //tuner.set_tolerance(0.05);
+        tuner.run("/media/hamster/Hamster Old/NTWI/OurSet/Bruylants");
     }
 #endif
 
 #ifdef CREATE_CONFIGS
                         // JP3D   AVC    HEVC    VVC
     CodecConfigCreator ccc(true, true, true, true);
+    // Sweep mode, one config per grid point next to the default one
+    //ccc.set_sweep(ParameterGrid(HEVC).add("GOPSize", {"1", "4"}).add("IntraPeriod", {"1", "4"}).add("QuadtreeTULog2MaxSize", {"3", "4", "5"}));
+    //ccc.set_sweep(ParameterGrid(VVC).add("CTUSize", {"64", "128"}).add("TransformSkipLog2MaxSize", {"3", "5"}));
+    //ccc.set_sweep(ParameterGrid(JP3D).add("levels", {"2,2,1", "4,4,2"}).add("cblk", {"32,32,32", "64,64,64"}));
+    // Take what AUTO_TUNE picked for each volume
+    //ccc.use_tuning();
     //ccc.run("/media/hamster/Hamster Old/NTWI/OurSet");
     ccc.run("/media/hamster/Hamster Old/NTWI/OurSet/Bruylants");
 #endif
 
+#if defined(RUN_CODECS) || defined(EVICT_CACHE) || defined(CREATE_RESULTS_FOR_CODEC)
+    // Shared by the runner and the result sheets, keyed by input, codec binaries and config
+    ResultCache cache("/media/hamster/Hamster Old/NTWI/OurSet/ntcomp-cache.csv");
+    cache.load();
+#endif
+
+#ifdef EVICT_CACHE
+    // Pick whatever should be forgotten, then persist
+    //std::cout << cache.evict_codec(VVC) << " entries evicted" << std::endl;
+    //std::cout << cache.evict_older_than(std::chrono::hours(24 * 30)) << " entries evicted" << std::endl;
+    std::cout << cache.evict_unverified() << " entries evicted" << std::endl;
+    cache.save();
+#endif
+
+#ifdef RUN_CODECS
+    // Same job as tools/*/run.sh, but only changed inputs or configs are encoded again
+#ifdef USE_MOCK_CODECS
+    // Stand-ins built from tools/mock, for timing the runner, cache and result sheets without the real codecs
+    // NTCOMP_MOCK_FRAME_DELAY_MS and friends in the environment make them as slow as needed
+    std::filesystem::path tools_dir = NTCOMP_MOCK_TOOLS_DIR;
+#else
+    std::filesystem::path tools_dir = std::filesystem::path(__FILE__).parent_path() / "tools";
+#endif
+#ifdef IN_MEMORY_CONFIGS
+    // Configs are rendered by the runner and handed to the tools as memfds, no CREATE_CONFIGS needed;
+    // give this creator the same set_sweep calls to run sweep variants
+    CodecConfigCreator in_memory(true, true, true, true);
+    //in_memory.use_tuning();
+#endif
+    // Peak memory per voxel of every codec, what concurrent jobs are admitted by
+    MemoryGovernor::instance().load_history("/media/hamster/Hamster Old/NTWI/OurSet/ntcomp-memory.csv");
+    //MemoryGovernor::instance().set_budget(48ull << 30);
+    for (Codec codec : {JP3D, AVC, HEVC, VVC})
+    {
+        CodecRunner runner(codec, tools_dir, &cache, 1);
+#ifdef IN_MEMORY_CONFIGS
+        runner.set_config_creator(&in_memory);
+#endif
+        ProcessLimits limits;
+        limits.m_wall_time = 12 * 3600.0;     // No volume of ours needs half a day
+        limits.m_max_rss = 16ull << 30;       // Keep the host out of swap
+        runner.set_limits(limits);
+        // Leave out volumes predicted to be trivial or hopeless, start the longest ones first
+        //runner.set_prediction_limits(0.05, 7.5);
+        //runner.rank_by_prediction();
+        runner.run("/media/hamster/Hamster Old/NTWI/OurSet/Bruylants");
+    }
+    MemoryGovernor::instance().save_history("/media/hamster/Hamster Old/NTWI/OurSet/ntcomp-memory.csv");
+#endif
+
+#ifdef EXPORT_CSV_FROM_INDEX
+    // Text versions of every dataset index, e.g. when only the .ntidx files were copied off the server
+    for (const auto &entry : std::filesystem::recursive_directory_iterator("/media/hamster/Hamster Old/NTWI/OurSet"))
+    {
+        if (!entry.is_regular_file() || entry.path().filename() != DatasetIndex::FILE_NAME)
+            continue;
+        DatasetIndex index;
+        if (!index.open(entry.path()))
+        {
+            std::cerr << "Could not open " << entry.path() << ": " << strerror(errno) << std::endl;
+            continue;
+        }
+        std::filesystem::path dir = entry.path().parent_path();
+        FileMetadata::export_csv(index, dir / "conv_metadata.csv");
+        for (Codec codec : {JP3D, AVC, HEVC, VVC})
+            Result::export_csv(index, codec, dir / get_codec_files(codec).m_result_file_name);
+        // The index is still the newest truth, keep readers using it
+        std::filesystem::last_write_time(entry.path(), std::filesystem::file_time_type::clock::now());
+    }
+#endif
+
 #ifdef CREATE_RESULTS_FOR_CODEC
-    ResultSheetCreator rsc;
-    rsc.run("/media/hamster/Hamster Old/NTWI/OurSet", JP3D);
-    rsc.run("/media/hamster/Hamster Old/NTWI/OurSet", AVC);
-    rsc.run("/media/hamster/Hamster Old/NTWI/OurSet", HEVC);
-    rsc.run("/media/hamster/Hamster Old/NTWI/OurSet", VVC);
+    ResultSheetCreator rsc(&cache);
+    // The tools CodecRunner had, so runs answered from the cache are matched by their exact key
+#ifdef USE_MOCK_CODECS
+    rsc.set_tools_dir(NTCOMP_MOCK_TOOLS_DIR);
+#else
+    rsc.set_tools_dir(std::filesystem::path(__FILE__).parent_path() / "tools");
+#endif
+    rsc.run("/media/hamster/Hamster Old/NTWI/OurSet", {JP3D, AVC, HEVC, VVC});
+    //rsc.run_sweep("/media/hamster/Hamster Old/NTWI/OurSet", HEVC);
 #endif
 }
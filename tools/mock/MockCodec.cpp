@@ -0,0 +1,347 @@
+// Stand-in for the reference codecs, for benchmarking the runner and the result pipeline offline
+// Behaves like whichever tool it is called as (argv[0], or the first argument when called as NTMockCodec):
+//   lencod -d default.cfg -f override.cfg [-p Key=Value]   ldecod -d decoder.cfg
+//   TAppEncoder -c cfg                                       TAppDecoder -b bitstream -o output [-d bits]
+//   EncoderApp -c cfg                                        DecoderApp -b bitstream -o output
+//   jp3d -c --size=W,H,D [--key=value ...] input output      jp3d -d input output
+// Bitstreams are real and decode losslessly (LosslessCoder per frame), and the encoders print the same
+// per-frame lines as the real ones. Environment knobs:
+//   NTCOMP_MOCK_FRAME_DELAY_MS   extra encode time per frame
+//   NTCOMP_MOCK_DECODE_DELAY_MS  extra decode time per frame
+//   NTCOMP_MOCK_STARTUP_DELAY_MS extra time before doing anything
+//   NTCOMP_MOCK_RSS_MB           memory to touch and hold, to exercise the runner's limits
+//   NTCOMP_MOCK_EXIT_CODE        exit with this code after the work, to exercise failure handling
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../LosslessCoder.h"
+
+namespace
+{
+    using Config = std::map<std::string, std::string>;
+
+    const char MAGIC[4] = {'N', 'T', 'M', 'C'};
+
+    struct Shape
+    {
+        uint32_t m_width = 0, m_height = 0, m_depth = 0, m_sample_bytes = 1;
+
+        size_t frame_bytes() const
+        {
+            return (size_t)m_width * m_height * m_sample_bytes;
+        }
+    };
+
+    long env_number(const char *name)
+    {
+        const char *value = getenv(name);
+        return value ? atol(value) : 0;
+    }
+
+    void sleep_ms(long ms)
+    {
+        if (ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    std::string trim(const std::string &text)
+    {
+        size_t start = text.find_first_not_of(" \t\r\"");
+        if (start == std::string::npos)
+            return "";
+        size_t end = text.find_last_not_of(" \t\r\"");
+        return text.substr(start, end + 1 - start);
+    }
+
+    // "Key: value" (HM, VTM) and "Key = value" (JM) lines, # starts a comment
+    bool read_config(const std::string &path, Config &config)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cerr << "Cannot open config " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            size_t sep = line.find_first_of(":=");
+            if (sep == std::string::npos)
+                continue;
+            std::string key = trim(line.substr(0, sep));
+            if (!key.empty())
+                config[key] = trim(line.substr(sep + 1));
+        }
+        return true;
+    }
+
+    uint32_t config_number(const Config &config, const std::string &key, uint32_t fallback = 0)
+    {
+        auto found = config.find(key);
+        return found == config.end() ? fallback : (uint32_t)strtoul(found->second.c_str(), nullptr, 10);
+    }
+
+    std::string config_text(const Config &config, const std::string &key)
+    {
+        auto found = config.find(key);
+        return found == config.end() ? "" : found->second;
+    }
+
+    void hold_memory()
+    {
+        static std::vector<char> ballast;
+        long mb = env_number("NTCOMP_MOCK_RSS_MB");
+        if (mb > 0)
+            ballast.assign((size_t)mb << 20, 1);
+    }
+
+    // Codes input into a bitstream, calls on_frame(index, bits, seconds) after each frame
+    template <typename OnFrame>
+    bool encode(const std::string &input, const std::string &output, const Shape &shape, OnFrame on_frame)
+    {
+        std::ifstream in(input, std::ios::binary);
+        std::ofstream out(output, std::ios::binary);
+        if (!in || !out)
+        {
+            std::cerr << "Cannot open " << input << " or " << output << std::endl;
+            return false;
+        }
+        out.write(MAGIC, 4);
+        uint32_t header[4] = {shape.m_width, shape.m_height, shape.m_depth, shape.m_sample_bytes};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+        long frame_delay = env_number("NTCOMP_MOCK_FRAME_DELAY_MS");
+        std::vector<uint8_t> frame(shape.frame_bytes()), coded;
+        for (uint32_t z = 0; z < shape.m_depth; ++z)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!in.read(reinterpret_cast<char *>(frame.data()), frame.size()))
+            {
+                std::cerr << "Input ends before frame " << z << std::endl;
+                return false;
+            }
+            coded.clear();
+            LosslessCoder::encode(frame.data(), frame.size(), coded);
+            uint32_t coded_size = (uint32_t)coded.size();
+            out.write(reinterpret_cast<const char *>(&coded_size), sizeof(coded_size));
+            out.write(reinterpret_cast<const char *>(coded.data()), coded.size());
+            sleep_ms(frame_delay);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            on_frame(z, (unsigned long long)(coded.size() + sizeof(coded_size)) * 8, seconds);
+        }
+        return (bool)out;
+    }
+
+    // Decodes a bitstream to raw frames, optionally also writing them to a second file
+    bool decode(const std::string &input, const std::string &output)
+    {
+        std::ifstream in(input, std::ios::binary);
+        std::ofstream out(output, std::ios::binary);
+        char magic[4];
+        uint32_t header[4];
+        if (!in || !out || !in.read(magic, 4) || memcmp(magic, MAGIC, 4) != 0 ||
+            !in.read(reinterpret_cast<char *>(header), sizeof(header)))
+        {
+            std::cerr << "Not a mock bitstream: " << input << std::endl;
+            return false;
+        }
+        Shape shape{header[0], header[1], header[2], header[3]};
+        long frame_delay = env_number("NTCOMP_MOCK_DECODE_DELAY_MS");
+        std::vector<uint8_t> frame(shape.frame_bytes()), coded;
+        for (uint32_t z = 0; z < shape.m_depth; ++z)
+        {
+            uint32_t coded_size = 0;
+            if (!in.read(reinterpret_cast<char *>(&coded_size), sizeof(coded_size)))
+                return false;
+            coded.resize(coded_size);
+            if (!in.read(reinterpret_cast<char *>(coded.data()), coded_size) ||
+                !LosslessCoder::decode(coded.data(), coded.size(), frame.data(), frame.size()))
+            {
+                std::cerr << "Corrupt frame " << z << " in " << input << std::endl;
+                return false;
+            }
+            out.write(reinterpret_cast<const char *>(frame.data()), frame.size());
+            sleep_ms(frame_delay);
+        }
+        return (bool)out;
+    }
+
+    int run_jm_encoder(int argc, char **argv)
+    {
+        Config config;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if ((arg == "-d" || arg == "-f") && i + 1 < argc)
+            {
+                if (!read_config(argv[++i], config))
+                    return 1;
+            }
+            else if (arg == "-p" && i + 1 < argc)
+            {
+                std::string pair = argv[++i];
+                size_t eq = pair.find('=');
+                if (eq != std::string::npos)
+                    config[trim(pair.substr(0, eq))] = trim(pair.substr(eq + 1));
+            }
+        }
+        Shape shape{config_number(config, "SourceWidth"), config_number(config, "SourceHeight"),
+                    config_number(config, "FramesToBeEncoded"), config_number(config, "SourceBitDepthLuma", 8) > 8 ? 2u : 1u};
+
+        printf("-------------------------------------------------------------------------------\n");
+        printf(" Frame     Bit/pic    QP   SnrY    SnrU    SnrV    Time(ms) MET(ms) Frm/Fld Ref  \n");
+        printf("-------------------------------------------------------------------------------\n");
+        printf("00000(NVB)     %d \n", 176);
+        double total = 0.0;
+        unsigned long long total_bits = 0;
+        bool ok = encode(config_text(config, "InputFile"), config_text(config, "OutputFile"), shape,
+                         [&](uint32_t z, unsigned long long bits, double seconds) {
+                             printf("%05u(%s) %8llu   0  99.000  99.000  99.000 %9d       0    FRM    1\n",
+                                    z, z == 0 ? "IDR" : " I ", bits, (int)(seconds * 1000.0));
+                             total += seconds;
+                             total_bits += bits;
+                         });
+        if (!ok)
+            return 1;
+
+        // JM also leaves a reconstruction, which for lossless coding is the input
+        std::string recon = config_text(config, "ReconFile");
+        if (!recon.empty())
+            std::filesystem::copy_file(config_text(config, "InputFile"), recon, std::filesystem::copy_options::overwrite_existing);
+
+        std::ofstream stats("stats.dat", std::ios::app);
+        stats << " Total encoding time for the seq.  : " << total << " sec\n";
+        stats << " Total bits                        : " << total_bits << "\n";
+        std::ofstream log("log.dat", std::ios::app);
+        log << "|" << config_text(config, "InputFile") << "|" << shape.m_width << "x" << shape.m_height << "|"
+            << shape.m_depth << "|" << total_bits << "|" << total << "|\n";
+        return 0;
+    }
+
+    int run_jm_decoder(int argc, char **argv)
+    {
+        Config config;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::string(argv[i]) == "-d" && i + 1 < argc && !read_config(argv[++i], config))
+                return 1;
+        }
+        return decode(config_text(config, "InputFile"), config_text(config, "OutputFile")) ? 0 : 1;
+    }
+
+    int run_hm_vtm_encoder(int argc, char **argv, bool vtm)
+    {
+        Config config;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::string(argv[i]) == "-c" && i + 1 < argc && !read_config(argv[++i], config))
+                return 1;
+        }
+        Shape shape{config_number(config, "SourceWidth"), config_number(config, "SourceHeight"),
+                    config_number(config, "FramesToBeEncoded"), config_number(config, "InputBitDepth", 8) > 8 ? 2u : 1u};
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = encode(config_text(config, "InputFile"), config_text(config, "BitstreamFile"), shape,
+                         [&](uint32_t z, unsigned long long bits, double) {
+                             double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                             if (vtm)
+                                 printf("POC %4u LId:  0 TId: 0 ( IDR_N_LP, I-SLICE, QP 0 ) %10llu bits [Y 99.9900 dB    U 99.9900 dB    V 99.9900 dB] [ET %5.0f ] [L0 ] [L1 ]\n",
+                                        z, bits, elapsed);
+                             else
+                                 printf("POC %4u TId: 0 ( I-SLICE, nQP   0 QP   0 ) %10llu bits [Y 99.9900 dB    U 99.9900 dB    V 99.9900 dB] [ET %5.0f ] [L0 ] [L1 ]\n",
+                                        z, bits, elapsed);
+                             start = std::chrono::steady_clock::now();
+                         });
+        return ok ? 0 : 1;
+    }
+
+    int run_hm_vtm_decoder(int argc, char **argv)
+    {
+        std::string bitstream, output;
+        for (int i = 1; i + 1 < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-b")
+                bitstream = argv[++i];
+            else if (arg == "-o")
+                output = argv[++i];
+        }
+        return decode(bitstream, output) ? 0 : 1;
+    }
+
+    int run_jp3d(int argc, char **argv)
+    {
+        bool compress = false, decompress = false;
+        Shape shape;
+        std::vector<std::string> files;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-c")
+                compress = true;
+            else if (arg == "-d")
+                decompress = true;
+            else if (arg.rfind("--size=", 0) == 0)
+                sscanf(arg.c_str() + 7, "%u,%u,%u", &shape.m_width, &shape.m_height, &shape.m_depth);
+            else if (arg.rfind("--", 0) != 0)
+                files.push_back(arg);
+        }
+        if (files.size() != 2 || compress == decompress)
+        {
+            std::cerr << "Usage: jp3d -c --size=W,H,D [options] input output | jp3d -d input output" << std::endl;
+            return 2;
+        }
+        if (decompress)
+            return decode(files[0], files[1]) ? 0 : 1;
+        return encode(files[0], files[1], shape, [](uint32_t, unsigned long long, double) {}) ? 0 : 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string tool = std::filesystem::path(argv[0]).filename().string();
+    if (tool == "NTMockCodec" && argc > 1)
+    {
+        // Called directly: NTMockCodec <tool> args...
+        tool = argv[1];
+        ++argv;
+        --argc;
+    }
+
+    sleep_ms(env_number("NTCOMP_MOCK_STARTUP_DELAY_MS"));
+    hold_memory();
+
+    int code;
+    if (tool == "lencod")
+        code = run_jm_encoder(argc, argv);
+    else if (tool == "ldecod")
+        code = run_jm_decoder(argc, argv);
+    else if (tool == "TAppEncoder")
+        code = run_hm_vtm_encoder(argc, argv, false);
+    else if (tool == "EncoderApp")
+        code = run_hm_vtm_encoder(argc, argv, true);
+    else if (tool == "TAppDecoder" || tool == "DecoderApp")
+        code = run_hm_vtm_decoder(argc, argv);
+    else if (tool == "jp3d")
+        code = run_jp3d(argc, argv);
+    else
+    {
+        std::cerr << "Unknown tool " << tool << ", call me as lencod, ldecod, TAppEncoder, TAppDecoder, EncoderApp, DecoderApp or jp3d" << std::endl;
+        return 2;
+    }
+    fflush(stdout);
+
+    if (code == 0 && getenv("NTCOMP_MOCK_EXIT_CODE"))
+        code = (int)env_number("NTCOMP_MOCK_EXIT_CODE");
+    return code;
+}